@@ -1,6 +1,11 @@
 // Define the WebSocket connection
 var webSocket = new WebSocket("ws://192.168.1.101:8000");
 
+// Every command carries an id, the server echoes it in the response. Commands
+// are sent without waiting, responses to reads may overtake earlier changes.
+var nextCommandId = 1;
+var pendingCommands = {};
+
 //--- WebSocket event handlers ---//
 // WebSocket connection opened
 webSocket.onopen = function(event) {
@@ -25,6 +30,13 @@ webSocket.onmessage = function(message) {
     var data = JSON.parse(message.data);
     var action = data.action;
 
+    // Hand the response to the callback of its command
+    if(data.id !== undefined && pendingCommands[data.id]) {
+        var callback = pendingCommands[data.id];
+        delete pendingCommands[data.id];
+        callback(data);
+    }
+
     if(data.type === "CommandResponse") {
         // Handle the response to a command
         var status = data.status;
@@ -99,31 +111,38 @@ function attachEventListeners() {
     // SUN Button clicked
     document.getElementById('sun-btn').addEventListener('click', function() {
         console.log("SUN button clicked");
+        sendCommand({ action: "apply_scene", scene: "SUN" });
     });
 
     // CLOUD Button clicked
     document.getElementById('cloud-btn').addEventListener('click', function() {
         console.log("CLOUD button clicked");
+        sendCommand({ action: "apply_scene", scene: "CLOUD" });
     });
 
     // RAIN Button clicked
     document.getElementById('rain-btn').addEventListener('click', function() {
         console.log("RAIN button clicked");
+        sendCommand({ action: "apply_scene", scene: "RAIN" });
     });
 
     // SNOW Button clicked
     document.getElementById('snow-btn').addEventListener('click', function() {
         console.log("SNOW button clicked");
+        sendCommand({ action: "apply_scene", scene: "SNOW" });
     });
 
     // GHOST Button clicked
     document.getElementById('ghost-btn').addEventListener('click', function() {
         console.log("GHOST button clicked");
+        sendCommand({ action: "apply_scene", scene: "GHOST" });
     });
 
     // AUTO Button clicked
     document.getElementById('auto-btn').addEventListener('click', function() {
         console.log("AUTO button clicked");
+        // Let the server-side thermostat control the heater
+        sendCommand({ action: "write", utility: "thermostat", value: "pid" });
     });
 }
 
@@ -141,7 +160,12 @@ $(document).ready(function() {
 });
 
 // Function to send a JSON command to the server
-function sendCommand(commandObject) {
+// onResponse is optionally called with the response to this command
+function sendCommand(commandObject, onResponse) {
+    commandObject.id = nextCommandId++;
+    if(onResponse) {
+        pendingCommands[commandObject.id] = onResponse;
+    }
     var commandJSON = JSON.stringify(commandObject);
     webSocket.send(commandJSON);
     console.log("Command sent: ", commandJSON);
@@ -15,6 +15,7 @@
  ******************************************************************************/
 /*
  *  functions  global:
+ * 				setWebhouseDebug
  * 				initWebhouse
  * 				closeWebhouse
  * 				turnTVOn
@@ -22,6 +23,8 @@
  * 				getTVState
  * 				dimDLed
  * 				dimSLed
+ * 				fadeRLamp
+ * 				fadeSLamp
  * 				turnLED1On
  * 				turnLED1Off
  * 				getLED1State
@@ -32,6 +35,17 @@
  * 				turnHeizOff
  * 				getHeizState
  * 				getAlarmState
+ * 				updateTemp
+ * 				setWebhouseState
+ * 				getAlarmEventFd
+ * 				readAlarmEvent
+ * 				getTimestamp
+ * 				setThermostat
+ * 				getThermostatMode
+ * 				getThermostatSetpoint
+ * 				getThermostatHysteresis
+ * 				getThermostatOutput
+ * 				stepThermostat
  *             
  ******************************************************************************/
  
@@ -41,10 +55,17 @@
 #include <stdint.h>
 #include <time.h>
 #include <limits.h>
+#include <math.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/eventfd.h>
 
 #include "Webhouse.h"
+#include "energy.h"
+#include "probes.h"
+#include "clock.h"
+#include "thermsim.h"
+#include "log.h"
 
 //----- Macros -----------------------------------------------------------------
 //PWM can only be used in privilege mode
@@ -75,31 +96,114 @@
 #define MAX_TEMP 40
 #define MIN_TEMP 0
 
+//Thermal model: the heater warms the living room (room 0), the other rooms
+//follow through the walls. The outdoor temperature is a daily sine of the
+//clock, coldest at 04:00 UTC
+#define HOUSE_ROOMS 3
+#define OUTDOOR_MEAN 8.0f
+#define OUTDOOR_AMPLITUDE 6.0f
+#define OUTDOOR_COLDEST_S (4 * 3600)
+
 #define HEIZ_ON 1
 #define HEIZ_OFF 0
 
+//Thermostat, the PID output is the heater-on fraction of a window
+#define THERMOSTAT_KP 0.5f			//Output per °C of error
+#define THERMOSTAT_KI 0.005f		//Output per °C and second
+#define THERMOSTAT_KD 1.0f			//Output per °C/s of temperature change
+#define THERMOSTAT_WINDOW_S 20.0f	//Period of the time-proportioned output
+
+//Alarm edge detection
+#define ALARM_POLL_US 250			//Poll interval of the edge detect status
+#define ALARM_DEBOUNCE_US 5000		//Edges within this time after an event are bounces
+#define ALARM_RING_SIZE 64			//Events buffered for the reader, power of 2
+
+//Lamp fades, levels are 16.16 fixed-point duty cycles
+#define FADE_SHIFT 16
+
+//Software PWM periods longer than this are reported as late edges,
+//the nominal period is RANGE * PWM_STEP_NS
+#define PWM_LATE_US 20000
+#define PWM_STEP_NS 100000			//One step of the duty cycle
+
+//----- Data types -------------------------------------------------------------
+#ifndef PWM
+typedef struct {
+	int32_t from;			//Level at the start of the fade
+	int32_t rate;			//Level change per millisecond
+	uint32_t duration;		//Length of the fade in ms, 0 when done
+	uint64_t start;			//Start of the fade in ms
+	uint16_t target;		//Duty cycle at the end of the fade
+} LampFade;
+#endif
+
 //----- Function prototypes ----------------------------------------------------
-static void * threadTemp(void *pdata);
+static void * threadAlarm(void *pdata);
+static void pushAlarmEvent(uint8_t level, uint64_t timestamp, uint16_t bounces);
 
 #ifndef PWM
 static void * threadDimRLamp(void *pdata);
 static void * threadDimSLamp(void *pdata);
+static void * simulateLamp(LampFade *fade, int *dutyCycle);
+static void unlockFade(void *arg);
+static int32_t startFade(LampFade *fade, uint16_t dutyCycle, uint32_t fade_ms);
+static int32_t getFadeLevel(LampFade *fade, uint64_t now);
 #endif
 
 //----- Data -------------------------------------------------------------------
-static pthread_t pThreadTemp;
 static int stateHeiz = HEIZ_OFF;
 static float localTemp = 16.0;
+static ThermalSim house;
+
+static int thermostatMode = THERMOSTAT_OFF;
+static float thermostatSetpoint = 21.0f;
+static float thermostatHysteresis = 0.5f;
+static float pidIntegral = 0.0f;
+static float pidLastTemp = 0.0f;
+static float pidOutput = 0.0f;
+static float pidWindow = 0.0f;			//Seconds into the current output window
+
+static pthread_t pThreadAlarm;
+static int alarmEventFd = -1;
+static int useSystemTimer = 0;
+static volatile int alarmLevel = 0;
+static AlarmEvent alarmRing[ALARM_RING_SIZE];
+static unsigned int alarmHead = 0;		//Written by threadAlarm only
+static unsigned int alarmTail = 0;		//Written by readAlarmEvent only
+static unsigned int alarmDropped = 0;
 
 #ifndef PWM
 static pthread_t pThreadDimRLamp;
 static pthread_t pThreadDimSLamp;
 static int dutyCycleRL = 0;
 static int dutyCycleSL = 0;
+static LampFade fadeRL;
+static LampFade fadeSL;
+static pthread_mutex_t fadeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fadeStarted = PTHREAD_COND_INITIALIZER;
 #endif
 
 //----- Implementation ---------------------------------------------------------
 
+/*******************************************************************************
+ *  function :    setWebhouseDebug
+ ******************************************************************************/
+/** \brief        Stubs out the GPIO access with the bcm2835 debug mode: the
+ *                register accesses are printed instead of performed, so the
+ *                server runs without the hardware and without root. Must be
+ *                called before initWebhouse.
+ *
+ *  \type         global
+ *
+ *  \param[in]    debug    1 to stub the GPIO access, 0 for the hardware
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void setWebhouseDebug(int debug){
+	bcm2835_set_debug(debug ? 1 : 0);
+}
+
 /*******************************************************************************
  *  function :    initWebhouse
  ******************************************************************************/
@@ -114,7 +218,7 @@ static int dutyCycleSL = 0;
  ******************************************************************************/
 void initWebhouse(void){
 	bcm2835_init();
-	printf("GPIO initializion\n");
+	logInfo("GPIO initialized");
 	
 	bcm2835_gpio_fsel(GPIO_TV, OUTPUT);
 	bcm2835_gpio_fsel(GPIO_Heat, OUTPUT);
@@ -137,7 +241,20 @@ void initWebhouse(void){
     bcm2835_pwm_set_range(PWM_CHANNEL1, RANGE);
 #endif
 
-    pthread_create(&pThreadTemp, NULL, threadTemp, NULL);
+	//Latch rising and falling edges of the alarm in the edge detect status
+	bcm2835_gpio_ren(GPIO_Alarm);
+	bcm2835_gpio_fen(GPIO_Alarm);
+	bcm2835_gpio_set_eds(GPIO_Alarm);
+	alarmLevel = bcm2835_gpio_lev(GPIO_Alarm);
+
+	initThermalSim(&house, 1, HOUSE_ROOMS, localTemp);
+
+	//The system timer cannot be read in debug mode and does not follow a
+	//scaled or virtual clock
+	useSystemTimer = getClockMode() == CLOCK_REAL && bcm2835_st_read() != 0;
+	alarmEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pthread_create(&pThreadAlarm, NULL, threadAlarm, NULL);
+
 #ifndef PWM
     pthread_create(&pThreadDimRLamp, NULL, threadDimRLamp, NULL);
     pthread_create(&pThreadDimSLamp, NULL, threadDimSLamp, NULL);
@@ -156,11 +273,16 @@ void initWebhouse(void){
  *
  ******************************************************************************/
 void closeWebhouse(void){
-	pthread_cancel(pThreadTemp);
+	pthread_cancel(pThreadAlarm);
+	pthread_join(pThreadAlarm, NULL);
+	bcm2835_gpio_clr_ren(GPIO_Alarm);
+	bcm2835_gpio_clr_fen(GPIO_Alarm);
+	close(alarmEventFd);
 #ifndef PWM
 	pthread_cancel(pThreadDimRLamp);
 	pthread_cancel(pThreadDimSLamp);
 #endif
+	closeThermalSim(&house);
 	bcm2835_close();
 }
 
@@ -178,6 +300,8 @@ void closeWebhouse(void){
  ******************************************************************************/
 void turnTVOn(void){
 	bcm2835_gpio_write(GPIO_TV, HIGH);
+	PROBE2(gpio_write, GPIO_TV, HIGH);
+	setEnergyLoad(ENERGY_TV, 1.0f);
 }
 
 /*******************************************************************************
@@ -194,6 +318,8 @@ void turnTVOn(void){
  ******************************************************************************/
 void turnTVOff(void){
 	bcm2835_gpio_write(GPIO_TV, LOW);
+	PROBE2(gpio_write, GPIO_TV, LOW);
+	setEnergyLoad(ENERGY_TV, 0.0f);
 }
 
 /*******************************************************************************
@@ -228,13 +354,39 @@ int getTVState(void){
  *
  ******************************************************************************/
 void dimSLamp(uint16_t dudtyCycle){
+	fadeSLamp(dudtyCycle, 0);
+}
+
+/*******************************************************************************
+ *  function :    fadeSLamp
+ ******************************************************************************/
+/** \brief        Fade the stand lamp linearly from its current level to a
+ *                new one. The PWM thread interpolates the level, a new fade
+ *                starts where the running one is. With the hardware PWM the
+ *                level is set at once.
+ *
+ *  \type         global
+ *
+ *  \param[in]    dudtyCycle   Dim level at the end of the fade [0,100]
+ *  \param[in]    fade_ms      Length of the fade in ms, 0 to dim at once
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void fadeSLamp(uint16_t dudtyCycle, uint32_t fade_ms){
 	if(dudtyCycle > 100){
 		dudtyCycle = 100;
 	}
 #ifdef PWM
 	bcm2835_pwm_set_data(PWM_CHANNEL0, dudtyCycle);
+	setEnergyLoad(ENERGY_LAMP_FLOOR, dudtyCycle / (float)RANGE);
 #else
-	dutyCycleSL = dudtyCycle;
+	int32_t from = startFade(&fadeSL, dudtyCycle, fade_ms);
+	if (fade_ms == 0) {
+		dutyCycleSL = dudtyCycle;
+	}
+	//The energy follows the linear ramp of the PWM thread
+	setEnergyFade(ENERGY_LAMP_FLOOR, from / (float)(RANGE << FADE_SHIFT), dudtyCycle / (float)RANGE, fade_ms);
 #endif
 }
 
@@ -254,16 +406,73 @@ void dimSLamp(uint16_t dudtyCycle){
  *
  ******************************************************************************/
 void dimRLamp(uint16_t dudtyCycle){
+	fadeRLamp(dudtyCycle, 0);
+}
+
+/*******************************************************************************
+ *  function :    fadeRLamp
+ ******************************************************************************/
+/** \brief        Fade the roof lamp linearly from its current level to a
+ *                new one, see fadeSLamp.
+ *
+ *  \type         global
+ *
+ *  \param[in]    dudtyCycle   Dim level at the end of the fade [0,100]
+ *  \param[in]    fade_ms      Length of the fade in ms, 0 to dim at once
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void fadeRLamp(uint16_t dudtyCycle, uint32_t fade_ms){
 	if(dudtyCycle > 100){
 		dudtyCycle = 100;
 	}
 #ifdef PWM
 	bcm2835_pwm_set_data(PWM_CHANNEL1, dudtyCycle);
+	setEnergyLoad(ENERGY_LAMP_CEIL, dudtyCycle / (float)RANGE);
 #else
-	dutyCycleRL = dudtyCycle;
+	int32_t from = startFade(&fadeRL, dudtyCycle, fade_ms);
+	if (fade_ms == 0) {
+		dutyCycleRL = dudtyCycle;
+	}
+	//The energy follows the linear ramp of the PWM thread
+	setEnergyFade(ENERGY_LAMP_CEIL, from / (float)(RANGE << FADE_SHIFT), dudtyCycle / (float)RANGE, fade_ms);
 #endif
 }
 
+/*******************************************************************************
+ *  function :    setWebhouseState
+ ******************************************************************************/
+/** \brief        Sets TV, heater and both lamps at once. TV and heater are
+ *                switched with a single masked GPIO write, so restoring a
+ *                saved state shows no intermediate states.
+ *                The webhouse must be initialized (initWebhouse) before this
+ *                function can be called.
+ *
+ *  \type         global
+ *
+ *  \param[in]    tv       1 for TV ON, 0 for TV OFF
+ *  \param[in]    heat     1 for heater ON, 0 for heater OFF
+ *  \param[in]    dutySL   Dim level of the stand lamp [0,100]
+ *  \param[in]    dutyRL   Dim level of the roof lamp [0,100]
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void setWebhouseState(int tv, int heat, uint16_t dutySL, uint16_t dutyRL){
+	uint32_t mask = (1 << GPIO_TV) | (1 << GPIO_Heat);
+	uint32_t value = (tv ? (1 << GPIO_TV) : 0) | (heat ? (1 << GPIO_Heat) : 0);
+
+	bcm2835_gpio_write_mask(value, mask);
+	PROBE2(gpio_write, mask, value);
+	stateHeiz = heat ? HEIZ_ON : HEIZ_OFF;
+	setEnergyLoad(ENERGY_TV, tv ? 1.0f : 0.0f);
+	setEnergyLoad(ENERGY_HEATER, heat ? 1.0f : 0.0f);
+
+	dimSLamp(dutySL);
+	dimRLamp(dutyRL);
+}
+
 /*******************************************************************************
  *  function :    turnLED1On
  ******************************************************************************/
@@ -278,6 +487,7 @@ void dimRLamp(uint16_t dudtyCycle){
  ******************************************************************************/
 void turnLED1On(void){
 	bcm2835_gpio_write(GPIO_LED1, HIGH);
+	PROBE2(gpio_write, GPIO_LED1, HIGH);
 }
 
 /*******************************************************************************
@@ -294,6 +504,7 @@ void turnLED1On(void){
  ******************************************************************************/
 void turnLED1Off(void){
 	bcm2835_gpio_write(GPIO_LED1, LOW);
+	PROBE2(gpio_write, GPIO_LED1, LOW);
 }
 
 /*******************************************************************************
@@ -327,6 +538,7 @@ int getLED1State(void){
  ******************************************************************************/
 void turnLED2On(void){
 	bcm2835_gpio_write(GPIO_LED2, HIGH);
+	PROBE2(gpio_write, GPIO_LED2, HIGH);
 }
 
 /*******************************************************************************
@@ -343,6 +555,7 @@ void turnLED2On(void){
  ******************************************************************************/
 void turnLED2Off(void){
 	bcm2835_gpio_write(GPIO_LED2, LOW);
+	PROBE2(gpio_write, GPIO_LED2, LOW);
 }
 
 /*******************************************************************************
@@ -376,7 +589,9 @@ int getLED2State(void){
  ******************************************************************************/
 void turnHeatOn(void){
 	bcm2835_gpio_write(GPIO_Heat, HIGH);
+	PROBE2(gpio_write, GPIO_Heat, HIGH);
 	stateHeiz = HEIZ_ON;
+	setEnergyLoad(ENERGY_HEATER, 1.0f);
 }
 
 /*******************************************************************************
@@ -393,7 +608,9 @@ void turnHeatOn(void){
  ******************************************************************************/
 void turnHeatOff(void){
 	bcm2835_gpio_write(GPIO_Heat, LOW);
+	PROBE2(gpio_write, GPIO_Heat, LOW);
 	stateHeiz = HEIZ_OFF;
+	setEnergyLoad(ENERGY_HEATER, 0.0f);
 }
 
 /*******************************************************************************
@@ -416,11 +633,12 @@ int getHeatState(void){
 /*******************************************************************************
  *  function :    getTemp
  ******************************************************************************/
-/** \brief        Return the temperature inside the webhouse
+/** \brief        Return the temperature of the living room, where the
+ *                heater is
  *
  *  \type         global
  *
- *  \return       1 for heater is ON, 0 for heater is OFF
+ *  \return       temperature in °C
  *
  ******************************************************************************/
 float getTemp(void){
@@ -430,7 +648,8 @@ float getTemp(void){
 /*******************************************************************************
  *  function :    getAlarmState
  ******************************************************************************/
-/** \brief        Get the state of the alarm
+/** \brief        Get the debounced state of the alarm, as tracked by the
+ *                edge detection
  *                The webhouse must be initialized (initWebhouse) before this
  *                function can be called.
  *
@@ -440,40 +659,351 @@ float getTemp(void){
  *
  ******************************************************************************/
 int getAlarmState(void){
-    uint8_t value = bcm2835_gpio_lev(GPIO_Alarm);
-    return value;
+    return alarmLevel;
+}
+
+/*******************************************************************************
+ *  function :    getAlarmEventFd
+ ******************************************************************************/
+/** \brief        Get an eventfd that becomes readable when alarm events are
+ *                waiting in readAlarmEvent. Reading the counter is up to the
+ *                caller.
+ *
+ *  \type         global
+ *
+ *  \return       file descriptor, -1 if the webhouse is not initialized
+ *
+ ******************************************************************************/
+int getAlarmEventFd(void){
+	return alarmEventFd;
+}
+
+/*******************************************************************************
+ *  function :    readAlarmEvent
+ ******************************************************************************/
+/** \brief        Take the oldest alarm edge out of the event ring. The ring
+ *                is lock-free with a single reader, so only one thread may
+ *                call this function.
+ *
+ *  \type         global
+ *
+ *  \param[out]   event   the alarm edge
+ *
+ *  \return       1 if an event was read, 0 if the ring is empty
+ *
+ ******************************************************************************/
+int readAlarmEvent(AlarmEvent *event){
+	unsigned int tail = __atomic_load_n(&alarmTail, __ATOMIC_RELAXED);
+	unsigned int head = __atomic_load_n(&alarmHead, __ATOMIC_ACQUIRE);
+
+	if (tail == head) {
+		return 0;
+	}
+
+	*event = alarmRing[tail & (ALARM_RING_SIZE - 1)];
+	__atomic_store_n(&alarmTail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
 }
 
 /*******************************************************************************
- *  function :    threadTemp
+ *  function :    updateTemp
  ******************************************************************************/
 /** \brief        simulate the variation of temperature
- *                according to the state of the heating system
+ *                according to the state of the heating system, with the
+ *                thermal model of the rooms (thermsim.c) and the outdoor
+ *                temperature of the time of day.
+ *                Must be called once per second, the caller owns the timing
+ *                (the server drives it from its timer wheel).
+ *
+ *  \type         global
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void updateTemp(void){
+	float phase = 2.0f * (float)M_PI * ((float)(getClockTime() % 86400) - OUTDOOR_COLDEST_S) / 86400.0f;
+
+	setThermalOutdoor(&house, 0, OUTDOOR_MEAN - OUTDOOR_AMPLITUDE * cosf(phase));
+	setThermalHeater(&house, 0, 0, stateHeiz == HEIZ_ON ? 1.0f : 0.0f);
+	stepThermalSim(&house, 1.0f);
+	localTemp = getThermalTemp(&house, 0, 0);
+}
+
+/*******************************************************************************
+ *  function :    setThermostat
+ ******************************************************************************/
+/** \brief        Configures the thermostat. Switching the mode restarts the
+ *                PID controller. With THERMOSTAT_OFF the heater keeps its
+ *                state and is only switched manually. Out-of-range values,
+ *                e.g. from a damaged state image, are limited: an unknown
+ *                mode switches the thermostat off, the setpoint is kept
+ *                within MIN_TEMP..MAX_TEMP and the hysteresis within
+ *                0..(MAX_TEMP - MIN_TEMP).
+ *
+ *  \type         global
+ *
+ *  \param[in]    mode         THERMOSTAT_OFF, _HYSTERESIS or _PID
+ *  \param[in]    setpoint     Target temperature in °C
+ *  \param[in]    hysteresis   Width of the switching band in °C
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void setThermostat(int mode, float setpoint, float hysteresis){
+	if (mode < THERMOSTAT_OFF || mode > THERMOSTAT_PID) {
+		mode = THERMOSTAT_OFF;
+	}
+	if (mode != thermostatMode) {
+		pidIntegral = 0.0f;
+		pidOutput = 0.0f;
+		pidWindow = 0.0f;
+		pidLastTemp = localTemp;
+	}
+
+	// The negated comparisons also catch NaN
+	if (!(setpoint >= MIN_TEMP)) {
+		setpoint = MIN_TEMP;
+	}
+	if (setpoint > MAX_TEMP) {
+		setpoint = MAX_TEMP;
+	}
+	if (!(hysteresis > 0.0f)) {
+		hysteresis = 0.0f;
+	}
+	if (hysteresis > MAX_TEMP - MIN_TEMP) {
+		hysteresis = MAX_TEMP - MIN_TEMP;
+	}
+
+	thermostatMode = mode;
+	thermostatSetpoint = setpoint;
+	thermostatHysteresis = hysteresis;
+}
+
+/*******************************************************************************
+ *  function :    getThermostatMode
+ ******************************************************************************/
+/** \brief        Get the mode of the thermostat
+ *
+ *  \type         global
+ *
+ *  \return       THERMOSTAT_OFF, _HYSTERESIS or _PID
+ *
+ ******************************************************************************/
+int getThermostatMode(void){
+	return thermostatMode;
+}
+
+/*******************************************************************************
+ *  function :    getThermostatSetpoint
+ ******************************************************************************/
+/** \brief        Get the target temperature of the thermostat
+ *
+ *  \type         global
+ *
+ *  \return       Setpoint in °C
+ *
+ ******************************************************************************/
+float getThermostatSetpoint(void){
+	return thermostatSetpoint;
+}
+
+/*******************************************************************************
+ *  function :    getThermostatHysteresis
+ ******************************************************************************/
+/** \brief        Get the width of the switching band of the thermostat
+ *
+ *  \type         global
+ *
+ *  \return       Hysteresis in °C
+ *
+ ******************************************************************************/
+float getThermostatHysteresis(void){
+	return thermostatHysteresis;
+}
+
+/*******************************************************************************
+ *  function :    getThermostatOutput
+ ******************************************************************************/
+/** \brief        Get the last output of the PID controller
+ *
+ *  \type         global
+ *
+ *  \return       Heater-on fraction [0,1], 0 unless in THERMOSTAT_PID mode
+ *
+ ******************************************************************************/
+float getThermostatOutput(void){
+	return pidOutput;
+}
+
+/*******************************************************************************
+ *  function :    stepThermostat
+ ******************************************************************************/
+/** \brief        Runs one step of the thermostat, called from the device
+ *                timer after updateTemp.
+ *                The hysteresis mode switches the heater on below and off
+ *                above the band around the setpoint. The PID mode computes
+ *                a heater-on fraction and turns the heater on for that part
+ *                of every THERMOSTAT_WINDOW_S window. The integrator only
+ *                runs while the output is not saturated in the direction of
+ *                the error (anti-windup), the derivative acts on the
+ *                temperature so setpoint changes cause no kick.
+ *
+ *  \type         global
+ *
+ *  \param[in]    dt   Seconds since the previous step
+ *
+ *  \return       1 if the heater was switched, 0 otherwise
+ *
+ ******************************************************************************/
+int stepThermostat(float dt){
+	int heat = stateHeiz == HEIZ_ON;
+	int want = heat;
+
+	if (thermostatMode == THERMOSTAT_HYSTERESIS) {
+		if (localTemp < thermostatSetpoint - thermostatHysteresis / 2) {
+			want = 1;
+		}
+		else if (localTemp > thermostatSetpoint + thermostatHysteresis / 2) {
+			want = 0;
+		}
+	}
+	else if (thermostatMode == THERMOSTAT_PID && dt > 0.0f) {
+		float error = thermostatSetpoint - localTemp;
+		float derivative = -THERMOSTAT_KD * (localTemp - pidLastTemp) / dt;
+		float output = THERMOSTAT_KP * error + pidIntegral + derivative;
+
+		pidLastTemp = localTemp;
+		if ((output < 1.0f || error < 0.0f) && (output > 0.0f || error > 0.0f)) {
+			pidIntegral += THERMOSTAT_KI * error * dt;
+			if (pidIntegral > 1.0f) {
+				pidIntegral = 1.0f;
+			}
+			if (pidIntegral < 0.0f) {
+				pidIntegral = 0.0f;
+			}
+			output = THERMOSTAT_KP * error + pidIntegral + derivative;
+		}
+		pidOutput = output < 0.0f ? 0.0f : (output > 1.0f ? 1.0f : output);
+
+		pidWindow += dt;
+		if (pidWindow >= THERMOSTAT_WINDOW_S) {
+			pidWindow -= THERMOSTAT_WINDOW_S;
+		}
+		want = pidWindow < pidOutput * THERMOSTAT_WINDOW_S;
+	}
+
+	if (want == heat) {
+		return 0;
+	}
+	want ? turnHeatOn() : turnHeatOff();
+	return 1;
+}
+
+/*******************************************************************************
+ *  function :    threadAlarm
+ ******************************************************************************/
+/** \brief        watch the edge detect status of the alarm pin.
+ *                The first edge is reported right away, further edges within
+ *                ALARM_DEBOUNCE_US are counted as bounces. A pulse shorter
+ *                than the poll interval shows up as a latched edge without a
+ *                level change and is reported as two edges.
  *
  *  \type         module
  *
  *  \return
  *
  ******************************************************************************/
-static void * threadTemp(void *pdata){
+static void * threadAlarm(void *pdata){
+	uint64_t lastEvent = 0;
+	uint16_t bounces = 0;
+
 	// Never ending loop
 	for (;;) {
-		if (stateHeiz == HEIZ_ON) {
-			if (localTemp < MAX_TEMP) {
-				localTemp += 0.05f;
-			}
+		int edge = bcm2835_gpio_eds(GPIO_Alarm);
+		if (edge) {
+			bcm2835_gpio_set_eds(GPIO_Alarm);
 		}
-		else {
-			if (localTemp > MIN_TEMP) {
-			   localTemp -= 0.05f;
+
+		int level = bcm2835_gpio_lev(GPIO_Alarm);
+		uint64_t now = getTimestamp();
+
+		if (lastEvent && now - lastEvent < ALARM_DEBOUNCE_US) {
+			if (edge && bounces < UINT16_MAX) {
+				bounces++;
 			}
 		}
+		else if (level != alarmLevel) {
+			alarmLevel = level;
+			pushAlarmEvent(level, now, bounces);
+			lastEvent = now;
+			bounces = 0;
+		}
+		else if (edge) {
+			pushAlarmEvent(!level, now, bounces);
+			pushAlarmEvent(level, now, 0);
+			lastEvent = now;
+			bounces = 0;
+		}
 
-		usleep(1000000);
+		usleep(ALARM_POLL_US);
 	}
 	return NULL;
 }
 
+/*******************************************************************************
+ *  function :    getTimestamp
+ ******************************************************************************/
+/** \brief        microsecond timestamp of the bcm2835 system timer, or of the
+ *                clock (clock.c) if the system timer is not accessible or
+ *                the server runs in scaled or virtual time.
+ *                This is the time base of the alarm events and the fades.
+ *
+ *  \type         global
+ *
+ *  \return       timestamp in microseconds
+ *
+ ******************************************************************************/
+uint64_t getTimestamp(void){
+	if (useSystemTimer) {
+		return bcm2835_st_read();
+	}
+	return getClockNs() / 1000;
+}
+
+/*******************************************************************************
+ *  function :    pushAlarmEvent
+ ******************************************************************************/
+/** \brief        store an alarm edge in the event ring and wake up the
+ *                reader. Events are dropped (and counted) when the ring is
+ *                full, the watcher never blocks.
+ *
+ *  \type         module
+ *
+ *  \return
+ *
+ ******************************************************************************/
+static void pushAlarmEvent(uint8_t level, uint64_t timestamp, uint16_t bounces){
+	unsigned int head = __atomic_load_n(&alarmHead, __ATOMIC_RELAXED);
+	unsigned int tail = __atomic_load_n(&alarmTail, __ATOMIC_ACQUIRE);
+	uint64_t one = 1;
+
+	if (head - tail == ALARM_RING_SIZE) {
+		alarmDropped++;
+		return;
+	}
+
+	AlarmEvent *event = &alarmRing[head & (ALARM_RING_SIZE - 1)];
+	event->timestamp = timestamp;
+	event->level = level;
+	event->reserved = 0;
+	event->bounces = bounces;
+	__atomic_store_n(&alarmHead, head + 1, __ATOMIC_RELEASE);
+
+	if (write(alarmEventFd, &one, sizeof(one)) < 0) {
+		// The counter is saturated, the reader is woken up anyway
+	}
+}
+
 #ifndef PWM
 /*******************************************************************************
  *  function :    threadDimRLamp
@@ -487,6 +1017,12 @@ static void * threadTemp(void *pdata){
  ******************************************************************************/
 static void * threadDimRLamp(void *pdata){
 	int time = 0;
+	uint64_t periodStart = 0;
+
+	if (getClockMode() != CLOCK_REAL) {
+		return simulateLamp(&fadeRL, &dutyCycleRL);
+	}
+
 	// Never ending loop
 	for (;;) {
 		if (time <= dutyCycleRL) {
@@ -495,9 +1031,20 @@ static void * threadDimRLamp(void *pdata){
 			bcm2835_gpio_write(GPIO_dimRLamp, LOW);
 		} else {
 			time = 0;
+			uint64_t now = getTimestamp();
+			if (periodStart && now - periodStart > PWM_LATE_US) {
+				PROBE2(pwm_edge_late, 1, now - periodStart);
+			}
+			periodStart = now;
+			// Advance a running fade once per PWM period
+			pthread_mutex_lock(&fadeLock);
+			if (fadeRL.duration) {
+				dutyCycleRL = (getFadeLevel(&fadeRL, now / 1000) + (1 << (FADE_SHIFT - 1))) >> FADE_SHIFT;
+			}
+			pthread_mutex_unlock(&fadeLock);
 		}
 		time++;
-		usleep(100);
+		sleepClock(PWM_STEP_NS);
 	}
 	return NULL;
 }
@@ -514,6 +1061,12 @@ static void * threadDimRLamp(void *pdata){
  ******************************************************************************/
 static void * threadDimSLamp(void *pdata){
 	int time = 0;
+	uint64_t periodStart = 0;
+
+	if (getClockMode() != CLOCK_REAL) {
+		return simulateLamp(&fadeSL, &dutyCycleSL);
+	}
+
 	// Never ending loop
 	for (;;) {
 		if (time <= dutyCycleSL) {
@@ -522,12 +1075,129 @@ static void * threadDimSLamp(void *pdata){
 			bcm2835_gpio_write(GPIO_dimSLamp, LOW);
 		} else {
 			time = 0;
+			uint64_t now = getTimestamp();
+			if (periodStart && now - periodStart > PWM_LATE_US) {
+				PROBE2(pwm_edge_late, 0, now - periodStart);
+			}
+			periodStart = now;
+			// Advance a running fade once per PWM period
+			pthread_mutex_lock(&fadeLock);
+			if (fadeSL.duration) {
+				dutyCycleSL = (getFadeLevel(&fadeSL, now / 1000) + (1 << (FADE_SHIFT - 1))) >> FADE_SHIFT;
+			}
+			pthread_mutex_unlock(&fadeLock);
 		}
 		time++;
-		usleep(100);
+		sleepClock(PWM_STEP_NS);
 	}
 	return NULL;
 }
+
+/*******************************************************************************
+ *  function :    simulateLamp
+ ******************************************************************************/
+/** \brief        run a lamp in scaled or virtual time. The pin is not
+ *                switched, a PWM period would last microseconds or keep the
+ *                virtual clock busy. Only running fades are advanced, once
+ *                per period of the clock; in between the thread waits for
+ *                the next fade.
+ *
+ *  \type         module
+ *
+ *  \param[in]    fade         fade of the lamp
+ *  \param[in]    dutyCycle    dim level of the lamp, updated
+ *
+ *  \return
+ *
+ ******************************************************************************/
+static void * simulateLamp(LampFade *fade, int *dutyCycle){
+	// Never ending loop
+	for (;;) {
+		pthread_mutex_lock(&fadeLock);
+		pthread_cleanup_push(unlockFade, NULL);
+		while (fade->duration == 0) {
+			pthread_cond_wait(&fadeStarted, &fadeLock);
+		}
+		*dutyCycle = (getFadeLevel(fade, getTimestamp() / 1000) + (1 << (FADE_SHIFT - 1))) >> FADE_SHIFT;
+		pthread_cleanup_pop(1);
+
+		sleepClock((uint64_t)RANGE * PWM_STEP_NS);
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+ *  function :    unlockFade
+ ******************************************************************************/
+/** \brief        release the fade lock of a lamp thread cancelled while
+ *                waiting for a fade.
+ *
+ *  \type         module
+ *
+ *  \return
+ *
+ ******************************************************************************/
+static void unlockFade(void *arg){
+	pthread_mutex_unlock(&fadeLock);
+}
+
+/*******************************************************************************
+ *  function :    startFade
+ ******************************************************************************/
+/** \brief        start a fade from the current level of a lamp. The rate is
+ *                computed once, the PWM thread only multiplies it with the
+ *                elapsed time, so a late period does not slow the fade down.
+ *
+ *  \type         module
+ *
+ *  \param[in]    fade         fade of the lamp
+ *  \param[in]    dutyCycle    dim level at the end of the fade [0,100]
+ *  \param[in]    fade_ms      length of the fade in ms, 0 to dim at once
+ *
+ *  \return       16.16 fixed-point duty cycle at the start of the fade
+ *
+ ******************************************************************************/
+static int32_t startFade(LampFade *fade, uint16_t dutyCycle, uint32_t fade_ms){
+	uint64_t now = getTimestamp() / 1000;
+	int32_t target = (int32_t)dutyCycle << FADE_SHIFT;
+
+	pthread_mutex_lock(&fadeLock);
+	fade->from = getFadeLevel(fade, now);
+	fade->target = dutyCycle;
+	fade->start = now;
+	fade->duration = fade_ms;
+	fade->rate = fade_ms ? (target - fade->from) / (int32_t)fade_ms : 0;
+	int32_t from = fade->from;
+	pthread_cond_broadcast(&fadeStarted);
+	pthread_mutex_unlock(&fadeLock);
+
+	return from;
+}
+
+/*******************************************************************************
+ *  function :    getFadeLevel
+ ******************************************************************************/
+/** \brief        level of a lamp at a point in time. A finished fade is
+ *                marked as done, so the PWM thread stops updating the lamp.
+ *                Must be called with fadeLock held.
+ *
+ *  \type         module
+ *
+ *  \param[in]    fade   fade of the lamp
+ *  \param[in]    now    time in ms
+ *
+ *  \return       16.16 fixed-point duty cycle
+ *
+ ******************************************************************************/
+static int32_t getFadeLevel(LampFade *fade, uint64_t now){
+	uint64_t elapsed = now - fade->start;
+
+	if (fade->duration == 0 || elapsed >= fade->duration) {
+		fade->duration = 0;
+		return (int32_t)fade->target << FADE_SHIFT;
+	}
+	return fade->from + fade->rate * (int32_t)elapsed;
+}
 #endif
 
 	
@@ -5,10 +5,22 @@
 #include <stdint.h>
 
 //-----Macros----------------------------------------------------------------------
+// Thermostat modes
+#define THERMOSTAT_OFF			0	// Heater is switched manually
+#define THERMOSTAT_HYSTERESIS	1	// Two-point control around the setpoint
+#define THERMOSTAT_PID			2	// PID with time-proportioned heater output
 
 //-----Data types------------------------------------------------------------------
+// Debounced edge of the alarm input
+typedef struct {
+	uint64_t timestamp;		// Microseconds of the bcm2835 system timer
+	uint8_t level;			// New level, 1 for alarm detected
+	uint8_t reserved;
+	uint16_t bounces;		// Edges suppressed by debouncing before this one
+} AlarmEvent;
 
 //-----Function prototypes---------------------------------------------------------
+extern void setWebhouseDebug(int debug);
 extern void initWebhouse(void);
 extern void closeWebhouse(void);
 
@@ -18,6 +30,10 @@ extern int  getTVState(void);
 
 extern void dimRLamp(uint16_t Duty_cycle);
 extern void dimSLamp(uint16_t Duty_cycle);
+extern void fadeRLamp(uint16_t Duty_cycle, uint32_t fade_ms);
+extern void fadeSLamp(uint16_t Duty_cycle, uint32_t fade_ms);
+
+extern void setWebhouseState(int tv, int heat, uint16_t dutySL, uint16_t dutyRL);
 
 extern void turnLED1On(void);
 extern void turnLED1Off(void);
@@ -31,7 +47,18 @@ extern void turnHeatOn(void);
 extern void turnHeatOff(void);
 extern int  getHeatState(void);
 extern float getTemp(void);
+extern void updateTemp(void);
+
+extern void setThermostat(int mode, float setpoint, float hysteresis);
+extern int  getThermostatMode(void);
+extern float getThermostatSetpoint(void);
+extern float getThermostatHysteresis(void);
+extern float getThermostatOutput(void);
+extern int  stepThermostat(float dt);
 
 extern int getAlarmState(void);
+extern int getAlarmEventFd(void);
+extern int readAlarmEvent(AlarmEvent *event);
+extern uint64_t getTimestamp(void);
 
 #endif
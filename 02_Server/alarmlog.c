@@ -0,0 +1,188 @@
+/*******************************************************************************
+ * @file       alarmlog.c
+ *******************************************************************************
+ *
+ * @brief      History of the alarm edges.
+ *
+ * @details    The edges are kept in a fixed-capacity ring of 16 byte entries
+ *             ordered by time, so a time range is found with two binary
+ *             searches and read without copying. The ring lives in a shared
+ *             mapping of a file and survives restarts; without a file an
+ *             anonymous mapping is used.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              openAlarmLog
+ *              closeAlarmLog
+ *              addAlarmLog
+ *              findAlarmLog
+ *              getAlarmLog
+ *
+ *  Functions  local:
+ *              lowerBound
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "alarmlog.h"
+#include "log.h"
+
+//----- Data types -------------------------------------------------------------
+typedef struct {
+    uint32_t magic;             // ALARM_LOG_MAGIC
+    uint32_t capacity;          // ALARM_LOG_CAPACITY
+    uint64_t written;           // Entries ever added
+    AlarmLogEntry entries[ALARM_LOG_CAPACITY];
+} AlarmLogFile;
+
+//----- Function prototypes ----------------------------------------------------
+static uint32_t lowerBound(uint64_t timestamp);
+
+//----- Global variables -------------------------------------------------------
+static AlarmLogFile *alarmLog = NULL;
+
+/*******************************************************************************
+ * @brief    Maps the alarm history. An existing history of a different
+ *           layout is discarded.
+ *
+ * @param    filename  File backing the history, NULL to keep it in memory.
+ * @return   0 if successful, -1 on failure.
+ ******************************************************************************/
+int openAlarmLog(const char *filename)
+{
+    int fd = -1;
+    int flags = MAP_SHARED;
+
+    if (filename) {
+        fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0 || ftruncate(fd, sizeof(AlarmLogFile)) < 0) {
+            logWarn("Error opening file %s: %s, keeping alarms in memory", filename, strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0)
+        flags |= MAP_ANONYMOUS;
+
+    alarmLog = mmap(NULL, sizeof(AlarmLogFile), PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (fd >= 0)
+        close(fd);
+    if (alarmLog == MAP_FAILED) {
+        logError("mmap alarm log failed: %s", strerror(errno));
+        alarmLog = NULL;
+        return -1;
+    }
+
+    if (alarmLog->magic != ALARM_LOG_MAGIC || alarmLog->capacity != ALARM_LOG_CAPACITY) {
+        memset(alarmLog, 0, sizeof(AlarmLogFile));
+        alarmLog->magic = ALARM_LOG_MAGIC;
+        alarmLog->capacity = ALARM_LOG_CAPACITY;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Unmaps the alarm history, the kernel writes back the file.
+ ******************************************************************************/
+void closeAlarmLog(void)
+{
+    if (alarmLog) {
+        munmap(alarmLog, sizeof(AlarmLogFile));
+        alarmLog = NULL;
+    }
+}
+
+/*******************************************************************************
+ * @brief    Appends an alarm edge, overwriting the oldest one when full.
+ *           Timestamps are clamped to be non-decreasing, so the ring stays
+ *           sorted even if the wall clock is set back.
+ *
+ * @param    timestamp  Wall clock in microseconds.
+ * @param    level      New level of the alarm input.
+ * @param    bounces    Edges suppressed by debouncing.
+ ******************************************************************************/
+void addAlarmLog(uint64_t timestamp, uint8_t level, uint16_t bounces)
+{
+    if (!alarmLog)
+        return;
+
+    if (alarmLog->written > 0) {
+        const AlarmLogEntry *last = &alarmLog->entries[(alarmLog->written - 1) % ALARM_LOG_CAPACITY];
+        if (timestamp < last->timestamp)
+            timestamp = last->timestamp;
+    }
+
+    AlarmLogEntry *entry = &alarmLog->entries[alarmLog->written % ALARM_LOG_CAPACITY];
+    entry->timestamp = timestamp;
+    entry->level = level;
+    entry->reserved = 0;
+    entry->bounces = bounces;
+    entry->reserved2 = 0;
+    alarmLog->written++;
+}
+
+/*******************************************************************************
+ * @brief    Finds the edges within a time range.
+ *
+ * @param    from   First timestamp of the range (inclusive).
+ * @param    to     Last timestamp of the range (inclusive).
+ * @param    first  Receives the index of the first edge for getAlarmLog.
+ * @return   Number of edges in the range.
+ ******************************************************************************/
+uint32_t findAlarmLog(uint64_t from, uint64_t to, uint32_t *first)
+{
+    *first = 0;
+    if (!alarmLog || to < from)
+        return 0;
+
+    *first = lowerBound(from);
+    return (to == UINT64_MAX ? lowerBound(to) : lowerBound(to + 1)) - *first;
+}
+
+/*******************************************************************************
+ * @brief    Returns an edge of the history, index 0 is the oldest one.
+ ******************************************************************************/
+const AlarmLogEntry *getAlarmLog(uint32_t index)
+{
+    uint64_t count = alarmLog->written < ALARM_LOG_CAPACITY ? alarmLog->written : ALARM_LOG_CAPACITY;
+    uint64_t oldest = alarmLog->written - count;
+
+    return &alarmLog->entries[(oldest + index) % ALARM_LOG_CAPACITY];
+}
+
+/*******************************************************************************
+ * @brief    Binary search for the first edge not older than timestamp. A
+ *           timestamp of UINT64_MAX returns the number of edges.
+ ******************************************************************************/
+static uint32_t lowerBound(uint64_t timestamp)
+{
+    uint32_t low = 0;
+    uint32_t high = alarmLog->written < ALARM_LOG_CAPACITY ? alarmLog->written : ALARM_LOG_CAPACITY;
+
+    if (timestamp == UINT64_MAX)
+        return high;
+
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (getAlarmLog(mid)->timestamp < timestamp)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
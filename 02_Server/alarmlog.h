@@ -0,0 +1,28 @@
+#ifndef ALARMLOG_H_
+#define ALARMLOG_H_
+
+//-----Header-Files----------------------------------------------------------------
+#include <stdint.h>
+
+//-----Macros----------------------------------------------------------------------
+#define ALARM_LOG_CAPACITY  4096    // Events kept, the oldest are overwritten
+#define ALARM_LOG_MAGIC     0x4C414857  // "WHAL"
+
+//-----Data types------------------------------------------------------------------
+// One alarm edge, 16 bytes so four entries share a cache line
+typedef struct {
+    uint64_t timestamp;     // Wall clock in microseconds since the epoch
+    uint8_t level;          // New level of the alarm input
+    uint8_t reserved;
+    uint16_t bounces;       // Edges suppressed by debouncing
+    uint32_t reserved2;
+} AlarmLogEntry;
+
+//-----Function prototypes---------------------------------------------------------
+extern int  openAlarmLog(const char *filename);
+extern void closeAlarmLog(void);
+extern void addAlarmLog(uint64_t timestamp, uint8_t level, uint16_t bounces);
+extern uint32_t findAlarmLog(uint64_t from, uint64_t to, uint32_t *first);
+extern const AlarmLogEntry *getAlarmLog(uint32_t index);
+
+#endif
@@ -0,0 +1,639 @@
+/*******************************************************************************
+ * @file       archive.c
+ *******************************************************************************
+ *
+ * @brief      Compressed long-term archive of the temperature history.
+ *
+ * @details    The 1 minute points of the history are appended to a file in
+ *             blocks of ARCHIVE_BLOCK_POINTS points. Inside a block the
+ *             timestamps are stored as delta-of-delta and the temperature
+ *             and heater duty cycle with XOR float encoding (Gorilla), the
+ *             utility states as run-length encoded runs. Constant minute
+ *             steps cost one bit and a steady temperature one bit, so a
+ *             year of data takes a few MB.
+ *
+ *             Block layout: ArchiveBlock header, time/value bit stream
+ *             (valueBits bits, padded to bytes), runs of 4 bit state and
+ *             10 bit length.
+ *
+ *             The file is only appended to. On open the block headers are
+ *             read into a sparse index (one entry per block); a range query
+ *             maps the file and decodes only the blocks it overlaps.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              openArchive
+ *              closeArchive
+ *              appendArchive
+ *              queryArchive
+ *              getArchiveSize
+ *
+ *  Functions  local:
+ *              putBits
+ *              getBits
+ *              encodeTime
+ *              decodeTime
+ *              encodeXor
+ *              decodeXor
+ *              flushRun
+ *              resetBlock
+ *              sealBlock
+ *              checkBlock
+ *              addIndex
+ *              abortOpen
+ *              decodeBlock
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "archive.h"
+#include "wal.h"
+#include "log.h"
+
+//----- Macros -----------------------------------------------------------------
+#define VALUE_BYTES     (ARCHIVE_BLOCK_POINTS * 16)     // Worst case per point
+#define RUN_BITS        14                              // 4 bit state, 10 bit length
+#define RUN_BYTES       ((ARCHIVE_BLOCK_POINTS * RUN_BITS + 7) / 8)
+
+//----- Data types -------------------------------------------------------------
+typedef struct {
+    uint32_t magic;         // ARCHIVE_MAGIC
+    uint16_t count;         // Points in the block
+    uint16_t runs;          // State runs in the block
+    uint32_t firstTime;     // Time of the first point
+    uint32_t lastTime;      // Time of the last point
+    uint32_t valueBits;     // Length of the time/value stream
+    uint32_t size;          // Payload bytes following the header
+    uint32_t crc;           // CRC-32 of the payload
+} ArchiveBlock;
+
+typedef struct {
+    uint32_t firstTime;
+    uint32_t lastTime;
+    long offset;            // Offset of the block header in the file
+} ArchiveIndex;
+
+typedef struct {
+    uint8_t *data;
+    uint64_t pos;           // Position in bits
+} BitStream;
+
+// State of an XOR encoded series
+typedef struct {
+    uint32_t prev;          // Previous value as bits
+    int lead;               // Leading zeros of the current window, 32 if none
+    int trail;              // Trailing zeros of the current window
+} XorState;
+
+//----- Function prototypes ----------------------------------------------------
+static void putBits(BitStream *s, uint32_t value, int bits);
+static uint32_t getBits(BitStream *s, int bits);
+static void encodeTime(BitStream *s, int32_t dod);
+static int32_t decodeTime(BitStream *s);
+static void encodeXor(BitStream *s, XorState *x, float value);
+static float decodeXor(BitStream *s, XorState *x);
+static void flushRun(void);
+static void resetBlock(void);
+static int sealBlock(void);
+static int checkBlock(const uint8_t *map, long offset, long size);
+static int addIndex(uint32_t firstTime, uint32_t lastTime, long offset);
+static int abortOpen(void);
+static int decodeBlock(const ArchiveBlock *block, uint32_t from, uint32_t to, ArchiveVisitFn visit, void *arg);
+
+//----- Global variables -------------------------------------------------------
+static int archiveFd = -1;
+static long archiveSize = 0;
+static ArchiveIndex *blocks = NULL;
+static int indexCount = 0;
+static int indexCapacity = 0;
+
+// Block being filled
+static ArchiveBlock block;
+static uint8_t valueData[VALUE_BYTES];
+static uint8_t runData[RUN_BYTES];
+static BitStream valueStream = { valueData, 0 };
+static BitStream runStream = { runData, 0 };
+static uint32_t prevTime;           // Time of the last point
+static int32_t prevDelta;
+static XorState tempState;
+static XorState heaterState;
+static uint8_t runState;
+static uint32_t runLength;
+
+/*******************************************************************************
+ * @brief    Opens the archive and builds the sparse index from the block
+ *           headers. A torn or corrupted last block is cut off. If the
+ *           archive cannot be read completely it stays closed, nothing is
+ *           appended to it or queried from it.
+ *
+ * @param    filename  Path of the archive.
+ * @return   0 if successful, -1 on failure.
+ ******************************************************************************/
+int openArchive(const char *filename)
+{
+    struct stat st;
+    uint8_t *map = NULL;
+    long offset = 0;
+
+    archiveFd = open(filename, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (archiveFd < 0 || fstat(archiveFd, &st) < 0) {
+        logError("Error opening file %s: %s", filename, strerror(errno));
+        return abortOpen();
+    }
+
+    if (st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, archiveFd, 0);
+        if (map == MAP_FAILED) {
+            logError("mmap archive failed: %s", strerror(errno));
+            return abortOpen();
+        }
+    }
+
+    while (offset + (long)sizeof(ArchiveBlock) <= st.st_size) {
+        const ArchiveBlock *b = (const ArchiveBlock *)(map + offset);
+
+        if (checkBlock(map, offset, st.st_size) < 0)
+            break;
+        // Valid blocks must not be cut off for want of index memory
+        if (addIndex(b->firstTime, b->lastTime, offset) < 0) {
+            logError("Archive: no memory for the index of %s", filename);
+            munmap(map, st.st_size);
+            return abortOpen();
+        }
+        offset += sizeof(ArchiveBlock) + b->size;
+    }
+
+    if (map)
+        munmap(map, st.st_size);
+
+    if (offset < st.st_size) {
+        logWarn("Archive: discarding %ld bytes of incomplete tail", (long)st.st_size - offset);
+        if (ftruncate(archiveFd, offset) < 0) {
+            logError("Archive truncate failed: %s", strerror(errno));
+            return abortOpen();
+        }
+    }
+    archiveSize = offset;
+    prevTime = indexCount ? blocks[indexCount - 1].lastTime : 0;
+
+    resetBlock();
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Writes the partially filled block and closes the archive.
+ ******************************************************************************/
+void closeArchive(void)
+{
+    if (archiveFd < 0)
+        return;
+
+    sealBlock();
+    close(archiveFd);
+    archiveFd = -1;
+
+    free(blocks);
+    blocks = NULL;
+    indexCount = 0;
+    indexCapacity = 0;
+}
+
+/*******************************************************************************
+ * @brief    Appends a point, the block is written to the file once it is
+ *           full. Times are clamped to be non-decreasing, so the blocks stay
+ *           sorted for the index.
+ *
+ * @param    time    Seconds since the epoch.
+ * @param    temp    Temperature in °C.
+ * @param    heater  Heater-on fraction of the interval.
+ * @param    states  ARCHIVE_STATE_* bits.
+ ******************************************************************************/
+void appendArchive(uint32_t time, float temp, float heater, uint8_t states)
+{
+    if (archiveFd < 0)
+        return;
+    if (time < prevTime)
+        time = prevTime;
+
+    if (block.count == 0) {
+        block.firstTime = time;
+        prevTime = time;
+        prevDelta = 0;
+        runState = states;
+    }
+    else {
+        int32_t delta = (int32_t)(time - prevTime);
+        encodeTime(&valueStream, delta - prevDelta);
+        prevTime = time;
+        prevDelta = delta;
+    }
+
+    encodeXor(&valueStream, &tempState, temp);
+    encodeXor(&valueStream, &heaterState, heater);
+
+    if (states != runState) {
+        flushRun();
+        runState = states;
+    }
+    runLength++;
+
+    block.lastTime = time;
+    block.count++;
+
+    if (block.count == ARCHIVE_BLOCK_POINTS)
+        sealBlock();
+}
+
+/*******************************************************************************
+ * @brief    Visits all archived points within a time range. Only the blocks
+ *           overlapping the range are decoded.
+ *
+ * @param    from   First second of the range (inclusive).
+ * @param    to     Last second of the range (inclusive).
+ * @param    visit  Called for every point, returns 0 to stop.
+ * @param    arg    User argument for visit.
+ * @return   Number of visited points, -1 on failure.
+ ******************************************************************************/
+int queryArchive(uint32_t from, uint32_t to, ArchiveVisitFn visit, void *arg)
+{
+    uint8_t *map;
+    int low = 0, high = indexCount, visited = 0;
+
+    if (archiveFd < 0 || archiveSize == 0 || to < from)
+        return 0;
+
+    // Binary search the first block ending at or after from
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (blocks[mid].lastTime < from)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low == indexCount || blocks[low].firstTime > to)
+        return 0;
+
+    map = mmap(NULL, archiveSize, PROT_READ, MAP_SHARED, archiveFd, 0);
+    if (map == MAP_FAILED) {
+        logError("mmap archive failed: %s", strerror(errno));
+        return -1;
+    }
+
+    for (int i = low; i < indexCount && blocks[i].firstTime <= to; i++) {
+        // A block damaged since it was indexed is skipped, not decoded
+        if (checkBlock(map, blocks[i].offset, archiveSize) < 0) {
+            logWarn("Archive: skipping damaged block at %ld", blocks[i].offset);
+            continue;
+        }
+
+        int n = decodeBlock((const ArchiveBlock *)(map + blocks[i].offset), from, to, visit, arg);
+        if (n < 0) {
+            visited -= n + 1;
+            break;
+        }
+        visited += n;
+    }
+
+    munmap(map, archiveSize);
+    return visited;
+}
+
+/*******************************************************************************
+ * @brief    Returns the size of the archive file in bytes.
+ ******************************************************************************/
+long getArchiveSize(void)
+{
+    return archiveSize;
+}
+
+/*******************************************************************************
+ * @brief    Appends the lowest bits of value to a bit stream, MSB first.
+ ******************************************************************************/
+static void putBits(BitStream *s, uint32_t value, int bits)
+{
+    for (int i = bits - 1; i >= 0; i--) {
+        uint8_t *byte = &s->data[s->pos >> 3];
+        int shift = 7 - (s->pos & 7);
+
+        if (shift == 7)
+            *byte = 0;
+        *byte |= ((value >> i) & 1) << shift;
+        s->pos++;
+    }
+}
+
+/*******************************************************************************
+ * @brief    Reads bits from a bit stream, MSB first.
+ ******************************************************************************/
+static uint32_t getBits(BitStream *s, int bits)
+{
+    uint32_t value = 0;
+
+    for (int i = 0; i < bits; i++) {
+        value = (value << 1) | ((s->data[s->pos >> 3] >> (7 - (s->pos & 7))) & 1);
+        s->pos++;
+    }
+
+    return value;
+}
+
+/*******************************************************************************
+ * @brief    Encodes a delta-of-delta with a variable length prefix code.
+ ******************************************************************************/
+static void encodeTime(BitStream *s, int32_t dod)
+{
+    if (dod == 0) {
+        putBits(s, 0x0, 1);
+    }
+    else if (dod >= -63 && dod <= 64) {
+        putBits(s, 0x2, 2);
+        putBits(s, dod + 63, 7);
+    }
+    else if (dod >= -255 && dod <= 256) {
+        putBits(s, 0x6, 3);
+        putBits(s, dod + 255, 9);
+    }
+    else if (dod >= -2047 && dod <= 2048) {
+        putBits(s, 0xE, 4);
+        putBits(s, dod + 2047, 12);
+    }
+    else {
+        putBits(s, 0xF, 4);
+        putBits(s, (uint32_t)dod, 32);
+    }
+}
+
+/*******************************************************************************
+ * @brief    Decodes a delta-of-delta written by encodeTime.
+ ******************************************************************************/
+static int32_t decodeTime(BitStream *s)
+{
+    if (!getBits(s, 1))
+        return 0;
+    if (!getBits(s, 1))
+        return (int32_t)getBits(s, 7) - 63;
+    if (!getBits(s, 1))
+        return (int32_t)getBits(s, 9) - 255;
+    if (!getBits(s, 1))
+        return (int32_t)getBits(s, 12) - 2047;
+    return (int32_t)getBits(s, 32);
+}
+
+/*******************************************************************************
+ * @brief    Encodes a float as XOR with the previous value. Only the
+ *           meaningful bits are stored, reusing the previous window of
+ *           leading and trailing zeros when the new bits fit into it.
+ ******************************************************************************/
+static void encodeXor(BitStream *s, XorState *x, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    if (block.count == 0) {
+        putBits(s, bits, 32);
+        x->prev = bits;
+        x->lead = 32;
+        x->trail = 0;
+        return;
+    }
+
+    uint32_t diff = bits ^ x->prev;
+    x->prev = bits;
+
+    if (diff == 0) {
+        putBits(s, 0x0, 1);
+        return;
+    }
+
+    int lead = __builtin_clz(diff);
+    int trail = __builtin_ctz(diff);
+
+    if (x->lead < 32 && lead >= x->lead && trail >= x->trail) {
+        putBits(s, 0x2, 2);
+        putBits(s, diff >> x->trail, 32 - x->lead - x->trail);
+    }
+    else {
+        int len = 32 - lead - trail;
+        putBits(s, 0x3, 2);
+        putBits(s, lead, 5);
+        putBits(s, len - 1, 5);
+        putBits(s, diff >> trail, len);
+        x->lead = lead;
+        x->trail = trail;
+    }
+}
+
+/*******************************************************************************
+ * @brief    Decodes a float written by encodeXor.
+ ******************************************************************************/
+static float decodeXor(BitStream *s, XorState *x)
+{
+    float value;
+
+    if (x->lead == 33) {
+        // First value of the block is stored verbatim
+        x->prev = getBits(s, 32);
+        x->lead = 32;
+    }
+    else if (getBits(s, 1)) {
+        if (getBits(s, 1)) {
+            x->lead = getBits(s, 5);
+            int len = getBits(s, 5) + 1;
+            x->trail = 32 - x->lead - len;
+        }
+        x->prev ^= getBits(s, 32 - x->lead - x->trail) << x->trail;
+    }
+
+    memcpy(&value, &x->prev, sizeof(value));
+    return value;
+}
+
+/*******************************************************************************
+ * @brief    Stores the current run of equal utility states.
+ ******************************************************************************/
+static void flushRun(void)
+{
+    if (runLength == 0)
+        return;
+
+    putBits(&runStream, runState, 4);
+    putBits(&runStream, runLength - 1, 10);
+    block.runs++;
+    runLength = 0;
+}
+
+/*******************************************************************************
+ * @brief    Starts an empty block.
+ ******************************************************************************/
+static void resetBlock(void)
+{
+    memset(&block, 0, sizeof(block));
+    block.magic = ARCHIVE_MAGIC;
+    valueStream.pos = 0;
+    runStream.pos = 0;
+    runLength = 0;
+}
+
+/*******************************************************************************
+ * @brief    Writes the current block to the file and adds it to the index.
+ *
+ * @return   0 if successful or empty, -1 on failure.
+ ******************************************************************************/
+static int sealBlock(void)
+{
+    uint8_t buffer[sizeof(ArchiveBlock) + VALUE_BYTES + RUN_BYTES];
+    size_t valueBytes, runBytes;
+    int ret = 0;
+
+    if (block.count == 0)
+        return 0;
+
+    flushRun();
+    valueBytes = (valueStream.pos + 7) / 8;
+    runBytes = (runStream.pos + 7) / 8;
+
+    block.valueBits = valueStream.pos;
+    block.size = valueBytes + runBytes;
+    memcpy(buffer + sizeof(ArchiveBlock), valueData, valueBytes);
+    memcpy(buffer + sizeof(ArchiveBlock) + valueBytes, runData, runBytes);
+    block.crc = crc32(buffer + sizeof(ArchiveBlock), block.size);
+    memcpy(buffer, &block, sizeof(ArchiveBlock));
+
+    size_t len = sizeof(ArchiveBlock) + block.size;
+    if (write(archiveFd, buffer, len) != (ssize_t)len || fdatasync(archiveFd) < 0) {
+        logError("Archive write failed: %s", strerror(errno));
+        // Cut off a partially written block, the next one starts at archiveSize
+        if (ftruncate(archiveFd, archiveSize) < 0)
+            logError("Archive truncate failed: %s", strerror(errno));
+        ret = -1;
+    }
+    else {
+        addIndex(block.firstTime, block.lastTime, archiveSize);
+        archiveSize += len;
+    }
+
+    resetBlock();
+    return ret;
+}
+
+/*******************************************************************************
+ * @brief    Checks the header and the CRC of a block in the mapped file.
+ *
+ * @param    map     Mapped archive file.
+ * @param    offset  Offset of the block header.
+ * @param    size    Bytes of the file that hold blocks.
+ * @return   0 if the block is complete and intact, -1 otherwise.
+ ******************************************************************************/
+static int checkBlock(const uint8_t *map, long offset, long size)
+{
+    const ArchiveBlock *b = (const ArchiveBlock *)(map + offset);
+
+    if (offset + (long)sizeof(ArchiveBlock) > size || b->magic != ARCHIVE_MAGIC ||
+        b->size > (uint64_t)(size - offset - sizeof(ArchiveBlock)) ||
+        (b->valueBits + 7ull) / 8 > b->size || crc32(b + 1, b->size) != b->crc)
+        return -1;
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Adds a block to the sparse index.
+ ******************************************************************************/
+static int addIndex(uint32_t firstTime, uint32_t lastTime, long offset)
+{
+    if (indexCount == indexCapacity) {
+        int capacity = indexCapacity ? indexCapacity * 2 : 64;
+        ArchiveIndex *grown = realloc(blocks, capacity * sizeof(ArchiveIndex));
+        if (!grown)
+            return -1;
+        blocks = grown;
+        indexCapacity = capacity;
+    }
+
+    blocks[indexCount].firstTime = firstTime;
+    blocks[indexCount].lastTime = lastTime;
+    blocks[indexCount].offset = offset;
+    indexCount++;
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Closes an archive that openArchive could not read completely
+ *           and drops the index built so far.
+ *
+ * @return   -1, the result of openArchive.
+ ******************************************************************************/
+static int abortOpen(void)
+{
+    if (archiveFd >= 0)
+        close(archiveFd);
+    archiveFd = -1;
+    archiveSize = 0;
+
+    free(blocks);
+    blocks = NULL;
+    indexCount = 0;
+    indexCapacity = 0;
+    return -1;
+}
+
+/*******************************************************************************
+ * @brief    Decodes a block and visits its points within the range.
+ *
+ * @return   Number of visited points, or -(n + 1) if visit stopped the
+ *           query after n points.
+ ******************************************************************************/
+static int decodeBlock(const ArchiveBlock *b, uint32_t from, uint32_t to, ArchiveVisitFn visit, void *arg)
+{
+    const uint8_t *payload = (const uint8_t *)(b + 1);
+    BitStream values = { (uint8_t *)payload, 0 };
+    BitStream runs = { (uint8_t *)payload + (b->valueBits + 7) / 8, 0 };
+    XorState temp = { 0, 33, 0 };
+    XorState heater = { 0, 33, 0 };
+    ArchivePoint point;
+    uint32_t time = b->firstTime, remaining = 0;
+    int32_t delta = 0;
+    int visited = 0;
+
+    for (int i = 0; i < b->count; i++) {
+        if (i > 0) {
+            delta += decodeTime(&values);
+            time += delta;
+        }
+
+        point.time = time;
+        point.temp = decodeXor(&values, &temp);
+        point.heater = decodeXor(&values, &heater);
+
+        if (remaining == 0) {
+            point.states = getBits(&runs, 4);
+            remaining = getBits(&runs, 10) + 1;
+        }
+        remaining--;
+
+        if (time > to)
+            break;
+        if (time < from)
+            continue;
+
+        visited++;
+        if (!visit(&point, arg))
+            return -visited - 1;
+    }
+
+    return visited;
+}
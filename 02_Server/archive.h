@@ -0,0 +1,35 @@
+#ifndef ARCHIVE_H_
+#define ARCHIVE_H_
+
+//-----Header-Files----------------------------------------------------------------
+#include <stdint.h>
+
+//-----Macros----------------------------------------------------------------------
+#define ARCHIVE_MAGIC           0x42415257  // "WRAB"
+#define ARCHIVE_BLOCK_POINTS    240         // Points per block, 4 hours of minutes
+
+// Bits of the utility states
+#define ARCHIVE_STATE_TV            0x01
+#define ARCHIVE_STATE_HEATER        0x02
+#define ARCHIVE_STATE_LAMP_FLOOR    0x04
+#define ARCHIVE_STATE_LAMP_CEIL     0x08
+
+//-----Data types------------------------------------------------------------------
+typedef struct {
+    uint32_t time;          // Seconds since the epoch
+    float temp;             // Temperature in °C
+    float heater;           // Heater-on fraction (duty cycle)
+    uint8_t states;         // ARCHIVE_STATE_* bits
+} ArchivePoint;
+
+// Return 0 to stop the query
+typedef int (*ArchiveVisitFn)(const ArchivePoint *point, void *arg);
+
+//-----Function prototypes---------------------------------------------------------
+extern int  openArchive(const char *filename);
+extern void closeArchive(void);
+extern void appendArchive(uint32_t time, float temp, float heater, uint8_t states);
+extern int  queryArchive(uint32_t from, uint32_t to, ArchiveVisitFn visit, void *arg);
+extern long getArchiveSize(void);
+
+#endif
@@ -0,0 +1,178 @@
+/*******************************************************************************
+ * @file       arena.c
+ *******************************************************************************
+ *
+ * @brief      Bump arena used as the allocator of jansson.
+ *
+ * @details    Every command builds and drops a small tree of jansson nodes
+ *             and strings. Between beginArena() and endArena() the nodes are
+ *             carved from a static buffer by moving a pointer, freeing them
+ *             does nothing (except for the block allocated last, which is
+ *             given back), and endArena() discards all of them at once. So a
+ *             command neither calls malloc nor fragments the small heap of
+ *             the Pi. Outside of a request, on other threads and when the
+ *             arena is full, blocks come from the fallback allocator, malloc
+ *             unless initArena() was given another one; frees are told apart
+ *             by their address.
+ *
+ *             Nothing allocated in a request may be used after endArena().
+ *             A value that must outlive it is copied with keepArenaJson().
+ *             The arena belongs to one thread, the one serving the
+ *             connections.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              initArena
+ *              beginArena
+ *              endArena
+ *              keepArenaJson
+ *              getArenaStats
+ *
+ *  Functions  local:
+ *              arenaMalloc
+ *              arenaFree
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "arena.h"
+
+//----- Macros -----------------------------------------------------------------
+#define ARENA_ALIGN _Alignof(max_align_t)   // Alignment of malloc
+
+//----- Function prototypes ----------------------------------------------------
+static void *arenaMalloc(size_t size);
+static void  arenaFree(void *ptr);
+
+//----- Global variables -------------------------------------------------------
+static _Alignas(max_align_t) unsigned char arena[ARENA_SIZE];
+static size_t arenaTop = 0;             // Bytes in use
+static size_t arenaHigh = 0;            // Most bytes in use in this request
+static unsigned char *lastBlock = NULL; // Block allocated last, NULL if freed
+static __thread unsigned int arenaDepth = 0;    // Nested requests of this thread
+static json_malloc_t fallbackMalloc = malloc;
+static json_free_t fallbackFree = free;
+static ArenaStats stats;
+
+/*******************************************************************************
+ * @brief    Installs the arena as the allocator of jansson. Must be called
+ *           before jansson allocates anything.
+ *
+ * @param    mallocFn  Allocator outside of requests, NULL for malloc.
+ * @param    freeFn    Its free function, NULL for free.
+ ******************************************************************************/
+void initArena(json_malloc_t mallocFn, json_free_t freeFn)
+{
+    fallbackMalloc = mallocFn ? mallocFn : malloc;
+    fallbackFree = freeFn ? freeFn : free;
+    json_set_alloc_funcs(arenaMalloc, arenaFree);
+}
+
+/*******************************************************************************
+ * @brief    Starts a request, jansson allocates from the arena until the
+ *           matching endArena(). Requests may be nested, the outermost one
+ *           decides when the arena is reset.
+ ******************************************************************************/
+void beginArena(void)
+{
+    arenaDepth++;
+}
+
+/*******************************************************************************
+ * @brief    Ends a request. At the end of the outermost one all blocks of the
+ *           arena are discarded.
+ ******************************************************************************/
+void endArena(void)
+{
+    if (arenaDepth == 0 || --arenaDepth > 0)
+        return;
+
+    if (arenaHigh > stats.peak)
+        stats.peak = arenaHigh;
+    stats.requests++;
+    arenaTop = 0;
+    arenaHigh = 0;
+    lastBlock = NULL;
+}
+
+/*******************************************************************************
+ * @brief    Copies a value with the fallback allocator, so it survives the
+ *           end of the request.
+ *
+ * @param    value  Value to keep, may be NULL.
+ * @return   A new reference to the copy, NULL if value is NULL or on failure.
+ ******************************************************************************/
+json_t *keepArenaJson(json_t *value)
+{
+    unsigned int depth = arenaDepth;
+
+    // json_deep_copy() allocates even for NULL
+    if (!value)
+        return NULL;
+
+    arenaDepth = 0;
+    json_t *copy = json_deep_copy(value);
+    arenaDepth = depth;
+
+    return copy;
+}
+
+/*******************************************************************************
+ * @brief    Returns the usage of the arena since the start.
+ ******************************************************************************/
+void getArenaStats(ArenaStats *usage)
+{
+    *usage = stats;
+}
+
+/*******************************************************************************
+ * @brief    Allocator of jansson: bumps the arena during a request, uses the
+ *           fallback allocator otherwise or when the arena is full.
+ ******************************************************************************/
+static void *arenaMalloc(size_t size)
+{
+    if (arenaDepth == 0)
+        return fallbackMalloc(size);
+
+    size_t aligned = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (aligned > ARENA_SIZE - arenaTop) {
+        stats.fallbacks++;
+        return fallbackMalloc(size);
+    }
+
+    lastBlock = arena + arenaTop;
+    arenaTop += aligned;
+    if (arenaTop > arenaHigh)
+        arenaHigh = arenaTop;
+    stats.allocations++;
+
+    return lastBlock;
+}
+
+/*******************************************************************************
+ * @brief    Free function of jansson: blocks of the arena are dropped with the
+ *           request, only the last one is given back at once. Other blocks
+ *           go to the fallback allocator.
+ ******************************************************************************/
+static void arenaFree(void *ptr)
+{
+    unsigned char *block = ptr;
+
+    if (block < arena || block >= arena + ARENA_SIZE) {
+        fallbackFree(ptr);
+        return;
+    }
+
+    if (block == lastBlock) {
+        arenaTop = (size_t)(block - arena);
+        lastBlock = NULL;
+    }
+}
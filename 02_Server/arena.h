@@ -0,0 +1,28 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+//-----Header-Files----------------------------------------------------------------
+#include <stddef.h>
+#include <stdint.h>
+
+#include "jansson.h"
+
+//-----Macros----------------------------------------------------------------------
+#define ARENA_SIZE 131072               // Bytes of the arena, holds the default energy response
+
+//-----Data types------------------------------------------------------------------
+typedef struct {
+    size_t peak;                        // Most bytes used by one request
+    uint64_t requests;                  // Completed requests
+    uint64_t allocations;               // Blocks taken from the arena
+    uint64_t fallbacks;                 // Blocks taken from the fallback allocator
+} ArenaStats;
+
+//-----Function prototypes---------------------------------------------------------
+extern void initArena(json_malloc_t mallocFn, json_free_t freeFn);
+extern void beginArena(void);
+extern void endArena(void);
+extern json_t *keepArenaJson(json_t *value);
+extern void getArenaStats(ArenaStats *usage);
+
+#endif
@@ -0,0 +1,169 @@
+/*******************************************************************************
+ * @file       capture.c
+ *******************************************************************************
+ *
+ * @brief      Capture of the WebSocket traffic for a later replay.
+ *
+ * @details    Every frame received or sent on a connection is written as a
+ *             16 byte record with the monotonic time and the connection
+ *             slot, followed by the frame as it was on the wire. Opened and
+ *             closed connections and the utility states at the start and
+ *             the end are recorded as well, so wsreplay can feed the
+ *             session into another server and compare the outcome. The
+ *             records are buffered and written in blocks by the event
+ *             loop, flushCapture bounds what a crash loses.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              openCapture
+ *              closeCapture
+ *              isCaptureOpen
+ *              captureEvent
+ *              captureFrames
+ *              flushCapture
+ *
+ *  Functions  local:
+ *              getCaptureTime
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "capture.h"
+#include "handshake.h"
+
+//----- Function prototypes ----------------------------------------------------
+static uint64_t getCaptureTime(void);
+
+//----- Global variables -------------------------------------------------------
+static FILE *captureFile = NULL;
+static uint64_t captureStart = 0;
+
+/*******************************************************************************
+ * @brief    Creates the capture file, an existing one is overwritten.
+ *
+ * @param    filename  File the traffic is written to.
+ * @return   0 if successful, -1 on failure.
+ ******************************************************************************/
+int openCapture(const char *filename)
+{
+    CaptureHeader header = { CAPTURE_MAGIC, CAPTURE_VERSION, 0, 0 };
+    struct timeval now;
+
+    closeCapture();
+
+    captureFile = fopen(filename, "wb");
+    if (!captureFile)
+        return -1;
+    setvbuf(captureFile, NULL, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+    gettimeofday(&now, NULL);
+    header.started = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+    captureStart = getCaptureTime();
+
+    if (fwrite(&header, sizeof(header), 1, captureFile) != 1) {
+        fclose(captureFile);
+        captureFile = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Writes the buffered records and closes the capture file.
+ ******************************************************************************/
+void closeCapture(void)
+{
+    if (captureFile) {
+        fclose(captureFile);
+        captureFile = NULL;
+    }
+}
+
+/*******************************************************************************
+ * @brief    Returns nonzero while the traffic is captured.
+ ******************************************************************************/
+int isCaptureOpen(void)
+{
+    return captureFile != NULL;
+}
+
+/*******************************************************************************
+ * @brief    Appends a record. Does nothing without an open capture.
+ *
+ * @param    conn  Connection slot.
+ * @param    type  CAPTURE_* type of the record.
+ * @param    data  Data of the record, NULL if len is 0.
+ * @param    len   Length of the data.
+ ******************************************************************************/
+void captureEvent(int conn, int type, const void *data, uint32_t len)
+{
+    CaptureRecord record;
+
+    if (!captureFile)
+        return;
+
+    record.ns = getCaptureTime() - captureStart;
+    record.conn = (uint16_t)conn;
+    record.type = (uint8_t)type;
+    record.reserved = 0;
+    record.len = len;
+
+    fwrite(&record, sizeof(record), 1, captureFile);
+    if (len > 0)
+        fwrite(data, 1, len, captureFile);
+}
+
+/*******************************************************************************
+ * @brief    Appends one record per frame of a buffer, e.g. the responses
+ *           sent together after a group commit.
+ *
+ * @param    conn  Connection slot.
+ * @param    type  CAPTURE_IN or CAPTURE_OUT.
+ * @param    data  Complete frames.
+ * @param    len   Length of the frames.
+ ******************************************************************************/
+void captureFrames(int conn, int type, const char *data, int len)
+{
+    if (!captureFile)
+        return;
+
+    while (len > 0) {
+        int frame_len = get_frame_length((char *)data, len);
+        if (frame_len <= 0)
+            frame_len = len;
+
+        captureEvent(conn, type, data, (uint32_t)frame_len);
+        data += frame_len;
+        len -= frame_len;
+    }
+}
+
+/*******************************************************************************
+ * @brief    Writes the buffered records to the file.
+ ******************************************************************************/
+void flushCapture(void)
+{
+    if (captureFile)
+        fflush(captureFile);
+}
+
+/*******************************************************************************
+ * @brief    Returns the monotonic clock in nanoseconds.
+ ******************************************************************************/
+static uint64_t getCaptureTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
@@ -0,0 +1,44 @@
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+//-----Header-Files----------------------------------------------------------------
+#include <stdint.h>
+
+//-----Macros----------------------------------------------------------------------
+#define CAPTURE_MAGIC       0x50434857      // "WHCP"
+#define CAPTURE_VERSION     1
+#define CAPTURE_BUFFER_SIZE 65536           // Records are written in blocks
+
+// Record types
+#define CAPTURE_OPEN        0       // Handshake of a connection completed
+#define CAPTURE_CLOSE       1       // Connection closed
+#define CAPTURE_IN          2       // Frame received, as on the wire (masked)
+#define CAPTURE_OUT         3       // Frame sent
+#define CAPTURE_STATE       4       // int32_t values[] indexed by STATE_* key
+
+//-----Data types------------------------------------------------------------------
+typedef struct {
+    uint32_t magic;         // CAPTURE_MAGIC
+    uint16_t version;       // CAPTURE_VERSION
+    uint16_t reserved;
+    uint64_t started;       // Wall clock of the start in microseconds since the epoch
+} CaptureHeader;
+
+// Followed by len bytes of data
+typedef struct {
+    uint64_t ns;            // Monotonic time since the start of the capture
+    uint16_t conn;          // Connection slot, reused after a close
+    uint8_t type;           // CAPTURE_*
+    uint8_t reserved;
+    uint32_t len;
+} CaptureRecord;
+
+//-----Function prototypes---------------------------------------------------------
+extern int  openCapture(const char *filename);
+extern void closeCapture(void);
+extern int  isCaptureOpen(void);
+extern void captureEvent(int conn, int type, const void *data, uint32_t len);
+extern void captureFrames(int conn, int type, const char *data, int len);
+extern void flushCapture(void);
+
+#endif
@@ -0,0 +1,235 @@
+/*******************************************************************************
+ * @file       clock.c
+ *******************************************************************************
+ *
+ * @brief      Time base of the simulation: real, scaled or virtual time.
+ *
+ * @details    The temperature model, the thermostat, the persistence and the
+ *             lamp fades take their time from here instead of the system
+ *             clocks. In real time the system clocks are passed through. In
+ *             scaled time the clock runs a fixed factor faster than the
+ *             monotonic clock and sleeps are shortened by the same factor.
+ *             In virtual time the clock stands still until the event loop
+ *             advances it tick by tick, so a run does not depend on the
+ *             speed of the machine and gives the same results every time.
+ *             Threads sleeping on a virtual clock are woken when it passes
+ *             their deadline.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              initClock
+ *              getClockMode
+ *              getClockScale
+ *              getClockNs
+ *              getClockWallUs
+ *              getClockTime
+ *              sleepClock
+ *              advanceClock
+ *
+ *  Functions  local:
+ *              getSystemNs
+ *              unlockSleepers
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "clock.h"
+
+//----- Function prototypes ----------------------------------------------------
+static uint64_t getSystemNs(clockid_t id);
+static void unlockSleepers(void *arg);
+
+//----- Global variables -------------------------------------------------------
+static int clockMode = CLOCK_REAL;
+static double clockScale = 1.0;
+static uint64_t startNs = 0;            // Monotonic clock at initClock()
+static uint64_t startWallUs = 0;        // Wall clock at initClock()
+static uint64_t virtualNs = 0;          // Time of the virtual clock
+static uint64_t nextWake = UINT64_MAX;  // Earliest deadline of a sleeping thread
+static pthread_mutex_t sleepLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sleepCond = PTHREAD_COND_INITIALIZER;
+
+/*******************************************************************************
+ * @brief    Selects the time base. Must be called before any other thread
+ *           reads the clock.
+ *
+ * @param    spec  "real" (or NULL), "scaled" with an optional factor as in
+ *                 "scaled:1000", or "virtual".
+ * @return   0 if successful, -1 if the spec is invalid.
+ ******************************************************************************/
+int initClock(const char *spec)
+{
+    if (!spec || strcmp(spec, "real") == 0) {
+        clockMode = CLOCK_REAL;
+        clockScale = 1.0;
+    }
+    else if (strncmp(spec, "scaled", 6) == 0 && (spec[6] == '\0' || spec[6] == ':')) {
+        clockMode = CLOCK_SCALED;
+        clockScale = spec[6] ? strtod(spec + 7, NULL) : CLOCK_DEFAULT_SCALE;
+        if (!(clockScale > 0))
+            return -1;
+    }
+    else if (strcmp(spec, "virtual") == 0) {
+        clockMode = CLOCK_VIRTUAL;
+        clockScale = 1.0;
+    }
+    else {
+        return -1;
+    }
+
+    startNs = getSystemNs(CLOCK_MONOTONIC);
+    startWallUs = getSystemNs(CLOCK_REALTIME) / 1000;
+    if (clockMode == CLOCK_VIRTUAL) {
+        startNs = 0;
+        startWallUs = CLOCK_VIRTUAL_START * 1000000;
+        __atomic_store_n(&virtualNs, 0, __ATOMIC_SEQ_CST);
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Returns the time base, CLOCK_REAL, CLOCK_SCALED or CLOCK_VIRTUAL.
+ ******************************************************************************/
+int getClockMode(void)
+{
+    return clockMode;
+}
+
+/*******************************************************************************
+ * @brief    Returns how many times faster than real time the clock runs,
+ *           1 in real and virtual time.
+ ******************************************************************************/
+double getClockScale(void)
+{
+    return clockScale;
+}
+
+/*******************************************************************************
+ * @brief    Returns the monotonic time of the clock in nanoseconds.
+ ******************************************************************************/
+uint64_t getClockNs(void)
+{
+    switch (clockMode) {
+    case CLOCK_SCALED:
+        return startNs + (uint64_t)((getSystemNs(CLOCK_MONOTONIC) - startNs) * clockScale);
+    case CLOCK_VIRTUAL:
+        return __atomic_load_n(&virtualNs, __ATOMIC_SEQ_CST);
+    default:
+        return getSystemNs(CLOCK_MONOTONIC);
+    }
+}
+
+/*******************************************************************************
+ * @brief    Returns the wall clock in microseconds since the epoch. Scaled
+ *           and virtual time start at the wall clock of initClock() and at
+ *           CLOCK_VIRTUAL_START respectively.
+ ******************************************************************************/
+uint64_t getClockWallUs(void)
+{
+    if (clockMode == CLOCK_REAL)
+        return getSystemNs(CLOCK_REALTIME) / 1000;
+
+    return startWallUs + (getClockNs() - startNs) / 1000;
+}
+
+/*******************************************************************************
+ * @brief    Returns the wall clock in seconds since the epoch.
+ ******************************************************************************/
+uint32_t getClockTime(void)
+{
+    return (uint32_t)(getClockWallUs() / 1000000);
+}
+
+/*******************************************************************************
+ * @brief    Suspends the calling thread for a duration of the clock. On a
+ *           virtual clock the thread waits until the event loop advanced
+ *           the clock far enough. Must not be called by the thread that
+ *           advances the virtual clock.
+ *
+ * @param    ns  Duration in nanoseconds.
+ ******************************************************************************/
+void sleepClock(uint64_t ns)
+{
+    struct timespec ts;
+
+    if (clockMode == CLOCK_SCALED)
+        ns = (uint64_t)(ns / clockScale);
+
+    if (clockMode != CLOCK_VIRTUAL) {
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+            // Interrupted by a signal, sleep the rest
+        }
+        return;
+    }
+
+    uint64_t deadline = getClockNs() + ns;
+
+    pthread_mutex_lock(&sleepLock);
+    pthread_cleanup_push(unlockSleepers, NULL);
+    for (;;) {
+        // Publish the deadline before checking the clock, advanceClock
+        // checks them the other way round
+        if (deadline < __atomic_load_n(&nextWake, __ATOMIC_SEQ_CST))
+            __atomic_store_n(&nextWake, deadline, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&virtualNs, __ATOMIC_SEQ_CST) >= deadline)
+            break;
+        pthread_cond_wait(&sleepCond, &sleepLock);
+    }
+    pthread_cleanup_pop(1);
+}
+
+/*******************************************************************************
+ * @brief    Advances a virtual clock and wakes the threads whose deadline
+ *           has passed. Has no effect on a real or scaled clock.
+ *
+ * @param    ns  Duration in nanoseconds.
+ ******************************************************************************/
+void advanceClock(uint64_t ns)
+{
+    if (clockMode != CLOCK_VIRTUAL)
+        return;
+
+    uint64_t now = __atomic_add_fetch(&virtualNs, ns, __ATOMIC_SEQ_CST);
+
+    if (now >= __atomic_load_n(&nextWake, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&sleepLock);
+        __atomic_store_n(&nextWake, UINT64_MAX, __ATOMIC_SEQ_CST);
+        pthread_cond_broadcast(&sleepCond);
+        pthread_mutex_unlock(&sleepLock);
+    }
+}
+
+/*******************************************************************************
+ * @brief    Returns a system clock in nanoseconds.
+ ******************************************************************************/
+static uint64_t getSystemNs(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*******************************************************************************
+ * @brief    Releases the sleep lock of a thread cancelled in sleepClock().
+ ******************************************************************************/
+static void unlockSleepers(void *arg)
+{
+    (void)arg;
+    pthread_mutex_unlock(&sleepLock);
+}
@@ -0,0 +1,25 @@
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+//-----Header-Files----------------------------------------------------------------
+#include <stdint.h>
+
+//-----Macros----------------------------------------------------------------------
+#define CLOCK_REAL          0       // Time passes as on the wall
+#define CLOCK_SCALED        1       // Time passes getClockScale() times faster
+#define CLOCK_VIRTUAL       2       // Time only passes through advanceClock()
+
+#define CLOCK_DEFAULT_SCALE 1000
+#define CLOCK_VIRTUAL_START 1767225600ull   // Wall clock of a virtual run, 2026-01-01 00:00 UTC
+
+//-----Function prototypes---------------------------------------------------------
+extern int  initClock(const char *spec);
+extern int  getClockMode(void);
+extern double getClockScale(void);
+extern uint64_t getClockNs(void);
+extern uint64_t getClockWallUs(void);
+extern uint32_t getClockTime(void);
+extern void sleepClock(uint64_t ns);
+extern void advanceClock(uint64_t ns);
+
+#endif
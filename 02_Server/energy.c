@@ -0,0 +1,358 @@
+/*******************************************************************************
+ * @file       energy.c
+ *******************************************************************************
+ *
+ * @brief      On-time and energy accounting of the Webhouse utilities.
+ *
+ * @details    The device layer reports every state transition with the new
+ *             load level of the device (0 off, 1 fully on, the duty cycle for
+ *             the lamps). The time since the previous transition is then
+ *             integrated into hourly and daily buckets, split at the bucket
+ *             boundaries, so the accounting is exact without sampling. A
+ *             lamp fade is reported once with its start and end level; the
+ *             load ramps linearly in between, like the PWM threads do it.
+ *             Energy is the duty-weighted on-time times the configured
+ *             wattage. Buckets and wattage are kept in a JSON file.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              setEnergyLoad
+ *              setEnergyFade
+ *              setEnergyWatts
+ *              getEnergyWatts
+ *              getEnergyName
+ *              getEnergyStep
+ *              getEnergyUsage
+ *              loadEnergy
+ *              saveEnergy
+ *
+ *  Functions  local:
+ *              now
+ *              bucketOf
+ *              accrue
+ *              integrate
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jansson.h"
+#include "energy.h"
+#include "stateimage.h"
+#include "clock.h"
+#include "log.h"
+
+//----- Macros -----------------------------------------------------------------
+#define HOUR_BUCKETS    168
+#define DAY_BUCKETS     366
+
+//----- Data types -------------------------------------------------------------
+typedef struct {
+    uint32_t start;                         // Start of the period, 0 if unused
+    EnergyUsage usage[ENERGY_DEVICES];
+} EnergyBucket;
+
+//----- Function prototypes ----------------------------------------------------
+static double now(void);
+static EnergyBucket *bucketOf(int period, uint32_t time);
+static void accrue(double until);
+static EnergyUsage integrate(int device, double begin, double end);
+
+//----- Global variables -------------------------------------------------------
+static const char *names[ENERGY_DEVICES] = { "tv", "heater", "lamp_floor", "lamp_ceil" };
+static const uint32_t steps[2] = { 3600, 86400 };
+static EnergyBucket hours[HOUR_BUCKETS];
+static EnergyBucket days[DAY_BUCKETS];
+
+static float watts[ENERGY_DEVICES] = { 100.0f, 2000.0f, 40.0f, 60.0f };
+static float levels[ENERGY_DEVICES];        // Current load, the end of a running fade
+static float fadeFrom[ENERGY_DEVICES];      // Load at the start of the fade
+static double fadeStart[ENERGY_DEVICES];    // Time the fade started
+static double fadeEnd[ENERGY_DEVICES];      // Time the fade ends, the level is flat after it
+static double lastTime = 0;                 // Time accrued up to
+
+/*******************************************************************************
+ * @brief    Reports a state transition of a device. The time at the
+ *           previous level is accounted first.
+ *
+ * @param    device  ENERGY_* device.
+ * @param    level   New load level [0,1].
+ ******************************************************************************/
+void setEnergyLoad(int device, float level)
+{
+    setEnergyFade(device, level, level, 0);
+}
+
+/*******************************************************************************
+ * @brief    Reports a linear fade of a device. The time at the previous
+ *           level or fade is accounted first.
+ *
+ * @param    device   ENERGY_* device.
+ * @param    from     Load level at the start of the fade [0,1].
+ * @param    level    Load level at the end of the fade [0,1].
+ * @param    fade_ms  Length of the fade, 0 to change the level at once.
+ ******************************************************************************/
+void setEnergyFade(int device, float from, float level, uint32_t fade_ms)
+{
+    from = from < 0.0f ? 0.0f : from > 1.0f ? 1.0f : from;
+    level = level < 0.0f ? 0.0f : level > 1.0f ? 1.0f : level;
+
+    accrue(now());
+    fadeFrom[device] = from;
+    levels[device] = level;
+    fadeStart[device] = lastTime;
+    fadeEnd[device] = lastTime + fade_ms / 1000.0;
+}
+
+/*******************************************************************************
+ * @brief    Sets the power draw of a device when fully on.
+ ******************************************************************************/
+void setEnergyWatts(int device, float value)
+{
+    watts[device] = value;
+}
+
+/*******************************************************************************
+ * @brief    Returns the power draw of a device when fully on.
+ ******************************************************************************/
+float getEnergyWatts(int device)
+{
+    return watts[device];
+}
+
+/*******************************************************************************
+ * @brief    Returns the name of a device as used in JSON.
+ ******************************************************************************/
+const char *getEnergyName(int device)
+{
+    return names[device];
+}
+
+/*******************************************************************************
+ * @brief    Returns the length of an ENERGY_* period in seconds.
+ ******************************************************************************/
+uint32_t getEnergyStep(int period)
+{
+    return steps[period];
+}
+
+/*******************************************************************************
+ * @brief    Returns the usage of all devices in a period, including the
+ *           time at the current levels up to now.
+ *
+ * @param    period  ENERGY_HOUR or ENERGY_DAY.
+ * @param    start   Any second within the period.
+ * @param    usage   Receives the usage per ENERGY_* device.
+ * @return   1 if the period is recorded, 0 otherwise.
+ ******************************************************************************/
+int getEnergyUsage(int period, uint32_t start, EnergyUsage usage[ENERGY_DEVICES])
+{
+    uint32_t begin = start - start % steps[period];
+    const EnergyBucket *b = period == ENERGY_HOUR ? &hours[(begin / steps[period]) % HOUR_BUCKETS]
+                                                  : &days[(begin / steps[period]) % DAY_BUCKETS];
+
+    accrue(now());
+
+    if (b->start != begin) {
+        memset(usage, 0, ENERGY_DEVICES * sizeof(EnergyUsage));
+        return 0;
+    }
+
+    memcpy(usage, b->usage, ENERGY_DEVICES * sizeof(EnergyUsage));
+    return 1;
+}
+
+/*******************************************************************************
+ * @brief    Loads the wattage and the buckets. Missing entries keep their
+ *           defaults.
+ *
+ * @param    filename  Path of the JSON file.
+ * @return   0 if successful, -1 if the file could not be read.
+ ******************************************************************************/
+int loadEnergy(const char *filename)
+{
+    json_error_t error;
+    json_t *root = json_load_file(filename, 0, &error);
+
+    if (!root) {
+        logWarn("Error loading file %s: %s", filename, error.text);
+        return -1;
+    }
+
+    json_t *config = json_object_get(root, "watts");
+    for (int i = 0; i < ENERGY_DEVICES; i++) {
+        json_t *value = json_object_get(config, names[i]);
+        if (json_is_number(value))
+            watts[i] = (float)json_number_value(value);
+    }
+
+    // Buckets are [start, on_s, duty_s, on_s, duty_s, ...] in device order
+    for (int period = ENERGY_HOUR; period <= ENERGY_DAY; period++) {
+        json_t *list = json_object_get(root, period == ENERGY_HOUR ? "hours" : "days");
+        size_t index;
+        json_t *entry;
+
+        json_array_foreach(list, index, entry) {
+            if (json_array_size(entry) != 1 + 2 * ENERGY_DEVICES)
+                continue;
+
+            uint32_t start = (uint32_t)json_integer_value(json_array_get(entry, 0));
+            EnergyBucket *b = bucketOf(period, start);
+            for (int i = 0; i < ENERGY_DEVICES; i++) {
+                b->usage[i].onSeconds = json_number_value(json_array_get(entry, 1 + 2 * i));
+                b->usage[i].dutySeconds = json_number_value(json_array_get(entry, 2 + 2 * i));
+            }
+        }
+    }
+
+    json_decref(root);
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Writes the wattage and the buckets atomically.
+ *
+ * @param    filename  Path of the JSON file.
+ * @return   0 if successful, -1 on failure.
+ ******************************************************************************/
+int saveEnergy(const char *filename)
+{
+    json_t *root = json_object();
+    json_t *config = json_object();
+
+    accrue(now());
+
+    for (int i = 0; i < ENERGY_DEVICES; i++)
+        json_object_set_new(config, names[i], json_real(watts[i]));
+    json_object_set_new(root, "watts", config);
+
+    for (int period = ENERGY_HOUR; period <= ENERGY_DAY; period++) {
+        int buckets = period == ENERGY_HOUR ? HOUR_BUCKETS : DAY_BUCKETS;
+        EnergyBucket *b = period == ENERGY_HOUR ? hours : days;
+        json_t *list = json_array();
+
+        for (int k = 0; k < buckets; k++) {
+            if (!b[k].start)
+                continue;
+
+            json_t *entry = json_array();
+            json_array_append_new(entry, json_integer(b[k].start));
+            for (int i = 0; i < ENERGY_DEVICES; i++) {
+                json_array_append_new(entry, json_real(b[k].usage[i].onSeconds));
+                json_array_append_new(entry, json_real(b[k].usage[i].dutySeconds));
+            }
+            json_array_append_new(list, entry);
+        }
+        json_object_set_new(root, period == ENERGY_HOUR ? "hours" : "days", list);
+    }
+
+    char *text = json_dumps(root, JSON_COMPACT);
+    json_decref(root);
+    if (!text)
+        return -1;
+
+    // The text comes from the allocator of jansson
+    json_free_t release;
+    json_get_alloc_funcs(NULL, &release);
+    int ret = writeFileAtomic(filename, text, strlen(text));
+    release(text);
+    if (ret < 0) {
+        logError("Error saving file: %s", filename);
+    }
+
+    return ret;
+}
+
+/*******************************************************************************
+ * @brief    Returns the wall clock of the server clock in seconds since the
+ *           epoch.
+ ******************************************************************************/
+static double now(void)
+{
+    return getClockWallUs() / 1e6;
+}
+
+/*******************************************************************************
+ * @brief    Returns the bucket of a period containing time. A bucket still
+ *           holding an older period is cleared and reused.
+ ******************************************************************************/
+static EnergyBucket *bucketOf(int period, uint32_t time)
+{
+    uint32_t start = time - time % steps[period];
+    EnergyBucket *b = period == ENERGY_HOUR ? &hours[(start / steps[period]) % HOUR_BUCKETS]
+                                            : &days[(start / steps[period]) % DAY_BUCKETS];
+
+    if (b->start != start) {
+        memset(b, 0, sizeof(*b));
+        b->start = start;
+    }
+
+    return b;
+}
+
+/*******************************************************************************
+ * @brief    Accounts the time from the last transition up to until at the
+ *           current levels, split at the hour boundaries. When the clock is
+ *           set back, the time in between is not accounted.
+ ******************************************************************************/
+static void accrue(double until)
+{
+    double t = lastTime;
+    int active = 0;
+
+    lastTime = until;
+    for (int i = 0; i < ENERGY_DEVICES; i++)
+        active |= levels[i] > 0.0f || (fadeEnd[i] > t && fadeFrom[i] > 0.0f);
+    if (t == 0 || until <= t || !active)
+        return;
+
+    while (t < until) {
+        uint32_t second = (uint32_t)t;
+        double end = (double)(second - second % 3600 + 3600);
+        double span = (end < until ? end : until) - t;
+        EnergyBucket *hour = bucketOf(ENERGY_HOUR, second);
+        EnergyBucket *day = bucketOf(ENERGY_DAY, second);
+
+        for (int i = 0; i < ENERGY_DEVICES; i++) {
+            EnergyUsage usage = integrate(i, t, t + span);
+            hour->usage[i].onSeconds += usage.onSeconds;
+            hour->usage[i].dutySeconds += usage.dutySeconds;
+            day->usage[i].onSeconds += usage.onSeconds;
+            day->usage[i].dutySeconds += usage.dutySeconds;
+        }
+        t += span;
+    }
+}
+
+/*******************************************************************************
+ * @brief    Integrates the load of a device over a span that starts at or
+ *           after the start of its fade. The fade ramp is a trapezoid, the
+ *           level after it is flat.
+ ******************************************************************************/
+static EnergyUsage integrate(int device, double begin, double end)
+{
+    EnergyUsage usage = { 0.0, 0.0 };
+    double split = fadeEnd[device] < begin ? begin : fadeEnd[device] > end ? end : fadeEnd[device];
+
+    if (split > begin && (fadeFrom[device] > 0.0f || levels[device] > 0.0f)) {
+        double slope = (levels[device] - fadeFrom[device]) / (fadeEnd[device] - fadeStart[device]);
+        double first = fadeFrom[device] + slope * (begin - fadeStart[device]);
+        double last = fadeFrom[device] + slope * (split - fadeStart[device]);
+        usage.onSeconds += split - begin;
+        usage.dutySeconds += (split - begin) * (first + last) / 2.0;
+    }
+    if (end > split && levels[device] > 0.0f) {
+        usage.onSeconds += end - split;
+        usage.dutySeconds += (end - split) * levels[device];
+    }
+
+    return usage;
+}
@@ -0,0 +1,36 @@
+#ifndef ENERGY_H_
+#define ENERGY_H_
+
+//-----Header-Files----------------------------------------------------------------
+#include <stdint.h>
+
+//-----Macros----------------------------------------------------------------------
+// Accounted devices
+#define ENERGY_TV           0
+#define ENERGY_HEATER       1
+#define ENERGY_LAMP_FLOOR   2       // Stand lamp
+#define ENERGY_LAMP_CEIL    3       // Roof lamp
+#define ENERGY_DEVICES      4
+
+// Accounting periods
+#define ENERGY_HOUR         0       // Hourly buckets of the last 7 days
+#define ENERGY_DAY          1       // Daily (UTC) buckets of the last year
+
+//-----Data types------------------------------------------------------------------
+typedef struct {
+    double onSeconds;       // Time the device was on at any level
+    double dutySeconds;     // On-time weighted with the duty cycle
+} EnergyUsage;
+
+//-----Function prototypes---------------------------------------------------------
+extern void setEnergyLoad(int device, float level);
+extern void setEnergyFade(int device, float from, float level, uint32_t fade_ms);
+extern void setEnergyWatts(int device, float watts);
+extern float getEnergyWatts(int device);
+extern const char *getEnergyName(int device);
+extern uint32_t getEnergyStep(int period);
+extern int  getEnergyUsage(int period, uint32_t start, EnergyUsage usage[ENERGY_DEVICES]);
+extern int  loadEnergy(const char *filename);
+extern int  saveEnergy(const char *filename);
+
+#endif
@@ -18,6 +18,7 @@
 #include "base64.h"
 #include "sha1.h"
 #include "handshake.h"
+#include "probes.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -103,7 +104,10 @@ int get_handshake_response(char hsrequest[], char hsresponse[])
 
     /* Ensure that we have a valid pointer. */
     if (s == NULL)
+    {
+        PROBE1(handshake, -1);
         return (-1);
+    }
 
     saveptr = NULL;
     s       = strtok_r(s, " ", &saveptr);
@@ -111,13 +115,17 @@ int get_handshake_response(char hsrequest[], char hsresponse[])
 
     ret = get_handshake_accept(s, &accept);
     if (ret < 0)
+    {
+        PROBE1(handshake, ret);
         return (ret);
+    }
 
     strcpy(hsresponse, WS_HS_ACCEPT);
     strcat(hsresponse, (const char *)accept);
     strcat(hsresponse, "\r\n\r\n");
 
     free(accept);
+    PROBE1(handshake, 0);
     return (0);
 }
 
@@ -208,36 +216,64 @@ int decode_incoming_request (char coded_request[], char request[], int coded_req
     return size;
 }
 
-int code_outgoing_response (char response[], char coded_response[]){
-    // read the number of data bytes to send
-    int size = strlen (response);
-    
-    if (size == 0) {
-        return (-1);
+/*******************************************************************************
+ * @brief    Determines the length of the first frame in a receive buffer.
+ *
+ *           A single recv may return several frames sent back-to-back, or
+ *           only the beginning of one. The length allows the caller to split
+ *           the buffer into frames and to keep an incomplete tail until the
+ *           rest of it arrives.
+ *
+ * @param    coded_request       Received bytes starting with a frame header.
+ * @param    coded_request_len   Number of received bytes.
+ *
+ * @return   Header plus payload length of the first frame, 0 if it is not
+ *           complete yet, or -1 if it uses the 64-bit payload length.
+ ******************************************************************************/
+int get_frame_length (char coded_request[], int coded_request_len) {
+    if (coded_request_len < 2) {
+        return 0;
     }
 
-    // add the 2 first header bytes to the response
-    coded_response[0] = 0x81;
-    coded_response[1] = size;
-    coded_response[2] = 0;
-    strcat(coded_response, response);
+    int size = coded_request[1] & 0x7F;
+    int header = 2 + ((coded_request[1] & 0x80) ? 4 : 0);
 
-    return (size);
+    if (size == 126) {
+        if (coded_request_len < 4) {
+            return 0;
+        }
+        size = ((coded_request[2] & 0xFF) << 8) | (coded_request[3] & 0xFF);
+        header += 2;
+    } else if (size == 127) {
+        return -1;
+    }
+
+    return (coded_request_len < header + size) ? 0 : header + size;
 }
 
-/*
-// Old function can only send responses to 124 bytes (rothl18)
-// TODO: This function still has to be completed, not working currently
-int code_outgoing_response(char response[], char coded_response[]) {
-    int size = strlen(response);
-    printf("Size: %d\n", size);
+/*******************************************************************************
+ * @brief    Encodes a response as an unmasked WebSocket text frame.
+ *
+ *           Payloads up to 125 bytes use the short header, longer ones the
+ *           16-bit or 64-bit extended payload length. The coded_response
+ *           buffer must hold strlen(response) + WS_FRAME_HDR_MAX bytes. As
+ *           the header may contain zero bytes, the returned length has to be
+ *           used instead of strlen().
+ *
+ * @param    response        Null-terminated payload.
+ * @param    coded_response  Buffer receiving the frame.
+ *
+ * @return   The length of the frame, or -1 if the response is empty.
+ ******************************************************************************/
+int code_outgoing_response (char response[], char coded_response[]){
+    // read the number of data bytes to send
+    size_t size = strlen (response);
+    int header_size;
 
     if (size == 0) {
-        return -1;
+        return (-1);
     }
 
-    int header_size;
-
     // Set the FIN bit and text frame opcode
     coded_response[0] = 0x81;
 
@@ -250,13 +286,14 @@ int code_outgoing_response(char response[], char coded_response[]) {
         coded_response[3] = size & 0xFF;        // Lower order byte
         header_size = 4;
     } else {
-        // Handling for size greater than 65535 is not implemented
-        return -1;
+        coded_response[1] = 127;
+        for (int i = 0; i < 8; i++) {
+            coded_response[2 + i] = ((uint64_t)size >> (56 - 8 * i)) & 0xFF;
+        }
+        header_size = 10;
     }
 
     // Copy the response into the coded_response buffer right after the header
     memcpy(coded_response + header_size, response, size);
-    return size + header_size;
+    return (int)size + header_size;
 }
-
-*/
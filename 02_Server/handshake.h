@@ -4,6 +4,10 @@
 extern int get_handshake_response  (char request[],       char hsresponse[]);
 extern int decode_incoming_request (char coded_request[], char request[], int coded_request_len);
 extern int code_outgoing_response  (char response[],      char coded_response[]);
+extern int get_frame_length        (char coded_request[], int coded_request_len);
+
+// Largest header of a frame sent by the server.
+#define WS_FRAME_HDR_MAX 10
 
 #define WS_KEY_LEN     24
 // Magic string length.
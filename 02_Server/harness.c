@@ -0,0 +1,104 @@
+/*******************************************************************************
+ * @file       harness.c
+ *******************************************************************************
+ *
+ * @brief      Setup and teardown shared by soak, microbench and selftest.
+ *
+ * @details    Creates a temporary directory for the server files, selects
+ *             the clock, puts the GPIO access into the bcm2835 debug mode
+ *             and starts the timer wheel. Closing stops the modules again
+ *             and removes the directory with the files in it. The steps
+ *             that need the local functions of main.c, restoring the
+ *             utilities and registering the timers, stay with the tools,
+ *             which include main.c.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              openHarness
+ *              closeHarness
+ *
+ *  Functions  local:
+ *              removeDirectory
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "harness.h"
+#include "Webhouse.h"
+#include "timerwheel.h"
+#include "wal.h"
+#include "alarmlog.h"
+#include "archive.h"
+#include "clock.h"
+#include "log.h"
+
+//----- Function prototypes ----------------------------------------------------
+static void removeDirectory(const char *directory);
+
+/*******************************************************************************
+ * @brief    Creates the temporary directory and makes it the working
+ *           directory, then starts the hardware and the timer wheel on the
+ *           given clock. Only errors are logged.
+ *
+ * @param    directory  mkdtemp template, holds the name afterwards.
+ * @param    clock      Clock spec as taken by initClock.
+ * @return   0 if successful, -1 on failure.
+ ******************************************************************************/
+int openHarness(char *directory, const char *clock)
+{
+    if (!mkdtemp(directory) || chdir(directory) < 0)
+        return -1;
+
+    setLogLevel(LOG_ERROR);
+    if (initClock(clock) < 0)
+        return -1;
+    setWebhouseDebug(1);
+    initWebhouse();
+
+    if (initTimerWheel() < 0)
+        return -1;
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Closes the timer wheel and the server files, then removes the
+ *           temporary directory.
+ *
+ * @param    directory  Directory created by openHarness.
+ ******************************************************************************/
+void closeHarness(const char *directory)
+{
+    closeTimerWheel();
+    closeWal();
+    closeAlarmLog();
+    closeArchive();
+    removeDirectory(directory);
+}
+
+/*******************************************************************************
+ * @brief    Removes the temporary directory and the files in it.
+ ******************************************************************************/
+static void removeDirectory(const char *directory)
+{
+    DIR *dir = opendir(directory);
+    struct dirent *entry;
+
+    while (dir && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.')
+            unlink(entry->d_name);
+    }
+    if (dir)
+        closedir(dir);
+    if (chdir("/") == 0)
+        rmdir(directory);
+}
@@ -0,0 +1,8 @@
+#ifndef HARNESS_H_
+#define HARNESS_H_
+
+//-----Function prototypes---------------------------------------------------------
+extern int  openHarness(char *directory, const char *clock);
+extern void closeHarness(const char *directory);
+
+#endif
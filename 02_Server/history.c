@@ -0,0 +1,228 @@
+/*******************************************************************************
+ * @file       history.c
+ *******************************************************************************
+ *
+ * @brief      Time series of the temperature and the heater state.
+ *
+ * @details    Samples are kept in three fixed-size rings: the raw 1 Hz
+ *             samples of the last hour, and 1 minute and 1 hour rollups with
+ *             min, max, mean and heater-on fraction. The rollups are updated
+ *             incrementally with every sample. The rings are ordered by time,
+ *             so a window is located by binary search and read in place.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              addHistorySample
+ *              selectHistoryTier
+ *              getHistoryStep
+ *              findHistory
+ *              getHistory
+ *
+ *  Functions  local:
+ *              pushPoint
+ *              accumulate
+ *              lowerBound
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <string.h>
+
+#include "history.h"
+
+//----- Macros -----------------------------------------------------------------
+#define RAW_POINTS      3600
+#define MINUTE_POINTS   1440
+#define HOUR_POINTS     720
+
+//----- Data types -------------------------------------------------------------
+typedef struct {
+    HistoryPoint *points;       // Storage of the ring
+    uint32_t capacity;          // Number of points in storage
+    uint32_t step;              // Seconds per point
+    uint32_t count;             // Valid points
+    uint32_t head;              // Next point to write
+} HistoryTier;
+
+// Rollup of the interval currently being filled
+typedef struct {
+    uint32_t start;             // Start of the interval
+    uint32_t samples;           // Samples in the interval, 0 if empty
+    uint32_t heaterOn;          // Samples with the heater on
+    float min;
+    float max;
+    double sum;
+} Rollup;
+
+//----- Function prototypes ----------------------------------------------------
+static void pushPoint(HistoryTier *tier, const HistoryPoint *point);
+static int accumulate(int tier, uint32_t time, float temp, int heater);
+static uint32_t lowerBound(const HistoryTier *tier, uint32_t time);
+
+//----- Global variables -------------------------------------------------------
+static HistoryPoint rawPoints[RAW_POINTS];
+static HistoryPoint minutePoints[MINUTE_POINTS];
+static HistoryPoint hourPoints[HOUR_POINTS];
+
+static HistoryTier tiers[HISTORY_TIERS] = {
+    { rawPoints, RAW_POINTS, 1, 0, 0 },
+    { minutePoints, MINUTE_POINTS, 60, 0, 0 },
+    { hourPoints, HOUR_POINTS, 3600, 0, 0 },
+};
+
+static Rollup rollups[HISTORY_TIERS];
+static uint32_t lastTime = 0;
+
+/*******************************************************************************
+ * @brief    Adds a sample to the raw tier and to the running rollups.
+ *           A clock set back is clamped, so the tiers stay in time order.
+ *
+ * @param    time    Seconds since the epoch.
+ * @param    temp    Temperature in °C.
+ * @param    heater  1 if the heater is on, 0 otherwise.
+ * @return   Bit (1 << tier) set for every rollup tier that completed a point.
+ ******************************************************************************/
+int addHistorySample(uint32_t time, float temp, int heater)
+{
+    if (time < lastTime)
+        time = lastTime;
+    lastTime = time;
+
+    HistoryPoint point = { time, temp, temp, temp, heater ? 1.0f : 0.0f };
+
+    pushPoint(&tiers[HISTORY_RAW], &point);
+    return accumulate(HISTORY_MINUTE, time, temp, heater) << HISTORY_MINUTE |
+           accumulate(HISTORY_HOUR, time, temp, heater) << HISTORY_HOUR;
+}
+
+/*******************************************************************************
+ * @brief    Selects the finest tier whose step is at least the requested
+ *           resolution, the coarsest tier if none is that coarse.
+ *
+ * @param    resolution  Requested seconds between two points.
+ * @return   HISTORY_* tier.
+ ******************************************************************************/
+int selectHistoryTier(uint32_t resolution)
+{
+    int tier = HISTORY_RAW;
+
+    while (tier + 1 < HISTORY_TIERS && tiers[tier].step < resolution)
+        tier++;
+
+    return tier;
+}
+
+/*******************************************************************************
+ * @brief    Returns the seconds between two points of a tier.
+ ******************************************************************************/
+uint32_t getHistoryStep(int tier)
+{
+    return tiers[tier].step;
+}
+
+/*******************************************************************************
+ * @brief    Finds the points of a tier within a time range.
+ *
+ * @param    tier   HISTORY_* tier.
+ * @param    from   First second of the range (inclusive).
+ * @param    to     Last second of the range (inclusive).
+ * @param    first  Receives the index of the first point for getHistory.
+ * @return   Number of points in the range.
+ ******************************************************************************/
+uint32_t findHistory(int tier, uint32_t from, uint32_t to, uint32_t *first)
+{
+    const HistoryTier *t = &tiers[tier];
+
+    *first = lowerBound(t, from);
+    if (to < from)
+        return 0;
+
+    return (to == UINT32_MAX ? t->count : lowerBound(t, to + 1)) - *first;
+}
+
+/*******************************************************************************
+ * @brief    Returns a point of a tier, index 0 is the oldest one.
+ ******************************************************************************/
+const HistoryPoint *getHistory(int tier, uint32_t index)
+{
+    const HistoryTier *t = &tiers[tier];
+
+    return &t->points[(t->head + t->capacity - t->count + index) % t->capacity];
+}
+
+/*******************************************************************************
+ * @brief    Appends a point to a tier, overwriting the oldest when full.
+ ******************************************************************************/
+static void pushPoint(HistoryTier *tier, const HistoryPoint *point)
+{
+    tier->points[tier->head] = *point;
+    tier->head = (tier->head + 1) % tier->capacity;
+    if (tier->count < tier->capacity)
+        tier->count++;
+}
+
+/*******************************************************************************
+ * @brief    Folds a sample into the running rollup of a tier. When the
+ *           sample starts a new interval, the finished one is stored first.
+ *
+ * @return   1 if a finished interval was stored, 0 otherwise.
+ ******************************************************************************/
+static int accumulate(int tier, uint32_t time, float temp, int heater)
+{
+    Rollup *r = &rollups[tier];
+    uint32_t start = time - time % tiers[tier].step;
+    int done = 0;
+
+    if (r->samples && r->start != start) {
+        HistoryPoint point;
+        point.time = r->start;
+        point.min = r->min;
+        point.max = r->max;
+        point.avg = (float)(r->sum / r->samples);
+        point.heater = (float)r->heaterOn / r->samples;
+        pushPoint(&tiers[tier], &point);
+        r->samples = 0;
+        done = 1;
+    }
+
+    if (!r->samples) {
+        memset(r, 0, sizeof(*r));
+        r->start = start;
+        r->min = temp;
+        r->max = temp;
+    }
+
+    r->samples++;
+    r->heaterOn += heater ? 1 : 0;
+    r->sum += temp;
+    if (temp < r->min)
+        r->min = temp;
+    if (temp > r->max)
+        r->max = temp;
+
+    return done;
+}
+
+/*******************************************************************************
+ * @brief    Binary search for the first point not older than time.
+ ******************************************************************************/
+static uint32_t lowerBound(const HistoryTier *tier, uint32_t time)
+{
+    uint32_t low = 0;
+    uint32_t high = tier->count;
+
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (getHistory(tier - tiers, mid)->time < time)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
@@ -0,0 +1,30 @@
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+//-----Header-Files----------------------------------------------------------------
+#include <stdint.h>
+
+//-----Macros----------------------------------------------------------------------
+#define HISTORY_TIERS       3
+#define HISTORY_RAW         0       // 1 s samples of the last hour
+#define HISTORY_MINUTE      1       // 1 min rollups of the last day
+#define HISTORY_HOUR        2       // 1 h rollups of the last 30 days
+
+//-----Data types------------------------------------------------------------------
+// One point of a tier, raw samples have min == max == avg
+typedef struct {
+    uint32_t time;          // Start of the interval, seconds since the epoch
+    float min;              // Lowest temperature in the interval
+    float max;              // Highest temperature in the interval
+    float avg;              // Mean temperature of the interval
+    float heater;           // Fraction of the interval the heater was on
+} HistoryPoint;
+
+//-----Function prototypes---------------------------------------------------------
+extern int  addHistorySample(uint32_t time, float temp, int heater);
+extern int  selectHistoryTier(uint32_t resolution);
+extern uint32_t getHistoryStep(int tier);
+extern uint32_t findHistory(int tier, uint32_t from, uint32_t to, uint32_t *first);
+extern const HistoryPoint *getHistory(int tier, uint32_t index);
+
+#endif
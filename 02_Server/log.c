@@ -0,0 +1,331 @@
+/*******************************************************************************
+ * @file       log.c
+ *******************************************************************************
+ *
+ * @brief      Asynchronous logger of the server.
+ *
+ * @details    Every thread formats its messages into a ring of its own, a
+ *             single-producer single-consumer queue that needs no lock. A
+ *             background writer drains all rings every LOG_FLUSH_MS and
+ *             writes the lines in large batches, so a slow terminal or
+ *             journal never stalls the request path. Messages above the
+ *             configured level are discarded before they are formatted.
+ *             When a ring is full the message is dropped and counted, the
+ *             writer reports the count. Until openLog and after closeLog,
+ *             messages are written directly.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              openLog
+ *              closeLog
+ *              setLogLevel
+ *              getLogLevel
+ *              parseLogLevel
+ *              logMessage
+ *              getLogDropped
+ *
+ *  Functions  local:
+ *              getRing
+ *              formatRecord
+ *              writeBatch
+ *              drainRings
+ *              threadWriter
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "log.h"
+
+//----- Macros -----------------------------------------------------------------
+#define LOG_LINE_MAX    (LOG_TEXT_SIZE + 32)    // Formatted line incl. prefix
+#define LOG_BATCH_SIZE  8192                    // Bytes written at once
+
+//----- Data types -------------------------------------------------------------
+typedef struct {
+    struct timespec time;       // Wall clock of the message
+    uint8_t level;              // LOG_*
+    uint8_t reserved;
+    uint16_t len;               // Characters in text
+    char text[LOG_TEXT_SIZE];
+} LogRecord;
+
+typedef struct {
+    LogRecord records[LOG_RING_SIZE];
+    unsigned int head;          // Written by the owning thread only
+    unsigned int tail;          // Written by the writer only
+} LogRing;
+
+//----- Function prototypes ----------------------------------------------------
+static LogRing *getRing(void);
+static int  formatRecord(char *line, const LogRecord *record);
+static void writeBatch(const char *batch, size_t len);
+static void drainRings(void);
+static void *threadWriter(void *arg);
+
+//----- Global variables -------------------------------------------------------
+static const char *levelNames[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+
+static LogRing rings[LOG_THREADS];
+static unsigned int ringCount = 0;      // Rings handed out, may exceed LOG_THREADS
+static __thread LogRing *threadRing = NULL;
+static __thread int threadHasNoRing = 0;
+
+static volatile int logLevel = LOG_INFO;
+static int logFd = STDERR_FILENO;
+static int running = 0;
+static pthread_t writer;
+static uint64_t dropped = 0;            // Messages lost since the start
+static uint64_t droppedReported = 0;    // Written by the writer only
+
+/*******************************************************************************
+ * @brief    Starts the background writer.
+ *
+ * @param    fd     Descriptor the lines are written to.
+ * @param    level  Highest level that is logged.
+ * @return   0 if successful, -1 if the writer could not be started; the
+ *           messages are then written directly.
+ ******************************************************************************/
+int openLog(int fd, int level)
+{
+    logFd = fd;
+    setLogLevel(level);
+
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&writer, NULL, threadWriter, NULL) != 0) {
+        __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Stops the writer after it wrote all queued messages.
+ ******************************************************************************/
+void closeLog(void)
+{
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+        return;
+
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+}
+
+/*******************************************************************************
+ * @brief    Sets the highest level that is logged.
+ ******************************************************************************/
+void setLogLevel(int level)
+{
+    if (level < LOG_ERROR)
+        level = LOG_ERROR;
+    if (level > LOG_DEBUG)
+        level = LOG_DEBUG;
+    logLevel = level;
+}
+
+/*******************************************************************************
+ * @brief    Returns the highest level that is logged.
+ ******************************************************************************/
+int getLogLevel(void)
+{
+    return logLevel;
+}
+
+/*******************************************************************************
+ * @brief    Converts a level name ("error", "warn", "info", "debug").
+ *
+ * @return   The level, -1 if the name is unknown.
+ ******************************************************************************/
+int parseLogLevel(const char *name)
+{
+    for (int i = LOG_ERROR; name && i <= LOG_DEBUG; i++) {
+        if (strcasecmp(name, levelNames[i]) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/*******************************************************************************
+ * @brief    Queues a message, never blocks. A trailing newline is removed,
+ *           every message is one line.
+ *
+ * @param    level   LOG_* level of the message.
+ * @param    format  printf format of the message.
+ ******************************************************************************/
+void logMessage(int level, const char *format, ...)
+{
+    LogRecord direct;
+    LogRecord *record = &direct;
+    LogRing *ring = NULL;
+    va_list args;
+
+    if (level > logLevel)
+        return;
+
+    if (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        ring = getRing();
+        if (!ring) {
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (ring->head - tail >= LOG_RING_SIZE) {
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        record = &ring->records[ring->head & (LOG_RING_SIZE - 1)];
+    }
+
+    clock_gettime(CLOCK_REALTIME, &record->time);
+    record->level = (uint8_t)level;
+
+    va_start(args, format);
+    int len = vsnprintf(record->text, LOG_TEXT_SIZE, format, args);
+    va_end(args);
+
+    if (len < 0)
+        len = 0;
+    if (len > LOG_TEXT_SIZE - 1)
+        len = LOG_TEXT_SIZE - 1;
+    while (len > 0 && record->text[len - 1] == '\n')
+        len--;
+    record->len = (uint16_t)len;
+
+    if (ring) {
+        __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    }
+    else {
+        char line[LOG_LINE_MAX];
+        writeBatch(line, formatRecord(line, record));
+    }
+}
+
+/*******************************************************************************
+ * @brief    Returns the number of messages dropped because a ring was full.
+ ******************************************************************************/
+uint64_t getLogDropped(void)
+{
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+ * @brief    Returns the ring of the calling thread, assigned on its first
+ *           message. NULL if all rings are taken.
+ ******************************************************************************/
+static LogRing *getRing(void)
+{
+    if (!threadRing && !threadHasNoRing) {
+        unsigned int index = __atomic_fetch_add(&ringCount, 1, __ATOMIC_ACQ_REL);
+        if (index < LOG_THREADS)
+            threadRing = &rings[index];
+        else
+            threadHasNoRing = 1;
+    }
+
+    return threadRing;
+}
+
+/*******************************************************************************
+ * @brief    Formats a record as "YYYY-MM-DD hh:mm:ss.mmm LEVEL text\n".
+ *
+ * @return   Length of the line.
+ ******************************************************************************/
+static int formatRecord(char *line, const LogRecord *record)
+{
+    struct tm tm;
+
+    localtime_r(&record->time.tv_sec, &tm);
+    int len = (int)strftime(line, LOG_LINE_MAX, "%Y-%m-%d %H:%M:%S", &tm);
+    len += snprintf(line + len, LOG_LINE_MAX - len, ".%03ld %-5s %.*s\n",
+                    record->time.tv_nsec / 1000000, levelNames[record->level], record->len, record->text);
+
+    return len < LOG_LINE_MAX ? len : LOG_LINE_MAX - 1;
+}
+
+/*******************************************************************************
+ * @brief    Writes a batch of lines completely.
+ ******************************************************************************/
+static void writeBatch(const char *batch, size_t len)
+{
+    while (len > 0) {
+        ssize_t written = write(logFd, batch, len);
+        if (written <= 0)
+            return;
+        batch += written;
+        len -= written;
+    }
+}
+
+/*******************************************************************************
+ * @brief    Writes all queued messages, thread by thread, and a note about
+ *           messages dropped since the last call.
+ ******************************************************************************/
+static void drainRings(void)
+{
+    char batch[LOG_BATCH_SIZE];
+    size_t len = 0;
+    unsigned int count = __atomic_load_n(&ringCount, __ATOMIC_ACQUIRE);
+
+    if (count > LOG_THREADS)
+        count = LOG_THREADS;
+
+    for (unsigned int i = 0; i < count; i++) {
+        LogRing *ring = &rings[i];
+        unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        for (unsigned int tail = ring->tail; tail != head; tail++) {
+            if (len + LOG_LINE_MAX > sizeof(batch)) {
+                writeBatch(batch, len);
+                len = 0;
+            }
+            len += formatRecord(batch + len, &ring->records[tail & (LOG_RING_SIZE - 1)]);
+            __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    uint64_t lost = getLogDropped();
+    if (lost != droppedReported) {
+        LogRecord record;
+        clock_gettime(CLOCK_REALTIME, &record.time);
+        record.level = LOG_WARN;
+        record.len = (uint16_t)snprintf(record.text, LOG_TEXT_SIZE, "%llu log messages dropped",
+                                        (unsigned long long)(lost - droppedReported));
+        droppedReported = lost;
+        if (len + LOG_LINE_MAX > sizeof(batch)) {
+            writeBatch(batch, len);
+            len = 0;
+        }
+        len += formatRecord(batch + len, &record);
+    }
+
+    writeBatch(batch, len);
+}
+
+/*******************************************************************************
+ * @brief    Background writer, drains the rings until closeLog.
+ ******************************************************************************/
+static void *threadWriter(void *arg)
+{
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        drainRings();
+        usleep(LOG_FLUSH_MS * 1000);
+    }
+    drainRings();
+
+    return NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef LOG_H_
+#define LOG_H_
+
+//-----Header-Files----------------------------------------------------------------
+#include <stdint.h>
+
+//-----Macros----------------------------------------------------------------------
+// Levels, a message is kept if its level is not above the configured one
+#define LOG_ERROR       0
+#define LOG_WARN        1
+#define LOG_INFO        2
+#define LOG_DEBUG       3
+
+#define LOG_TEXT_SIZE   232         // Longest message, longer ones are cut
+#define LOG_RING_SIZE   128         // Records per thread, power of 2
+#define LOG_THREADS     8           // Threads that can log at the same time
+#define LOG_FLUSH_MS    50          // Interval of the background writer
+
+#define logError(...)   logMessage(LOG_ERROR, __VA_ARGS__)
+#define logWarn(...)    logMessage(LOG_WARN, __VA_ARGS__)
+#define logInfo(...)    logMessage(LOG_INFO, __VA_ARGS__)
+#define logDebug(...)   logMessage(LOG_DEBUG, __VA_ARGS__)
+
+//-----Function prototypes---------------------------------------------------------
+extern int  openLog(int fd, int level);
+extern void closeLog(void);
+extern void setLogLevel(int level);
+extern int  getLogLevel(void);
+extern int  parseLogLevel(const char *name);
+extern void logMessage(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+extern uint64_t getLogDropped(void);
+
+#endif
@@ -31,10 +31,43 @@
  *              shutdownHook
  *              InitWebhouseUtilities
  *              InitSocket
+ *              InitEventLoop
+ *              InitTimers
+ *              AcceptConnection
+ *              CloseConnection
+ *              HandleConnection
+ *              TempTimerExpired
+ *              SaveTimerExpired
+ *              PingTimerExpired
+ *              IdleTimerExpired
+ *              WriteTimerExpired
+ *              RunTimerExpired
+ *              FlushWrites
+ *              DispatchAlarmEvents
+ *              ArchiveStates
+ *              VisitArchive
+ *              StatsObject
+ *              PushStats
  *              HandleHandshake
+ *              HandleMetricsRequest
  *              CheckAndHandleCloseFrame
+ *              HandleControlFrame
  *              DecodeMessage
+ *              SendResponse
+ *              CommitResponses
  *              processCommand
+ *              ProcessBatch
+ *              TagResponse
+ *              FreeJsonText
+ *              ValidateCommand
+ *              FadeError
+ *              ExecuteCommand
+ *              RecordState
+ *              BeginStateBatch
+ *              EndStateBatch
+ *              ApplyState
+ *              CollectState
+ *              SaveState
  *              SaveData
  *              LoadData
  * 
@@ -62,27 +95,158 @@ typedef int int32_t;
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/socketvar.h>
+#include <sys/epoll.h>
 
 #include "jansson.h"
 #include "Webhouse.h"
 #include "handshake.h"
+#include "timerwheel.h"
+#include "wal.h"
+#include "stateimage.h"
+#include "alarmlog.h"
+#include "history.h"
+#include "archive.h"
+#include "stats.h"
+#include "energy.h"
+#include "scenes.h"
+#include "log.h"
+#include "metrics.h"
+#include "probes.h"
+#include "capture.h"
+#include "clock.h"
+#include "arena.h"
 
 //----- Macros -----------------------------------------------------------------
 #define TRUE 1
 #define FALSE 0
 #define SERVER_PORT 8000		// Port number for the server
 #define BACKLOG 5 				// Number of allowed connections
-#define RX_BUFFER_SIZE 1024   	// Buffer size for receiving data, maybe 1024
+#define RX_BUFFER_SIZE 4096   	// Buffer size for received frames, bounds the command size
+#define TX_BUFFER_SIZE 16384		// Buffer size for a response
+#define MAX_CONNECTIONS 16		// Number of simultaneously served clients
+#define MAX_EVENTS 16			// Events handled per epoll_wait call
+#define EV_SERVER MAX_CONNECTIONS		// epoll tag of the server socket
+#define EV_TIMER (MAX_CONNECTIONS + 1)	// epoll tag of the timer wheel
+#define EV_ALARM (MAX_CONNECTIONS + 2)	// epoll tag of the alarm events
+
+#define SUB_ALARM 0x01				// Subscription to alarm edges
+#define SUB_STATS 0x02				// Subscription to the temperature statistics
+
+#define SEND_DURABLE 0x01			// Frame acknowledges a logged change
+#define SEND_ORDERED 0x02			// Frame must not overtake queued frames
+#define ID_MAX_LEN 64				// Longest correlation id echoed
+
+#define TEMP_INTERVAL_MS 1000		// Tick of the temperature model
+#define SAVE_INTERVAL_MS 300000		// Periodic save of the utility states
+#define PING_INTERVAL_MS 20000		// Keepalive ping on idle connections
+#define IDLE_TIMEOUT_MS 60000		// Connections silent for this long are evicted
+#define WRITE_TICK_MS 20			// Device tick applying the coalesced lamp writes
+#define FADE_MAX_MS 60000			// Longest lamp fade of a write
+
+#define LOG_LEVEL_ENV "WEBHOUSE_LOG"	// error, warn, info (default) or debug
+#define METRICS_PATH "/metrics"		// HTTP path of the Prometheus page
+#define METRICS_PATH_ENV "WEBHOUSE_METRICS_PATH"	// Overrides METRICS_PATH
+#define CAPTURE_ENV "WEBHOUSE_CAPTURE"	// File the traffic is captured to
+#define GPIO_DEBUG_ENV "WEBHOUSE_GPIO_DEBUG"	// Set to 1 to stub out the GPIO access
+#define CLOCK_ENV "WEBHOUSE_CLOCK"		// real (default), scaled[:factor] or virtual
+#define RUN_FOR_ENV "WEBHOUSE_RUN_FOR"	// Shut down after this many seconds of the clock
+#define VIRTUAL_POLL_TICKS 100		// Virtual ticks run between two polls of the sockets
+#define SHUTDOWN_RUN_END (-1)		// eShutdown value when the run time elapsed
+#define DATA_FILE "data.json"		// JSON export of the utility states
+#define STATE_FILE "state.img"		// Binary snapshot of the utility states
+#define WAL_FILE "data.wal"			// Mutations since the last snapshot
+#define WAL_COMPACT_SIZE 65536		// Log size that triggers a new snapshot
+#define PENDING_SIZE (2 * TX_BUFFER_SIZE)	// Responses held back until the log is synced
+#define ALARM_LOG_FILE "alarms.bin"	// History of the alarm edges
+#define EVENTS_LIMIT 64				// Alarm edges returned per events request
+#define HISTORY_LIMIT 300			// Points returned per history request
+#define BATCH_LIMIT 32				// Commands per batch message, times STATE_KEY_COUNT fits WAL_BUFFER_RECORDS
+#define ARCHIVE_FILE "archive.bin"	// Compressed long-term history
+#define SCENES_FILE "scenes.json"	// Optional user-defined scenes
+#define ENERGY_FILE "energy.json"	// Wattage and on-time accounting
+#define ENERGY_LIMIT 64			// Periods returned per energy request, about 220 bytes each
+#define STATS_WINDOWS { 60, 300, 900, 3600 }	// Default statistics windows in seconds
+#define STATS_WINDOW_LIMIT 4		// Windows per stats request, as many as the defaults
+
+//----- Data types -------------------------------------------------------------
+typedef struct {
+    int sock_id;			// Socket ID, -1 if the slot is free
+    int handshake_done;		// TRUE once the WebSocket upgrade is done
+    TimerEntry ping;		// Periodic keepalive ping
+    TimerEntry idle;		// Evicts the connection when it stays silent
+    char rx[RX_BUFFER_SIZE];	// Received bytes, starts with an incomplete frame
+    int rx_len;				// Bytes in rx
+    char pending[PENDING_SIZE];	// Responses waiting for the group commit
+    int pending_len;		// Bytes in pending
+    unsigned int subscriptions;	// SUB_* events pushed to the client
+    int ledWrites;			// led_pwm writes waiting for the device tick
+    json_t *ledWriteId;		// id of the last of them, NULL if none
+    uint64_t opened;		// getMetricTime() of the accept
+} Connection;
+
+// Outcome of a received command
+typedef struct {
+    int correlated;			// TRUE if the response carries an id
+    int action;				// Action index of the metrics
+    uint64_t ns[METRIC_PHASES];	// Time spent per phase
+} CommandInfo;
+
+// Buckets archived points into the resolution of a history request
+typedef struct {
+    char *response;			// Response being written
+    int len;				// Bytes in response
+    uint32_t step;			// Seconds per bucket
+    uint32_t count;			// Points written
+    uint32_t start;			// Start of the current bucket
+    uint32_t samples;		// Archived points in the bucket, 0 if empty
+    float min;
+    float max;
+    double sum;
+    double heater;
+} ArchiveQuery;
 
 //----- Function prototypes ----------------------------------------------------
+static int SaveState(void);
 static int SaveData(void);
-static int LoadData(void);
+static int LoadData(uint32_t *seq);
 static void InitWebhouseUtilities(void);
 static int InitSocket(void);
+static int InitEventLoop(int server_sock_id);
+static void InitTimers(void);
+static void AcceptConnection(int server_sock_id);
+static void CloseConnection(Connection *conn);
+static void HandleConnection(Connection *conn);
+static void TempTimerExpired(TimerEntry *timer, void *arg);
+static void SaveTimerExpired(TimerEntry *timer, void *arg);
+static void PingTimerExpired(TimerEntry *timer, void *arg);
+static void IdleTimerExpired(TimerEntry *timer, void *arg);
+static void WriteTimerExpired(TimerEntry *timer, void *arg);
+static void RunTimerExpired(TimerEntry *timer, void *arg);
+static void FlushWrites(void);
+static void DispatchAlarmEvents(void);
+static uint8_t ArchiveStates(void);
+static int VisitArchive(const ArchivePoint *point, void *arg);
+static json_t *StatsObject(json_t *windows);
+static void PushStats(void);
 static int HandleHandshake(int com_sock_id, char* rxBuf);
 static int CheckAndHandleCloseFrame(int com_sock_id, char* rxBuf, int rx_data_len);
-static void DecodeMessage(int com_sock_id, char* rxBuf, int rx_data_len);
-static int processCommand(char*, char*);
+static int HandleControlFrame(int com_sock_id, char* rxBuf, int rx_data_len);
+static void DecodeMessage(Connection *conn, char* rxBuf, int rx_data_len, uint64_t recv_ns);
+static int HandleMetricsRequest(int com_sock_id, char* rxBuf);
+static void SendResponse(Connection *conn, const char *frame, int len, int flags);
+static void CommitResponses(void);
+static int processCommand(Connection*, char*, char*, CommandInfo*);
+static int TagResponse(json_t *id, char *response, size_t size);
+static void FreeJsonText(char *text);
+static int ProcessBatch(Connection *conn, json_t *commands, int atomic, char *response);
+static int ValidateCommand(json_t *root, char *response);
+static const char *FadeError(json_t *root);
+static int ExecuteCommand(Connection *conn, json_t *root, char *response);
+static int  RecordState(uint8_t key, int32_t value);
+static void BeginStateBatch(void);
+static void EndStateBatch(void);
+static void ApplyState(uint8_t key, int32_t value);
+static void CollectState(int32_t values[]);
 static void shutdownHook (int32_t);
 
 //----- Global variables -------------------------------------------------------
@@ -90,6 +254,19 @@ static volatile int eShutdown = FALSE;
 static int dutyCycleLed = 25;
 static int stateLampFloor = 0;
 static int stateLampCeiling = 0;
+static int epoll_id = -1;
+static Connection connections[MAX_CONNECTIONS];
+static TimerEntry tempTimer;
+static TimerEntry saveTimer;
+static TimerEntry writeTimer;
+static TimerEntry runTimer;
+static int responsesPending = FALSE;
+static int32_t restoredState[STATE_KEY_COUNT];
+static int stateBatchDepth = 0;
+static int commandBatchDepth = 0;
+static uint32_t ledFadeMs = 0;
+static int ledTickStart = 0;		// dutyCycleLed before the writes of the tick
+static const char *metricsPath = METRICS_PATH;
 
 /*******************************************************************************
  * @brief    Main function of the Webhouse project.
@@ -101,100 +278,156 @@ static int stateLampCeiling = 0;
 int main(int argc, char **argv) {
 	// Variables
 	int server_sock_id = -1;					// Socket ID for the server
-	int com_sock_id = -1;						// Socket ID for the communication
-	struct sockaddr_in client;					// Client address
-	int addrlen = sizeof (struct sockaddr_in);	// Length of the client address
-	int com_addrlen = sizeof(client);			// Length of the communication address
+	struct epoll_event events[MAX_EVENTS];		// Events reported by epoll
 	
+	// Log asynchronously, the level is taken from the environment
+	int level = parseLogLevel(getenv(LOG_LEVEL_ENV));
+	openLog(STDOUT_FILENO, level < 0 ? LOG_INFO : level);
+	if (getenv(METRICS_PATH_ENV)) {
+		metricsPath = getenv(METRICS_PATH_ENV);
+	}
+
+	// Commands allocate their JSON values from an arena, it must be
+	// installed before jansson allocates anything
+	initArena(NULL, NULL);
+
 	// Register shutdown hook
 	signal(SIGINT, shutdownHook);
+	// A peer vanishing during send must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+
+	// Select the time base before any thread reads it, a scaled or virtual
+	// clock runs long simulations in seconds
+	if (initClock(getenv(CLOCK_ENV)) < 0) {
+		logError("Invalid %s: %s", CLOCK_ENV, getenv(CLOCK_ENV));
+		closeLog();
+		return EXIT_FAILURE;
+	}
 
-	// Initialize Webhouse
-	printf("Init Webhouse\n");
-	fflush(stdout);
+	// Initialize Webhouse, e.g. for a replay without the hardware in the
+	// bcm2835 debug mode
+	logInfo("Init Webhouse");
+	if (getenv(GPIO_DEBUG_ENV) && atoi(getenv(GPIO_DEBUG_ENV))) {
+		setWebhouseDebug(1);
+	}
 	initWebhouse();
 
     // Init all Webhouse utilities
     InitWebhouseUtilities();
+    openAlarmLog(ALARM_LOG_FILE);
+    openArchive(ARCHIVE_FILE);
+
+    // Capture the traffic for wsreplay, starting with the utility states
+    if (getenv(CAPTURE_ENV)) {
+        if (openCapture(getenv(CAPTURE_ENV)) == 0) {
+            int32_t values[STATE_KEY_COUNT];
+            CollectState(values);
+            captureEvent(0, CAPTURE_STATE, values, sizeof(values));
+            logInfo("Capturing the traffic to %s", getenv(CAPTURE_ENV));
+        }
+        else {
+            logError("Cannot create %s: %s", getenv(CAPTURE_ENV), strerror(errno));
+        }
+    }
 
 	// Initialize Socket
-	printf("Init Socket\n");
-	fflush(stdout);
+	logInfo("Init Socket");
 	server_sock_id = InitSocket();
 
 	if(server_sock_id < 0) {
-		perror("Socket initialization failed");
+		logError("Socket initialization failed: %s", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	// Initialize the event loop and the periodic tasks
+	if(InitEventLoop(server_sock_id) < 0) {
+		logError("Event loop initialization failed: %s", strerror(errno));
+		close(server_sock_id);
 		return EXIT_FAILURE;
 	}
+	InitTimers();
 
 	// Main Loop
+	int timeout = getClockMode() == CLOCK_VIRTUAL ? 0 : -1;
 	while (eShutdown == FALSE) {
-		if(com_sock_id < 0){
-            // Accept a new connection
-			com_sock_id = accept(server_sock_id, (struct sockaddr *)&client, &com_addrlen);
-			if (com_sock_id < 0) {
-				perror("accept failed");
-				continue;
-			}
-			else {
-				printf("Connection established\n");
-				fflush(stdout);
+		// Wait for sockets or the timer wheel, signals interrupt the wait
+		int n = epoll_wait(epoll_id, events, MAX_EVENTS, timeout);
+		if (n < 0) {
+			if (errno != EINTR) {
+				logError("epoll_wait failed: %s", strerror(errno));
 			}
+			continue;
 		}
 
-        // Receive data
-		char rxBuf[RX_BUFFER_SIZE];
-		int rx_data_len = recv (com_sock_id, (void *)rxBuf, RX_BUFFER_SIZE, MSG_DONTWAIT);
+		// A virtual clock runs whenever the sockets are idle
+		for (int tick = 0; n == 0 && tick < VIRTUAL_POLL_TICKS && eShutdown == FALSE; tick++) {
+			stepTimerWheel();
+		}
 
-		// If a new WebSocket message have been received
-		if (rx_data_len > 0) {
-            //printf("Received %d bytes\n", rx_data_len);
-			rxBuf[rx_data_len] = '\0';
+		for (int i = 0; i < n; i++) {
+			uint32_t tag = events[i].data.u32;
 
-			// Is the message a handshake request
-			if(HandleHandshake(com_sock_id, rxBuf) == TRUE) {	
-                printf("Handshake handled\n");			
-				continue;
+			if (tag == EV_SERVER) {
+				AcceptConnection(server_sock_id);
 			}
-
-			// Is the message a close frame
-			if(!CheckAndHandleCloseFrame(com_sock_id, rxBuf, rx_data_len)) {
-                printf("Close frame received\n");
-				com_sock_id = -1;	 	// Update as the socket is closed
-				continue;
+			else if (tag == EV_TIMER) {
+				processTimerWheel();
 			}
-
-			// Decode the message, execute the command and send the response
-			DecodeMessage(com_sock_id, rxBuf, rx_data_len);
-
-		}
-		else if (rx_data_len == 0) {
-            // Connection closed by the client
-			close(com_sock_id);
-			com_sock_id = -1;
-			printf("Connection closed\n");
-			fflush(stdout);
-		}
-		else {
-			// Check if the error is EAGAIN or EWOULDBLOCK (which means "try again")
-			if (errno == EAGAIN || errno == EWOULDBLOCK) {
-				// No data available right now, try again later
-			} else {
-				perror("Receive failed");
+			else if (tag == EV_ALARM) {
+				DispatchAlarmEvents();
+			}
+			else if (connections[tag].sock_id >= 0) {
+				HandleConnection(&connections[tag]);
 			}
 		}
 
-		sleep(1);
+		// Group commit: one sync for all changes of this iteration, then
+		// acknowledge them
+		CommitResponses();
+	}
+
+	if (eShutdown == SHUTDOWN_RUN_END) {
+		logInfo("Run time elapsed, initiating shutdown...");
+	}
+	else {
+		logInfo("Signal %d received, initiating shutdown...", eShutdown);
+	}
+
+	// Apply and acknowledge lamp writes of the last tick
+	if (isTimerActive(&writeTimer)) {
+		FlushWrites();
+		CommitResponses();
+	}
+
+	// The capture ends with the final utility states
+	if (isCaptureOpen()) {
+		int32_t values[STATE_KEY_COUNT];
+		CollectState(values);
+		captureEvent(0, CAPTURE_STATE, values, sizeof(values));
+	}
+
+	// Close all remaining connections
+	for (int i = 0; i < MAX_CONNECTIONS; i++) {
+		if (connections[i].sock_id >= 0) {
+			CloseConnection(&connections[i]);
+		}
 	}
+	closeTimerWheel();
+	close(epoll_id);
 
-    // Save the current state of the Webhouse utilities
+    // Save the current state of the Webhouse utilities and export it
+    SaveState();
     SaveData();
+    closeWal();
+    closeAlarmLog();
+    closeArchive();
+    closeCapture();
 	
     // Close the Webhouse
 	closeWebhouse();
-	printf ("Close Webhouse\n");
-	fflush (stdout);
+	logInfo("Close Webhouse");
 	close(server_sock_id);
+	closeLog();
 
     // Exit the program successfully
 	return EXIT_SUCCESS;
@@ -203,15 +436,15 @@ int main(int argc, char **argv) {
 /*******************************************************************************
  * @brief    Handles registered signals (SIGTERM, SIGINT) for graceful shutdown.
  *
- *           This function sets a flag to indicate that a shutdown signal has
- *           been received, allowing the program to terminate gracefully.
+ *           This function sets a flag to the received signal to indicate that
+ *           a shutdown signal has been received, allowing the program to
+ *           terminate gracefully.
  *
  * @param    sig   The incoming signal.
  ******************************************************************************/
 static void shutdownHook(int32_t sig) {
-    printf("Signal %d received, initiating shutdown...\n", sig);
-    fflush(stdout);
-    eShutdown = TRUE;
+    // Only flag the shutdown, logging is not async-signal-safe
+    eShutdown = sig;
 }
 
 /*******************************************************************************
@@ -220,360 +453,1414 @@ static void shutdownHook(int32_t sig) {
  *           Initializes the utilities to ensure consistent starting states.
  *           This is necessary because the initial state reading of utilities 
  *           might sometimes return incorrect values. To handle this, the 
- *           function attempts to load the previous state from a file. If this 
- *           fails, it sets default states for all utilities.
+ *           function restores the previous state from the binary state image,
+ *           or imports it from the JSON export if there is no valid image.
+ *           If both fail, default states are used. The changes logged after
+ *           the snapshot are replayed on top of it and the result is applied
+ *           to the hardware in one batch.
  *
  * @return   void
  ******************************************************************************/
 static void InitWebhouseUtilities(void)
 {
+    uint32_t seq = 0;
+
+    // Default states in case nothing can be restored
+    restoredState[STATE_TV] = 0;
+    restoredState[STATE_HEATER] = 0;
+    restoredState[STATE_LAMP_FLOOR] = stateLampFloor;
+    restoredState[STATE_LAMP_CEIL] = stateLampCeiling;
+    restoredState[STATE_LED_PWM] = dutyCycleLed;
+    restoredState[STATE_THERMOSTAT] = getThermostatMode();
+    restoredState[STATE_SETPOINT] = (int32_t)lroundf(getThermostatSetpoint() * 100);
+    restoredState[STATE_HYSTERESIS] = (int32_t)lroundf(getThermostatHysteresis() * 100);
+
     // Attempt to load the previous state of utilities
-    if (!LoadData()) {
-        // If loading fails, set default states
-        turnTVOff();
-        turnHeatOff();
+    if (loadStateImage(STATE_FILE, restoredState, STATE_KEY_COUNT, &seq) == 0) {
+        logInfo("State loaded from %s", STATE_FILE);
+    }
+    else if (!LoadData(&seq)) {
+        logInfo("Using default states");
+    }
+
+    // Replay the changes made since the snapshot was written
+    if (openWal(WAL_FILE, seq) == 0) {
+        int batches = replayWal(ApplyState);
+        if (batches > 0)
+            logInfo("Replayed %d logged changes from %s", batches, WAL_FILE);
+    }
+    else {
+        logError("Cannot open %s, changes are refused", WAL_FILE);
+    }
+
+    // Continue the energy accounting of the previous runs
+    loadEnergy(ENERGY_FILE);
+
+    // User-defined scenes extend or replace the built-in ones
+    if (loadScenes(SCENES_FILE) > 0)
+        logInfo("Scenes loaded from %s", SCENES_FILE);
+
+    // Apply the restored states with a single GPIO write
+    dutyCycleLed = restoredState[STATE_LED_PWM];
+    stateLampFloor = restoredState[STATE_LAMP_FLOOR];
+    stateLampCeiling = restoredState[STATE_LAMP_CEIL];
+    setWebhouseState(restoredState[STATE_TV], restoredState[STATE_HEATER],
+                     stateLampFloor ? (uint16_t)dutyCycleLed : 0,
+                     stateLampCeiling ? (uint16_t)dutyCycleLed : 0);
+    setThermostat(restoredState[STATE_THERMOSTAT], restoredState[STATE_SETPOINT] / 100.0f,
+                  restoredState[STATE_HYSTERESIS] / 100.0f);
+}
+
+/*******************************************************************************
+ * @brief    Records a changed utility state in the write-ahead log. The
+ *           change becomes durable with the next group commit. Inside
+ *           BeginStateBatch/EndStateBatch all changes form one batch.
+ *
+ * @param    key    STATE_* key of the utility.
+ * @param    value  New state.
+ * @return   0 if the change was logged, -1 if the log refused it.
+ ******************************************************************************/
+static int RecordState(uint8_t key, int32_t value)
+{
+    int ret = logWal(key, value);
+    if (stateBatchDepth == 0 && sealWal() < 0) {
+        ret = -1;
+    }
+    if (ret < 0) {
+        logError("Change of state %u not logged, %s cannot be written", key, WAL_FILE);
+    }
+    return ret;
+}
+
+/*******************************************************************************
+ * @brief    Starts grouping the recorded changes into one batch, so they
+ *           are replayed all together or not at all. Batches nest.
+ ******************************************************************************/
+static void BeginStateBatch(void)
+{
+    stateBatchDepth++;
+}
+
+/*******************************************************************************
+ * @brief    Ends a batch started with BeginStateBatch. The outermost end
+ *           seals the batch as one state version.
+ ******************************************************************************/
+static void EndStateBatch(void)
+{
+    if (--stateBatchDepth == 0 && sealWal() < 0) {
+        logError("Batch of changes aborted, %s cannot be written", WAL_FILE);
+    }
+}
+
+/*******************************************************************************
+ * @brief    Applies a state replayed from the write-ahead log to the state
+ *           being restored on startup.
+ *
+ * @param    key    STATE_* key of the utility.
+ * @param    value  Logged state.
+ ******************************************************************************/
+static void ApplyState(uint8_t key, int32_t value)
+{
+    if (key < STATE_KEY_COUNT) {
+        restoredState[key] = value;
+    }
+}
+
+/*******************************************************************************
+ * @brief    Collects the current utility states, indexed by STATE_* key.
+ *
+ * @param    values  Receives STATE_KEY_COUNT states.
+ ******************************************************************************/
+static void CollectState(int32_t values[])
+{
+    values[STATE_TV] = getTVState();
+    values[STATE_HEATER] = getHeatState();
+    values[STATE_LAMP_FLOOR] = stateLampFloor;
+    values[STATE_LAMP_CEIL] = stateLampCeiling;
+    values[STATE_LED_PWM] = dutyCycleLed;
+    values[STATE_THERMOSTAT] = getThermostatMode();
+    values[STATE_SETPOINT] = (int32_t)lroundf(getThermostatSetpoint() * 100);
+    values[STATE_HYSTERESIS] = (int32_t)lroundf(getThermostatHysteresis() * 100);
+}
+
+/*******************************************************************************
+ * @brief    Writes a snapshot of the utility states to the binary state
+ *           image and empties the write-ahead log, which it now covers.
+ *
+ * @return   TRUE if successful, FALSE otherwise.
+ ******************************************************************************/
+static int SaveState(void)
+{
+    int32_t values[STATE_KEY_COUNT];
+
+    CollectState(values);
+    if (saveStateImage(STATE_FILE, values, STATE_KEY_COUNT, getWalSeq()) < 0) {
+        logError("Error saving state image: %s", STATE_FILE);
+        return FALSE;
+    }
+
+    resetWal();
+    return TRUE;
+}
+
+/*******************************************************************************
+ * @brief    Exports the current state of the Webhouse utilities to a file.
+ *           It writes the states of TV, heater, floor lamp, ceiling lamp,
+ *           and LED PWM duty cycle to 'data.json' in JSON format. The file
+ *           is replaced atomically and can be imported again by LoadData.
+ *
+ * @return   TRUE if successful, FALSE otherwise.
+ ******************************************************************************/
+static int SaveData(void)
+{
+    // Define the filename where the data will be saved
+    const char* filename = DATA_FILE;
+    int32_t values[STATE_KEY_COUNT];
+
+    CollectState(values);
+    beginArena();
+
+    // Create a new JSON object
+    json_t *root = json_object();
+    
+    // Set the values for each utility in the JSON object
+    json_object_set_new(root, "tv", json_integer(values[STATE_TV]));
+    json_object_set_new(root, "heater", json_integer(values[STATE_HEATER]));
+    json_object_set_new(root, "lamp_floor", json_integer(values[STATE_LAMP_FLOOR]));
+    json_object_set_new(root, "lamp_ceil", json_integer(values[STATE_LAMP_CEIL]));
+    json_object_set_new(root, "led_pwm", json_integer(values[STATE_LED_PWM]));
+    json_object_set_new(root, "thermostat", json_integer(values[STATE_THERMOSTAT]));
+    json_object_set_new(root, "setpoint", json_integer(values[STATE_SETPOINT]));
+    json_object_set_new(root, "hysteresis", json_integer(values[STATE_HYSTERESIS]));
+    json_object_set_new(root, "seq", json_integer(getWalSeq()));
+
+    // Convert the JSON object to a string
+    char *res_str = json_dumps(root, JSON_COMPACT);
+    json_decref(root);          // Release the JSON object
+    if(!res_str){
+        // Handle error if conversion fails
+        logError("Error converting JSON to string");
+        endArena();
+        return FALSE;
+    }
+
+    // Replace the file, a power cut never leaves a truncated file
+    int ok = writeFileAtomic(filename, res_str, strlen(res_str)) == 0;
+    FreeJsonText(res_str);      // Free the JSON string
+
+    if(!ok){
+        // Handle error if writing fails
+        logError("Error writing to file: %s", filename);
+        endArena();
+        return FALSE;
+    }
+
+    // The energy accounting is kept next to the export
+    saveEnergy(ENERGY_FILE);
+    endArena();
+
+    // Confirm successful data saving
+    logInfo("Data successfully saved to %s", filename);
+    return TRUE;
+}
+
+/*******************************************************************************
+ * @brief    Importiert den Zustand der Webhouse-Umgebung aus der JSON-Datei.
+ *           Gibt TRUE zurück, wenn das Laden erfolgreich war, sonst FALSE.
+ *
+ * @param    seq  Receives the log sequence number covered by the export.
+ * @return   TRUE if successful, FALSE otherwise.
+ ******************************************************************************/
+static int LoadData(uint32_t *seq)
+{
+    const char* filename = DATA_FILE;
+
+    // JSON-Datei einlesen und parsen
+    json_error_t error;
+    beginArena();
+    json_t *root = json_load_file(filename, 0, &error);
+
+    if (!root) {
+        logError("Error loading %s: %s", filename, error.text);
+        endArena();
+        return FALSE;
+    }
+
+    // Zustände aus dem JSON-Objekt extrahieren
+    static const struct {
+        const char *name;
+        int key;
+    } fields[] = {
+        { "tv", STATE_TV },
+        { "heater", STATE_HEATER },
+        { "lamp_floor", STATE_LAMP_FLOOR },
+        { "lamp_ceil", STATE_LAMP_CEIL },
+        { "led_pwm", STATE_LED_PWM },
+        { "thermostat", STATE_THERMOSTAT },
+        { "setpoint", STATE_SETPOINT },
+        { "hysteresis", STATE_HYSTERESIS },
+    };
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        json_t *value = json_object_get(root, fields[i].name);
+        if(json_is_integer(value)){
+            restoredState[fields[i].key] = (int32_t)json_integer_value(value);
+        }
+    }
+
+    json_t *snapshot_seq = json_object_get(root, "seq");
+    if(json_is_integer(snapshot_seq)){
+        *seq = (uint32_t)json_integer_value(snapshot_seq);
+    }
+
+    // JSON-Objekt freigeben
+    json_decref(root);
+    endArena();
+
+    logInfo("Data loaded successfully from %s", filename);
+    return TRUE;
+}
+
+/*******************************************************************************
+ * @brief    Creates and initializes a server socket with specified settings.
+ *           Binds the socket to the server address and listens for incoming
+ *           connections.
+ *
+ * @return   The socket ID if successful, -1 on failure.
+ ******************************************************************************/
+static int InitSocket(void) 
+{
+    // Create a socket
+    int server_sock_id = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (server_sock_id < 0) {
+        logError("Socket creation failed: %s", strerror(errno));
+        return -1;
+    }
+    logInfo("Socket created successfully. Server socket ID: %d", server_sock_id);
+
+    // Set server address
+    struct sockaddr_in server;
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_ANY);
+    server.sin_port = htons(SERVER_PORT);
+
+    // Bind the socket
+    int bind_status = bind(server_sock_id, (struct sockaddr *)&server, sizeof(server));
+    if (bind_status < 0) {
+        logError("Socket bind failed: %s", strerror(errno));
+        close(server_sock_id);
+        return -1;
+    }
+    logInfo("Socket binded successfully");
+
+    // Listen on the socket
+    int listen_status = listen(server_sock_id, BACKLOG);
+    if (listen_status < 0) {
+        logError("Listen failed: %s", strerror(errno));
+        close(server_sock_id);
+        return -1;
+    }
+    logInfo("Listen succeeded");
+
+    return server_sock_id;
+}
+
+/*******************************************************************************
+ * @brief    Creates the epoll instance and registers the server socket and
+ *           the timer wheel. All connection slots are marked as free.
+ *
+ * @param    server_sock_id  Listening socket.
+ * @return   0 if successful, -1 on failure.
+ ******************************************************************************/
+static int InitEventLoop(int server_sock_id)
+{
+    struct epoll_event ev;
+
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        connections[i].sock_id = -1;
+    }
+
+    epoll_id = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_id < 0) {
+        logError("epoll_create1 failed: %s", strerror(errno));
+        return -1;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u32 = EV_SERVER;
+    if (epoll_ctl(epoll_id, EPOLL_CTL_ADD, server_sock_id, &ev) < 0) {
+        logError("epoll_ctl server failed: %s", strerror(errno));
+        return -1;
+    }
+
+    int timer_fd = initTimerWheel();
+    if (timer_fd < 0) {
+        return -1;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u32 = EV_TIMER;
+    if (epoll_ctl(epoll_id, EPOLL_CTL_ADD, timer_fd, &ev) < 0) {
+        logError("epoll_ctl timer failed: %s", strerror(errno));
+        return -1;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u32 = EV_ALARM;
+    if (epoll_ctl(epoll_id, EPOLL_CTL_ADD, getAlarmEventFd(), &ev) < 0) {
+        logError("epoll_ctl alarm failed: %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Starts the periodic tasks of the server on the timer wheel.
+ ******************************************************************************/
+static void InitTimers(void)
+{
+    initTimer(&tempTimer, TempTimerExpired, NULL);
+    startTimer(&tempTimer, TEMP_INTERVAL_MS, TEMP_INTERVAL_MS);
+
+    initTimer(&saveTimer, SaveTimerExpired, NULL);
+    startTimer(&saveTimer, SAVE_INTERVAL_MS, SAVE_INTERVAL_MS);
+
+    // Started by the first lamp write of a tick
+    initTimer(&writeTimer, WriteTimerExpired, NULL);
+
+    // A simulation ends after a given time of the clock
+    initTimer(&runTimer, RunTimerExpired, NULL);
+    if (getenv(RUN_FOR_ENV)) {
+        double seconds = atof(getenv(RUN_FOR_ENV));
+        startTimer(&runTimer, seconds < UINT32_MAX / 1000.0 ? (uint32_t)(seconds * 1000) : UINT32_MAX, 0);
+    }
+}
+
+/*******************************************************************************
+ * @brief    Accepts a pending connection and assigns it a free slot.
+ *           The idle timer is started right away, so clients that never
+ *           complete the handshake are evicted as well.
+ *
+ * @param    server_sock_id  Listening socket.
+ ******************************************************************************/
+static void AcceptConnection(int server_sock_id)
+{
+    struct sockaddr_in client;					// Client address
+    socklen_t com_addrlen = sizeof(client);		// Length of the client address
+    struct epoll_event ev;
+    Connection *conn = NULL;
+
+    int com_sock_id = accept(server_sock_id, (struct sockaddr *)&client, &com_addrlen);
+    if (com_sock_id < 0) {
+        logError("accept failed: %s", strerror(errno));
+        return;
+    }
+
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (connections[i].sock_id < 0) {
+            conn = &connections[i];
+            ev.data.u32 = i;
+            break;
+        }
+    }
+
+    if (!conn) {
+        logInfo("Connection refused, too many clients");
+        close(com_sock_id);
+        return;
+    }
+
+    ev.events = EPOLLIN;
+    if (epoll_ctl(epoll_id, EPOLL_CTL_ADD, com_sock_id, &ev) < 0) {
+        logError("epoll_ctl connection failed: %s", strerror(errno));
+        close(com_sock_id);
+        return;
+    }
+
+    conn->sock_id = com_sock_id;
+    conn->handshake_done = FALSE;
+    conn->rx_len = 0;
+    conn->pending_len = 0;
+    conn->subscriptions = 0;
+    conn->ledWrites = 0;
+    conn->ledWriteId = NULL;
+    conn->opened = getMetricTime();
+    initTimer(&conn->ping, PingTimerExpired, conn);
+    initTimer(&conn->idle, IdleTimerExpired, conn);
+    startTimer(&conn->idle, IDLE_TIMEOUT_MS, 0);
+
+    PROBE2(conn_accept, (int)(conn - connections), com_sock_id);
+    logInfo("Connection established");
+}
+
+/*******************************************************************************
+ * @brief    Closes a connection, stops its timers and frees its slot.
+ ******************************************************************************/
+static void CloseConnection(Connection *conn)
+{
+    PROBE2(conn_close, (int)(conn - connections), getMetricTime() - conn->opened);
+    if (conn->handshake_done) {
+        captureEvent((int)(conn - connections), CAPTURE_CLOSE, NULL, 0);
+    }
+    stopTimer(&conn->ping);
+    stopTimer(&conn->idle);
+    epoll_ctl(epoll_id, EPOLL_CTL_DEL, conn->sock_id, NULL);
+    close(conn->sock_id);
+    conn->sock_id = -1;
+    conn->ledWrites = 0;
+    json_decref(conn->ledWriteId);
+    conn->ledWriteId = NULL;
+}
+
+/*******************************************************************************
+ * @brief    Receives and dispatches the data pending on a connection.
+ *           Complete frames are handled in order of arrival, an incomplete
+ *           one is kept for the next call.
+ *
+ * @param    conn  Connection reported readable by epoll.
+ ******************************************************************************/
+static void HandleConnection(Connection *conn)
+{
+    // Receive data behind an incomplete frame of the previous call
+    uint64_t start = getMetricTime();
+    int rx_data_len = recv(conn->sock_id, (void *)(conn->rx + conn->rx_len), RX_BUFFER_SIZE - 1 - conn->rx_len, MSG_DONTWAIT);
+    uint64_t recv_ns = getMetricTime() - start;
+
+    // If new WebSocket data have been received
+    if (rx_data_len > 0) {
+        conn->rx_len += rx_data_len;
+        conn->rx[conn->rx_len] = '\0';
+
+        // Any traffic proves that the peer is still alive
+        startTimer(&conn->idle, IDLE_TIMEOUT_MS, 0);
+
+        // Is the message a scrape of the metrics page
+        if(!conn->handshake_done && HandleMetricsRequest(conn->sock_id, conn->rx) == TRUE) {
+            CloseConnection(conn);
+            return;
+        }
+
+        // Is the message a handshake request
+        if(!conn->handshake_done && HandleHandshake(conn->sock_id, conn->rx) == TRUE) {
+            conn->handshake_done = TRUE;
+            conn->rx_len = 0;
+            captureEvent((int)(conn - connections), CAPTURE_OPEN, NULL, 0);
+            startTimer(&conn->ping, PING_INTERVAL_MS, PING_INTERVAL_MS);
+            logInfo("Handshake handled");
+            return;
+        }
+
+        // A pipelining client may send several frames in one segment
+        int offset = 0;
+        while (offset < conn->rx_len) {
+            char *frame = conn->rx + offset;
+            int frame_len = get_frame_length(frame, conn->rx_len - offset);
+
+            if (frame_len == 0) {
+                break;
+            }
+            if (frame_len < 0) {
+                logWarn("Frame too large, closing connection");
+                CloseConnection(conn);
+                return;
+            }
+            offset += frame_len;
+            captureEvent((int)(conn - connections), CAPTURE_IN, frame, (uint32_t)frame_len);
+
+            // Is the message a close frame
+            if(!CheckAndHandleCloseFrame(conn->sock_id, frame, frame_len)) {
+                logInfo("Close frame received");
+                CloseConnection(conn);
+                return;
+            }
+
+            // Is the message a ping or pong frame
+            if(HandleControlFrame(conn->sock_id, frame, frame_len)) {
+                continue;
+            }
+
+            // Decode the message, execute the command and send the response
+            // The recv is accounted to the first frame it delivered
+            DecodeMessage(conn, frame, frame_len, recv_ns);
+            recv_ns = 0;
+        }
+
+        // Keep an incomplete frame, a full buffer can never complete it
+        conn->rx_len -= offset;
+        memmove(conn->rx, conn->rx + offset, conn->rx_len);
+        if (conn->rx_len == RX_BUFFER_SIZE - 1) {
+            logWarn("Frame too large, closing connection");
+            CloseConnection(conn);
+        }
+    }
+    else if (rx_data_len == 0) {
+        // Connection closed by the client
+        CloseConnection(conn);
+        logInfo("Connection closed");
+    }
+    else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        logError("Receive failed: %s", strerror(errno));
+        CloseConnection(conn);
+    }
+}
+
+/*******************************************************************************
+ * @brief    Advances the temperature model and the thermostat once per
+ *           TEMP_INTERVAL_MS and records the new temperature in the history and the window
+ *           statistics. Every finished minute is appended to the long-term
+ *           archive. The captured traffic is written out as well.
+ ******************************************************************************/
+static void TempTimerExpired(TimerEntry *timer, void *arg)
+{
+    uint32_t now = getClockTime();
+
+    updateTemp();
+    stepThermostat(TEMP_INTERVAL_MS / 1000.0f);
+    addStatsSample(now, getTemp());
+    PushStats();
+    flushCapture();
+
+    if (addHistorySample(now, getTemp(), getHeatState()) & (1 << HISTORY_MINUTE)) {
+        uint32_t first;
+        uint32_t count = findHistory(HISTORY_MINUTE, 0, UINT32_MAX, &first);
+        const HistoryPoint *point = getHistory(HISTORY_MINUTE, count - 1);
+        appendArchive(point->time, point->avg, point->heater, ArchiveStates());
+    }
+}
+
+/*******************************************************************************
+ * @brief    Saves the utility states periodically, not only on shutdown.
+ ******************************************************************************/
+static void SaveTimerExpired(TimerEntry *timer, void *arg)
+{
+    SaveState();
+    saveEnergy(ENERGY_FILE);
+}
+
+/*******************************************************************************
+ * @brief    Sends a keepalive ping, the client answers with a pong which
+ *           re-arms the idle timer of the connection.
+ ******************************************************************************/
+static void PingTimerExpired(TimerEntry *timer, void *arg)
+{
+    Connection *conn = (Connection *)arg;
+    char pingFrame[2] = { 0x89, 0x00 }; // Empty ping frame
+
+    send(conn->sock_id, pingFrame, sizeof(pingFrame), 0);
+}
+
+/*******************************************************************************
+ * @brief    Evicts a connection that stayed silent for IDLE_TIMEOUT_MS.
+ ******************************************************************************/
+static void IdleTimerExpired(TimerEntry *timer, void *arg)
+{
+    Connection *conn = (Connection *)arg;
+
+    if (conn->handshake_done) {
+        char closeFrame[2] = { 0x88, 0x00 }; // Simple close frame
+        send(conn->sock_id, closeFrame, sizeof(closeFrame), 0);
+    }
+    CloseConnection(conn);
+
+    logInfo("Idle connection evicted");
+}
+
+/*******************************************************************************
+ * @brief    Ends the device tick of the lamp writes.
+ ******************************************************************************/
+static void WriteTimerExpired(TimerEntry *timer, void *arg)
+{
+    FlushWrites();
+}
+
+/*******************************************************************************
+ * @brief    Shuts the server down once the run time of WEBHOUSE_RUN_FOR
+ *           elapsed.
+ ******************************************************************************/
+static void RunTimerExpired(TimerEntry *timer, void *arg)
+{
+    eShutdown = SHUTDOWN_RUN_END;
+}
+
+/*******************************************************************************
+ * @brief    Applies the last led_pwm write of the tick to the lamps, with
+ *           its fade, and logs it. Every connection that wrote gets a single acknowledgement
+ *           with the final value and the number of writes it covers; it is
+ *           sent after the group commit. If the log refuses the change, the
+ *           lamps keep their level and the writes are answered with an error.
+ ******************************************************************************/
+static void FlushWrites(void)
+{
+    if (isTimerActive(&writeTimer)) {
+        stopTimer(&writeTimer);
+    }
+
+    int logged = RecordState(STATE_LED_PWM, dutyCycleLed) == 0;
+    if (!logged) {
+        dutyCycleLed = ledTickStart;
+    }
+    if(logged && stateLampFloor){
+        fadeSLamp((uint16_t)dutyCycleLed, ledFadeMs);
+    }
+    if(logged && stateLampCeiling){
+        fadeRLamp((uint16_t)dutyCycleLed, ledFadeMs);
+    }
+    ledFadeMs = 0;
+
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        Connection *conn = &connections[i];
+        if (conn->sock_id < 0 || conn->ledWrites == 0) {
+            continue;
+        }
+
+        char response[TX_BUFFER_SIZE];
+        char frame[TX_BUFFER_SIZE + WS_FRAME_HDR_MAX];
+        if (logged) {
+            sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"write\",\"status\":\"Success\",\"message\":\"LED PWM set to %d\",\"value\":%d,\"coalesced\":%d}",
+                    dutyCycleLed, dutyCycleLed, conn->ledWrites);
+        }
+        else {
+            sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"write\",\"status\":\"Error\",\"message\":\"State log not writable\",\"coalesced\":%d}",
+                    conn->ledWrites);
+        }
+        int tagged = TagResponse(conn->ledWriteId, response, sizeof(response));
+        int len = code_outgoing_response(response, frame);
+        SendResponse(conn, frame, len, (logged ? SEND_DURABLE : 0) | (tagged ? 0 : SEND_ORDERED));
+
+        conn->ledWrites = 0;
+        json_decref(conn->ledWriteId);
+        conn->ledWriteId = NULL;
+    }
+}
+
+/*******************************************************************************
+ * @brief    Records the alarm edges detected by the Webhouse in the alarm
+ *           history and pushes them to all clients that subscribed to them.
+ ******************************************************************************/
+static void DispatchAlarmEvents(void)
+{
+    uint64_t count;
+    AlarmEvent event;
+
+    // Reset the eventfd counter, the ring tells how many events there are
+    if (read(getAlarmEventFd(), &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        logError("Alarm event read failed: %s", strerror(errno));
+    }
+
+    while (readAlarmEvent(&event)) {
+        char message[160];
+        char frame[sizeof(message) + WS_FRAME_HDR_MAX];
+
+        // Convert the timestamp of the edge to wall clock time
+        uint64_t time = getClockWallUs() - (getTimestamp() - event.timestamp);
+        addAlarmLog(time, event.level, event.bounces);
+
+        snprintf(message, sizeof(message),
+                 "{\"type\":\"Event\",\"event\":\"alarm\",\"state\":%d,\"timestamp\":%llu,\"time\":%llu,\"bounces\":%d}",
+                 event.level, (unsigned long long)event.timestamp, (unsigned long long)time, event.bounces);
+        int len = code_outgoing_response(message, frame);
+
+        for (int i = 0; i < MAX_CONNECTIONS; i++) {
+            Connection *conn = &connections[i];
+            if (conn->sock_id >= 0 && (conn->subscriptions & SUB_ALARM)) {
+                SendResponse(conn, frame, len, SEND_ORDERED);
+            }
+        }
+    }
+}
+
+/*******************************************************************************
+ * @brief    Returns the utility states as ARCHIVE_STATE_* bits.
+ ******************************************************************************/
+static uint8_t ArchiveStates(void)
+{
+    return (getTVState() ? ARCHIVE_STATE_TV : 0) |
+           (getHeatState() ? ARCHIVE_STATE_HEATER : 0) |
+           (stateLampFloor ? ARCHIVE_STATE_LAMP_FLOOR : 0) |
+           (stateLampCeiling ? ARCHIVE_STATE_LAMP_CEIL : 0);
+}
+
+/*******************************************************************************
+ * @brief    Folds an archived point into the current bucket of a history
+ *           request and writes the bucket once the next one starts. A point
+ *           with time UINT32_MAX only writes the last bucket.
+ *
+ * @param    point  Archived point.
+ * @param    arg    ArchiveQuery.
+ * @return   FALSE once HISTORY_LIMIT points are written, TRUE otherwise.
+ ******************************************************************************/
+static int VisitArchive(const ArchivePoint *point, void *arg)
+{
+    ArchiveQuery *q = (ArchiveQuery *)arg;
+    uint32_t start = point->time - point->time % q->step;
+
+    if (q->samples && q->start != start) {
+        q->len += snprintf(q->response + q->len, TX_BUFFER_SIZE - q->len, "%s[%u,%.2f,%.2f,%.2f,%.2f]",
+                           q->count ? "," : "", q->start, q->min, q->max,
+                           q->sum / q->samples, q->heater / q->samples);
+        q->count++;
+        q->samples = 0;
+    }
+    if (q->count >= HISTORY_LIMIT || point->time == UINT32_MAX)
+        return FALSE;
+
+    if (!q->samples) {
+        q->start = start;
+        q->min = point->temp;
+        q->max = point->temp;
+        q->sum = 0;
+        q->heater = 0;
+    }
+    q->samples++;
+    q->sum += point->temp;
+    q->heater += point->heater;
+    if (point->temp < q->min)
+        q->min = point->temp;
+    if (point->temp > q->max)
+        q->max = point->temp;
+
+    return TRUE;
+}
+
+/*******************************************************************************
+ * @brief    Builds the window statistics of the temperature as JSON object,
+ *           keyed by the window length in seconds.
+ *
+ * @param    windows  Array of window lengths, NULL for STATS_WINDOWS. At most
+ *                    STATS_WINDOW_LIMIT of them are used.
+ * @return   New JSON object, the caller releases it.
+ ******************************************************************************/
+static json_t *StatsObject(json_t *windows)
+{
+    const uint32_t defaults[] = STATS_WINDOWS;
+    size_t count = json_is_array(windows) ? json_array_size(windows) : sizeof(defaults) / sizeof(defaults[0]);
+    if (count > STATS_WINDOW_LIMIT)
+        count = STATS_WINDOW_LIMIT;
+    json_t *stats = json_object();
+
+    for (size_t i = 0; i < count; i++) {
+        WindowStats ws;
+        char key[16];
+        json_t *window = json_is_array(windows) ? json_array_get(windows, i) : NULL;
+        uint32_t seconds = window ? (uint32_t)json_integer_value(window) : defaults[i];
+
+        if ((window && !json_is_integer(window)) || !getWindowStats(seconds, &ws))
+            continue;
+
+        snprintf(key, sizeof(key), "%u", seconds);
+        json_object_set_new(stats, key, json_pack("{s:i,s:f,s:f,s:f,s:f}",
+                            "count", (int)ws.count, "min", ws.min, "max", ws.max,
+                            "mean", ws.mean, "stddev", ws.stddev));
+    }
+
+    return stats;
+}
 
-        // Set the lamp states based on their current state and duty cycle
-        if (stateLampFloor)
-            dimSLamp(dutyCycleLed);
-        else
-            dimSLamp(0);
+/*******************************************************************************
+ * @brief    Pushes the window statistics to all clients that subscribed to
+ *           them.
+ ******************************************************************************/
+static void PushStats(void)
+{
+    int i;
 
-        if (stateLampCeiling)
-            dimRLamp(dutyCycleLed);
-        else
-            dimRLamp(0);
+    for (i = 0; i < MAX_CONNECTIONS; i++) {
+        if (connections[i].sock_id >= 0 && (connections[i].subscriptions & SUB_STATS))
+            break;
     }
+    if (i == MAX_CONNECTIONS)
+        return;
+
+    json_t *event = json_pack("{s:s,s:s,s:o}", "type", "Event", "event", "stats", "stats", StatsObject(NULL));
+    char *message = json_dumps(event, JSON_COMPACT);
+    json_decref(event);
+    if (!message)
+        return;
+
+    char frame[TX_BUFFER_SIZE + WS_FRAME_HDR_MAX];
+    int len = code_outgoing_response(message, frame);
+    FreeJsonText(message);
+
+    for (; i < MAX_CONNECTIONS; i++) {
+        Connection *conn = &connections[i];
+        if (conn->sock_id >= 0 && (conn->subscriptions & SUB_STATS)) {
+            SendResponse(conn, frame, len, SEND_ORDERED);
+        }
+    }
+}
+
+/*******************************************************************************
+ * @brief    Handles the WebSocket handshake if the incoming message is a GET request.
+ *           Creates and sends a handshake response back.
+ *
+ * @param    com_sock_id  Socket ID for communication.
+ * @param    rxBuf        Buffer containing the received message.
+ * @return   TRUE if a handshake was handled, FALSE otherwise.
+ ******************************************************************************/
+static int HandleHandshake(int com_sock_id, char* rxBuf)
+{
+	if (strncmp(rxBuf, "GET", 3) == 0) {
+		// create the handshake response and send it back
+		char response[WS_HS_ACCLEN];
+		get_handshake_response(rxBuf, response);
+		send(com_sock_id, (void *)response, strlen(response), 0);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*******************************************************************************
+ * @brief    Answers a plain HTTP GET of the metrics path with the Prometheus
+ *           text page, the caller closes the connection afterwards.
+ *
+ * @param    com_sock_id  Socket ID for communication.
+ * @param    rxBuf        Buffer containing the received request.
+ * @return   TRUE if the metrics were requested, FALSE otherwise.
+ ******************************************************************************/
+static int HandleMetricsRequest(int com_sock_id, char* rxBuf)
+{
+	size_t path_len = strlen(metricsPath);
+
+	if (strncmp(rxBuf, "GET ", 4) != 0 || strncmp(rxBuf + 4, metricsPath, path_len) != 0 ||
+	    (rxBuf[4 + path_len] != ' ' && rxBuf[4 + path_len] != '?')) {
+		return FALSE;
+	}
+
+	char header[160];
+	char *page = formatMetricsText();
+	if (!page) {
+		snprintf(header, sizeof(header), "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+		send(com_sock_id, header, strlen(header), 0);
+		return TRUE;
+	}
+
+	snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+	         strlen(page));
+	send(com_sock_id, header, strlen(header), 0);
+	send(com_sock_id, page, strlen(page), 0);
+	free(page);
+
+	return TRUE;
+}
+
+/*******************************************************************************
+ * @brief    Checks if the received WebSocket message is a close frame.
+ *           Handles the close frame by sending a response, the caller
+ *           closes the connection.
+ *
+ * @param    com_sock_id  Socket ID for communication.
+ * @param    rxBuf        Buffer containing the received message.
+ * @param    rx_data_len  Length of the received message.
+ * @return   TRUE if not a close frame, FALSE if it is a close frame.
+ ******************************************************************************/
+static int CheckAndHandleCloseFrame(int com_sock_id, char* rxBuf, int rx_data_len) 
+{
+    uint8_t opcode = rxBuf[0] & 0x0F;
+    if (opcode == 0x8) { // Close frame detected
+        char closeFrame[2] = { 0x88, 0x00 }; // Simple close frame
+        send(com_sock_id, closeFrame, sizeof(closeFrame), 0);
+        return FALSE;
+    }
+	
+    return TRUE;
+}
+
+/*******************************************************************************
+ * @brief    Handles ping and pong control frames. A ping is answered with a
+ *           pong carrying the same application data, a pong only confirms
+ *           that the peer is alive.
+ *
+ * @param    com_sock_id  Socket ID for communication.
+ * @param    rxBuf        Buffer containing the received message.
+ * @param    rx_data_len  Length of the received message.
+ * @return   TRUE if the message was a control frame, FALSE otherwise.
+ ******************************************************************************/
+static int HandleControlFrame(int com_sock_id, char* rxBuf, int rx_data_len)
+{
+    uint8_t opcode = rxBuf[0] & 0x0F;
+
+    if (opcode == 0xA) { // Pong frame
+        return TRUE;
+    }
+
+    if (opcode == 0x9) { // Ping frame
+        char pongFrame[2 + 125 + 1];	// Header, payload and terminator
+        int size = -1;
+        if ((rxBuf[1] & 0x7F) <= 125) {
+            size = decode_incoming_request(rxBuf, pongFrame + 2, rx_data_len);
+        }
+        if (size < 0) {
+            size = 0;
+        }
+        pongFrame[0] = 0x8A;
+        pongFrame[1] = size;
+        send(com_sock_id, pongFrame, size + 2, 0);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*******************************************************************************
+ * @brief    Decodes the received WebSocket message and executes the command.
+ *           Sends the response back to the client. Responses to commands
+ *           that changed a utility are held back until the change is
+ *           durable (see CommitResponses). Responses to commands with an id
+ *           are not bound to the order of the commands, so reads complete
+ *           ahead of changes still waiting for the sync.
+ *
+ * @param    conn         Connection the message was received on.
+ * @param    rxBuf        Buffer containing the received message.
+ * @param    rx_data_len  Length of the received message.
+ * @param    recv_ns      Time spent receiving the message.
+ * @return   void
+ ******************************************************************************/
+static void DecodeMessage(Connection *conn, char* rxBuf, int rx_data_len, uint64_t recv_ns)
+{
+    CommandInfo info = { FALSE, getMetricAction("invalid"), { 0 } };
+    uint64_t start = getMetricTime();
+    uint64_t now;
+
+    // Decode the incoming request, HandleConnection never passes a frame
+    // longer than its receive buffer
+	char command[RX_BUFFER_SIZE];
+	if(rx_data_len >= RX_BUFFER_SIZE || decode_incoming_request(rxBuf, command, rx_data_len) == -1){
+        logWarn("Error decoding incoming request");
+        return;
+    }
+    now = getMetricTime();
+    info.ns[METRIC_RECV] = recv_ns;
+    info.ns[METRIC_UNMASK] = now - start;
+    PROBE3(frame_decoded, (int)(conn - connections), rx_data_len, info.ns[METRIC_UNMASK]);
+
+    // Process the command and create a response
+    char response[TX_BUFFER_SIZE];
+    uint32_t seq = getWalSeq();
+	if(!processCommand(conn, command, response, &info)){
+        logWarn("Error processing command, response: %s", response);
+    }
+
+    // A response without an id must not overtake the acknowledgement of
+    // lamp writes still waiting for the device tick, so the tick ends early
+    if (response[0] != '\0' && !info.correlated && conn->ledWrites > 0) {
+        FlushWrites();
+    }
+
+    // Encode the response
+    uint64_t encode = getMetricTime();
+	char codedResponse[TX_BUFFER_SIZE + WS_FRAME_HDR_MAX];
+	int len = code_outgoing_response (response, codedResponse);
+    now = getMetricTime();
+    info.ns[METRIC_SERIALIZE] += now - encode;
+
+    // Send the response, changes are acknowledged after the group commit.
+    // A response carrying an id may overtake the ones held back.
+	if (len > 0) {
+		SendResponse(conn, codedResponse, len,
+		             (getWalSeq() != seq ? SEND_DURABLE : 0) | (info.correlated ? 0 : SEND_ORDERED));
+	}
+
+    info.ns[METRIC_SEND] = getMetricTime() - now;
+    info.ns[METRIC_TOTAL] = recv_ns + getMetricTime() - start;
+    PROBE3(command_done, (int)(conn - connections), getMetricActionName(info.action), info.ns[METRIC_TOTAL]);
+    for (int phase = 0; phase < METRIC_PHASES; phase++) {
+        recordMetric(info.action, phase, info.ns[phase]);
+    }
+}
+
+/*******************************************************************************
+ * @brief    Sends a frame or queues it until the next group commit. Once a
+ *           frame is queued, all following ordered frames of the connection
+ *           are queued as well to keep the response order.
+ *
+ * @param    conn     Connection to send on.
+ * @param    frame    Encoded WebSocket frame.
+ * @param    len      Length of the frame.
+ * @param    flags    SEND_DURABLE if the frame acknowledges a logged change,
+ *                    SEND_ORDERED if it must not overtake queued frames.
+ ******************************************************************************/
+static void SendResponse(Connection *conn, const char *frame, int len, int flags)
+{
+    if (!(flags & SEND_DURABLE) && (!(flags & SEND_ORDERED) || conn->pending_len == 0)) {
+        send(conn->sock_id, (void *)frame, len, 0);
+        captureEvent((int)(conn - connections), CAPTURE_OUT, frame, (uint32_t)len);
+        return;
+    }
+
+    // Commit early instead of dropping responses when the queue is full,
+    // the frame is only dropped while the log cannot be written
+    if (conn->pending_len + len > PENDING_SIZE) {
+        CommitResponses();
+    }
+    if (conn->pending_len + len > PENDING_SIZE) {
+        logError("Response dropped, %s cannot be written", WAL_FILE);
+        return;
+    }
+
+    memcpy(conn->pending + conn->pending_len, frame, len);
+    conn->pending_len += len;
+    responsesPending = TRUE;
 }
 
 /*******************************************************************************
- * @brief    Saves the current state of the Webhouse utilities to a file.
- *           It writes the states of TV, heater, floor lamp, ceiling lamp,
- *           and LED PWM duty cycle to 'data.json' in JSON format.
- *
- * @return   TRUE if successful, FALSE otherwise.
+ * @brief    Flushes the write-ahead log with a single sync and sends the
+ *           responses that waited for it. Compacts the log into a new
+ *           snapshot when it grew too large.
  ******************************************************************************/
-static int SaveData(void)
+static void CommitResponses(void)
 {
-    // Define the filename where the data will be saved
-    const char* filename = "data.json";
-
-    // Create a new JSON object
-    json_t *root = json_object();
-    
-    // Set the values for each utility in the JSON object
-    json_object_set_new(root, "tv", json_integer(getTVState()));
-    json_object_set_new(root, "heater", json_integer(getHeatState()));
-    json_object_set_new(root, "lamp_floor", json_integer(stateLampFloor));
-    json_object_set_new(root, "lamp_ceil", json_integer(stateLampCeiling));
-    json_object_set_new(root, "led_pwm", json_integer(dutyCycleLed));
-
-    // Convert the JSON object to a string
-    char *res_str = json_dumps(root, JSON_COMPACT);
-    if(!res_str){
-        // Handle error if conversion fails
-        fprintf(stderr, "Error converting JSON to string\n");
-        fflush(stderr);
-        json_decref(root);      // Release the JSON object
-        return FALSE;
+    if (isWalPending()) {
+        uint64_t start = getMetricTime();
+        (void)start;    // Only read by the probe
+        if (syncWal() < 0) {
+            // Acknowledgements wait for the next attempt, they must not
+            // report changes that are not on disk
+            logError("Error syncing %s, responses held back", WAL_FILE);
+            return;
+        }
+        PROBE2(state_persisted, getWalSeq(), getMetricTime() - start);
     }
 
-    // Open the file for writing
-    FILE *fp = fopen(filename, "w");
-    if(!fp){
-        // Handle error if file opening fails
-        fprintf(stderr, "Error opening file: %s\n", filename);
-        fflush(stderr);
-        free(res_str);          // Free the JSON string
-        json_decref(root);      // Release the JSON object
-        return FALSE;
+    if (responsesPending) {
+        for (int i = 0; i < MAX_CONNECTIONS; i++) {
+            Connection *conn = &connections[i];
+            if (conn->sock_id >= 0 && conn->pending_len > 0) {
+                send(conn->sock_id, (void *)conn->pending, conn->pending_len, 0);
+                captureFrames(i, CAPTURE_OUT, conn->pending, conn->pending_len);
+            }
+            conn->pending_len = 0;
+        }
+        responsesPending = FALSE;
     }
 
-    // Write the JSON string to the file
-    if(fprintf(fp, "%s", res_str) < 0) {
-        // Handle error if writing fails
-        fprintf(stderr, "Error writing to file: %s\n", filename);
-    } else {
-        // Confirm successful data saving
-        printf("Data successfully saved to %s\n", filename);
+    if (getWalSize() > WAL_COMPACT_SIZE) {
+        SaveState();
     }
-
-    // Close the file and release resources
-    fclose(fp);
-    free(res_str);              // Free the JSON string
-    json_decref(root);          // Release the JSON object
-
-    return TRUE;
 }
 
 /*******************************************************************************
- * @brief    Lädt den aktuellen Zustand der Webhouse-Umgebung aus einer Datei.
- *           Gibt TRUE zurück, wenn das Laden erfolgreich war, sonst FALSE.
+ * @brief    Processes the received command and creates a response.
+ *           The message is a single command object or a batch of them.
  *
+ * @param    conn        Connection the command was received on.
+ * @param    command     The received command.
+ * @param    response    The response to be sent back.
+ * @param    info        Receives action, id echo and phase times.
  * @return   TRUE if successful, FALSE otherwise.
  ******************************************************************************/
-static int LoadData(void)
+static int processCommand(Connection *conn, char* command, char* response, CommandInfo *info) 
 {
-    const char* filename = "data.json";
-
-    // Datei für das Lesen öffnen
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        fprintf(stderr, "Error opening file: %s\n", filename);
-        fflush(stderr);
-        return FALSE;
-    }
-
-    // Datei in einen String einlesen
-    char *buffer = NULL;
-    long length;
-    fseek(fp, 0, SEEK_END);
-    length = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    buffer = malloc(length);
-    if (buffer) {
-        fread(buffer, 1, length, fp);
-    }
-    fclose(fp);
+    // Print the received command
+    logDebug("Command: %s", command);
 
-    if (!buffer) {
-        fprintf(stderr, "Error reading file: %s\n", filename);
-        fflush(stderr);
-        return FALSE;
-    }
+    // The nodes of the command and its response live in the arena until
+    // the response is written
+    beginArena();
 
-    // JSON-String parsen
+    // Parse the command as JSON
     json_error_t error;
-    json_t *root = json_loads(buffer, 0, &error);
-    free(buffer);
+    uint64_t start = getMetricTime();
+    json_t *root = json_loads(command, 0, &error);
+    uint64_t parsed = getMetricTime();
+    info->ns[METRIC_PARSE] = parsed - start;
 
     if (!root) {
-        fprintf(stderr, "Error parsing JSON data: %s\n", error.text);
-        fflush(stderr);
+        // Error handling
+        logWarn("Invalid JSON on line %d: %s, command: %s", error.line, error.text, command);
+        sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"-\",\"status\":\"Error\",\"message\":\"Invalid JSON\"}");
+        endArena();
         return FALSE;
     }
 
-    // Zustände aus dem JSON-Objekt extrahieren
-    json_t *tv = json_object_get(root, "tv");
-    if(json_is_integer(tv)){
-        if(json_integer_value(tv))
-            turnTVOn();
-        else
-            turnTVOff();
-    }
+    // A JSON array or {"batch":[...],"atomic":true} carries several commands
+    json_t *batch = json_object_get(root, "batch");
+    int ok;
 
-    json_t *heater = json_object_get(root, "heater");
-    if(json_is_integer(heater)){
-        if(json_integer_value(heater))
-            turnHeatOn();
-        else
-            turnHeatOff();
+    if (json_is_array(root) || json_is_array(batch)) {
+        info->action = getMetricAction("batch");
     }
-
-    json_t *led_pwm = json_object_get(root, "led_pwm");
-    if(json_is_integer(led_pwm)){
-        dutyCycleLed = (int)json_integer_value(led_pwm);
+    else {
+        info->action = getMetricAction(json_string_value(json_object_get(root, "action")));
     }
+    PROBE3(command_parsed, (int)(conn - connections), getMetricActionName(info->action), info->ns[METRIC_PARSE]);
 
-    json_t *lamp_floor = json_object_get(root, "lamp_floor");
-    if(json_is_integer(lamp_floor)){
-        stateLampFloor = (int)json_integer_value(lamp_floor);
-        
-        if(json_integer_value(lamp_floor)){
-            dimSLamp((uint16_t)dutyCycleLed);
-        } else{
-            dimSLamp(0);
-        }
+    if (json_is_array(root)) {
+        ok = ProcessBatch(conn, root, FALSE, response);
+    }
+    else if (json_is_array(batch)) {
+        ok = ProcessBatch(conn, batch, json_is_true(json_object_get(root, "atomic")), response);
     }
+    else {
+        ok = ExecuteCommand(conn, root, response);
+    }
+    uint64_t executed = getMetricTime();
+    info->ns[METRIC_ACTUATE] = executed - parsed;
 
-    json_t *lamp_ceil = json_object_get(root, "lamp_ceil");
-    if(json_is_integer(lamp_ceil)){
-        stateLampCeiling = (int)json_integer_value(lamp_ceil);
-        
-        if(json_integer_value(lamp_ceil)){
-            dimRLamp((uint16_t)dutyCycleLed);
-        } else{
-            dimRLamp(0);
-        }
+    // Echo the id, the client matches the response by it
+    if (json_is_object(root)) {
+        info->correlated = TagResponse(json_object_get(root, "id"), response, TX_BUFFER_SIZE);
     }
+    info->ns[METRIC_SERIALIZE] = getMetricTime() - executed;
 
-    // JSON-Objekt freigeben
     json_decref(root);
-
-    printf("Data loaded successfully from %s\n", filename);
-    return TRUE;
+    endArena();
+    return ok;
 }
 
 /*******************************************************************************
- * @brief    Creates and initializes a server socket with specified settings.
- *           Binds the socket to the server address and listens for incoming
- *           connections.
+ * @brief    Processes the commands of a batch in order and combines their
+ *           responses into one. An atomic batch is validated completely
+ *           before any command is executed, and its state changes are
+ *           logged as one batch.
  *
- * @return   The socket ID if successful, -1 on failure.
+ * @param    conn      Connection the batch was received on.
+ * @param    commands  JSON array of command objects.
+ * @param    atomic    TRUE to execute all commands or none.
+ * @param    response  The combined response to be sent back.
+ * @return   TRUE if all commands succeeded, FALSE otherwise.
  ******************************************************************************/
-static int InitSocket(void) 
+static int ProcessBatch(Connection *conn, json_t *commands, int atomic, char *response)
 {
-    // Create a socket
-    int server_sock_id = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (server_sock_id < 0) {
-        perror("Socket creation failed");
-        return -1;
+    char single[TX_BUFFER_SIZE];
+    size_t count = json_array_size(commands);
+    size_t index;
+    json_t *command;
+    int ok = TRUE;
+
+    if (count == 0 || count > BATCH_LIMIT) {
+        sprintf(response, "{\"type\":\"BatchResponse\",\"status\":\"Error\",\"message\":\"A batch holds 1 to %d commands\"}", BATCH_LIMIT);
+        return FALSE;
     }
-    printf("Socket created successfully. Server socket ID: %d\n", server_sock_id);
-    fflush(stdout);
 
-    // Set server address
-    struct sockaddr_in server;
-    server.sin_family = AF_INET;
-    server.sin_addr.s_addr = htonl(INADDR_ANY);
-    server.sin_port = htons(SERVER_PORT);
+    if (atomic) {
+        json_array_foreach(commands, index, command) {
+            if (!ValidateCommand(command, single)) {
+                TagResponse(json_object_get(command, "id"), single, sizeof(single));
+                snprintf(response, TX_BUFFER_SIZE, "{\"type\":\"BatchResponse\",\"status\":\"Error\",\"atomic\":true,\"failed\":%zu,\"responses\":[%s]}",
+                         index, single);
+                return FALSE;
+            }
+        }
 
-    // Bind the socket
-    int bind_status = bind(server_sock_id, (struct sockaddr *)&server, sizeof(server));
-    if (bind_status < 0) {
-        perror("Socket bind failed");
-        close(server_sock_id);
-        return -1;
+        // The whole batch must fit the log buffer, so no part of it is
+        // written before it is sealed
+        if (reserveWal((int)count * STATE_KEY_COUNT) < 0) {
+            sprintf(response, "{\"type\":\"BatchResponse\",\"status\":\"Error\",\"atomic\":true,\"message\":\"State log not writable\"}");
+            return FALSE;
+        }
+        BeginStateBatch();
     }
-    printf("Socket binded successfully\n");
-    fflush(stdout);
 
-    // Listen on the socket
-    int listen_status = listen(server_sock_id, BACKLOG);
-    if (listen_status < 0) {
-        perror("Listen failed");
-        close(server_sock_id);
-        return -1;
+    int len = sprintf(response, "{\"type\":\"BatchResponse\",\"responses\":[");
+    commandBatchDepth++;
+    json_array_foreach(commands, index, command) {
+        if (!ExecuteCommand(conn, command, single)) {
+            ok = FALSE;
+        }
+        TagResponse(json_object_get(command, "id"), single, sizeof(single));
+
+        // Leave room for the closing part of the combined response
+        if (len + strlen(single) + 64 > TX_BUFFER_SIZE) {
+            sprintf(single, "{\"type\":\"CommandResponse\",\"status\":\"Error\",\"message\":\"Response too large for a batch\"}");
+            ok = FALSE;
+        }
+        len += sprintf(response + len, "%s%s", index ? "," : "", single);
     }
-    printf("Listen succeeded\n");
-    fflush(stdout);
 
-    return server_sock_id;
+    commandBatchDepth--;
+    if (atomic) {
+        EndStateBatch();
+    }
+    sprintf(response + len, "],\"status\":\"%s\"}", ok ? "Success" : "Error");
+    return ok;
 }
 
 /*******************************************************************************
- * @brief    Handles the WebSocket handshake if the incoming message is a GET request.
- *           Creates and sends a handshake response back.
+ * @brief    Copies the id of a command into its response, right behind the
+ *           opening brace. Strings up to ID_MAX_LEN characters and integers
+ *           are echoed, other ids are ignored.
  *
- * @param    com_sock_id  Socket ID for communication.
- * @param    rxBuf        Buffer containing the received message.
- * @return   TRUE if a handshake was handled, FALSE otherwise.
+ * @param    id        The id of the command, may be NULL.
+ * @param    response  The response created for the command.
+ * @param    size      Size of the response buffer.
+ * @return   TRUE if the id was echoed, FALSE if it was ignored or does not
+ *           fit.
  ******************************************************************************/
-static int HandleHandshake(int com_sock_id, char* rxBuf)
+static int TagResponse(json_t *id, char *response, size_t size)
 {
-	if (strncmp(rxBuf, "GET", 3) == 0) {
-		// create the handshake response and send it back
-		char response[WS_HS_ACCLEN];
-		get_handshake_response(rxBuf, response);
-		send(com_sock_id, (void *)response, strlen(response), 0);
-		return TRUE;
-	}
+    int tagged = FALSE;
 
-	return FALSE;
+    if (!(json_is_integer(id) || (json_is_string(id) && json_string_length(id) <= ID_MAX_LEN))) {
+        return FALSE;
+    }
+
+    char *encoded = json_dumps(id, JSON_ENCODE_ANY | JSON_COMPACT);
+    if (!encoded) {
+        return FALSE;
+    }
+
+    // The response is an object, insert "id":<id>, behind its brace
+    size_t len = strlen(response);
+    size_t tag = strlen(encoded) + 6;
+    if (response[0] == '{' && len + tag < size) {
+        memmove(response + 1 + tag, response + 1, len);
+        memcpy(response + 1, "\"id\":", 5);
+        memcpy(response + 6, encoded, tag - 6);
+        response[tag] = ',';
+        tagged = TRUE;
+    }
+    FreeJsonText(encoded);
+    return tagged;
 }
 
 /*******************************************************************************
- * @brief    Checks if the received WebSocket message is a close frame.
- *           Handles the close frame by sending a response and closing the socket.
- *
- * @param    com_sock_id  Socket ID for communication.
- * @param    rxBuf        Buffer containing the received message.
- * @param    rx_data_len  Length of the received message.
- * @return   TRUE if not a close frame, FALSE if it is a close frame.
+ * @brief    Releases a string of json_dumps(). It comes from the allocator of
+ *           jansson, which is not malloc once json_set_alloc_funcs() was
+ *           called.
  ******************************************************************************/
-static int CheckAndHandleCloseFrame(int com_sock_id, char* rxBuf, int rx_data_len) 
+static void FreeJsonText(char *text)
 {
-    uint8_t opcode = rxBuf[0] & 0x0F;
-    if (opcode == 0x8) { // Close frame detected
-        char closeFrame[2] = { 0x88, 0x00 }; // Simple close frame
-        send(com_sock_id, closeFrame, sizeof(closeFrame), 0);
-        close(com_sock_id);
-        return FALSE;
-    }
-	
-    return TRUE;
+    json_free_t release;
+
+    json_get_alloc_funcs(NULL, &release);
+    release(text);
 }
 
 /*******************************************************************************
- * @brief    Decodes the received WebSocket message and executes the command.
- *           Sends the response back to the client.
+ * @brief    Checks a command without executing it, so an atomic batch can be
+ *           rejected before anything changes.
  *
- * @param    com_sock_id  Socket ID for communication.
- * @param    rxBuf        Buffer containing the received message.
- * @param    rx_data_len  Length of the received message.
- * @return   void
+ * @param    root      The command.
+ * @param    response  Receives the error response.
+ * @return   TRUE if the command can be executed, FALSE otherwise.
  ******************************************************************************/
-static void DecodeMessage(int com_sock_id, char* rxBuf, int rx_data_len)
+static int ValidateCommand(json_t *root, char *response)
 {
-    // Decode the incoming request
-	char command[rx_data_len];
-	if(decode_incoming_request(rxBuf, command, rx_data_len) == -1){
-        printf("Error decoding incoming request\n");
-        fflush(stdout);
-        return;
+    json_t *action = json_object_get(root, "action");
+    const char *action_str = json_is_string(action) ? json_string_value(action) : "-";
+    const char *message = NULL;
+
+    if (!json_is_string(action)) {
+        message = "Missing or invalid action";
     }
+    else if (strcmp(action_str, "write") == 0) {
+        json_t *utility = json_object_get(root, "utility");
+        json_t *value = json_object_get(root, "value");
+        const char *utility_str = json_is_string(utility) ? json_string_value(utility) : "";
 
-    // Terminate the command string
-	command[strlen(command)] = '\0';
+        if (strcmp(utility_str, "led_pwm") == 0) {
+            message = json_is_integer(value) ? FadeError(root) : "Invalid value";
+        }
+        else if (strcmp(utility_str, "thermostat") == 0) {
+            const char *mode = json_is_string(value) ? json_string_value(value) : "";
+            int valid = json_is_integer(value) ? json_integer_value(value) >= THERMOSTAT_OFF && json_integer_value(value) <= THERMOSTAT_PID
+                                               : strcmp(mode, "off") == 0 || strcmp(mode, "hysteresis") == 0 || strcmp(mode, "pid") == 0;
+            message = valid ? NULL : "Invalid thermostat mode";
+        }
+        else if (strcmp(utility_str, "setpoint") == 0 || strcmp(utility_str, "hysteresis") == 0) {
+            message = json_is_number(value) ? NULL : "Invalid value";
+        }
+        else {
+            message = "Missing or invalid utility";
+        }
+    }
+    else if (strcmp(action_str, "toggle") == 0) {
+        json_t *utility = json_object_get(root, "utility");
+        const char *utility_str = json_is_string(utility) ? json_string_value(utility) : "";
 
-    // Process the command and create a response
-    char response[RX_BUFFER_SIZE];
-	if(!processCommand(command, response)){
-        printf("Error processing command, response: %s \n", response);
-        fflush(stdout);
+        if (strcmp(utility_str, "tv") != 0 && strcmp(utility_str, "heater") != 0 &&
+            strcmp(utility_str, "lamp_floor") != 0 && strcmp(utility_str, "lamp_ceil") != 0) {
+            message = "Missing or invalid utility";
+        }
+    }
+    else if (strcmp(action_str, "apply_scene") == 0) {
+        json_t *name = json_object_get(root, "scene");
+        message = json_is_string(name) && findScene(json_string_value(name)) ? NULL : "Unknown scene";
+    }
+    else if (strcmp(action_str, "read") == 0) {
+        json_t *windows = json_object_get(root, "windows");
+        message = !json_is_array(json_object_get(root, "utilities")) ? "Missing or invalid utilities" :
+                  windows && (!json_is_array(windows) || json_array_size(windows) > STATS_WINDOW_LIMIT) ? "Invalid windows" : NULL;
+    }
+    else if (strcmp(action_str, "subscribe") == 0) {
+        message = json_is_array(json_object_get(root, "events")) ? NULL : "Missing or invalid events";
+    }
+    else if (strcmp(action_str, "events") != 0 && strcmp(action_str, "history") != 0 &&
+             strcmp(action_str, "energy") != 0 && strcmp(action_str, "metrics") != 0) {
+        message = "Invalid action";
     }
 
-    // Encode the response
-	char codedResponse[strlen(response)+2];
-	code_outgoing_response (response, codedResponse);
+    if (message) {
+        snprintf(response, TX_BUFFER_SIZE, "{\"type\":\"CommandResponse\",\"action\":\"%s\",\"status\":\"Error\",\"message\":\"%s\"}",
+                 action_str, message);
+        return FALSE;
+    }
 
-    // Send the response
-	send(com_sock_id, (void *)codedResponse, strlen(codedResponse), 0);
+    return TRUE;
 }
 
 /*******************************************************************************
- * @brief    Processes the received command and creates a response.
+ * @brief    Checks the optional fade_ms of a lamp write.
  *
- * @param    command   The received command.
- * @param    response  The response to be sent back.
- * @return   TRUE if successful, FALSE otherwise.
+ * @param    root  The write command.
+ * @return   NULL if the fade is valid or missing, an error message otherwise.
  ******************************************************************************/
-static int processCommand(char* command, char* response) 
+static const char *FadeError(json_t *root)
 {
-    // Print the received command
-    printf("[%d] Command: {%s}\n", __LINE__, command);
-    fflush(stdout);
-
-    // Parse the command as JSON
-    json_error_t error;
-    json_t *root = json_loads(command, 0, &error);
+    json_t *fade = json_object_get(root, "fade_ms");
 
-    if (!root) {
-        // Error handling
-        fprintf(stderr, "error: on line %d: %s\n", error.line, error.text);
-        fprintf(stderr, "Command: %s\n", command);
-        sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"-\",\"status\":\"Error\",\"message\":\"Invalid JSON\"}", command);
-        return FALSE;
+    if (fade && (!json_is_integer(fade) || json_integer_value(fade) < 0 || json_integer_value(fade) > FADE_MAX_MS)) {
+        return "fade_ms must be 0 to 60000";
     }
+    return NULL;
+}
 
+/*******************************************************************************
+ * @brief    Executes a single command and creates its response.
+ *
+ * @param    conn      Connection the command was received on.
+ * @param    root      The command, owned by the caller.
+ * @param    response  The response to be sent back.
+ * @return   TRUE if successful, FALSE otherwise.
+ ******************************************************************************/
+static int ExecuteCommand(Connection *conn, json_t *root, char *response)
+{
     json_t *action = json_object_get(root, "action");
 
     if (!json_is_string(action)) {
-        sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"-\",\"status\":\"Error\",\"message\":\"Missing or invalid action\"}", command);
-        printf("[%d] Response: {%s}\n", __LINE__, response);
+        sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"-\",\"status\":\"Error\",\"message\":\"Missing or invalid action\"}");
+        logDebug("Response: %s", response);
         return FALSE;
     }
 
     // Handle different actions
     const char *action_str = json_string_value(action);
 
+    // A change is only made if the log can take its records, otherwise the
+    // command fails before it touches a utility
+    if ((strcmp(action_str, "write") == 0 || strcmp(action_str, "toggle") == 0 ||
+         strcmp(action_str, "apply_scene") == 0) && reserveWal(STATE_KEY_COUNT) < 0) {
+        sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"%s\",\"status\":\"Error\",\"message\":\"State log not writable\"}",
+                action_str);
+        return FALSE;
+    }
+
     if (strcmp(action_str, "read") == 0) {
         json_t *utilities = json_object_get(root, "utilities");
         
+        json_t *windows = json_object_get(root, "windows");
+
         if (!json_is_array(utilities)) {
             sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"read\",\"status\":\"Error\",\"message\":\"Missing or invalid utilities\"}");
             return FALSE;
         }
+        if (windows && (!json_is_array(windows) || json_array_size(windows) > STATS_WINDOW_LIMIT)) {
+            sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"read\",\"status\":\"Error\",\"message\":\"Invalid windows, at most %d window lengths\"}",
+                    STATS_WINDOW_LIMIT);
+            return FALSE;
+        }
 
         // Create JSON response
         json_t *res = json_object();
@@ -604,36 +1891,52 @@ static int processCommand(char* command, char* response)
                     json_object_set_new(data, "lamp_ceil", json_integer(stateLampCeiling));
                 } else if (strcmp(utility_str, "led_pwm") == 0) {
                     json_object_set_new(data, "led_pwm", json_integer(dutyCycleLed));
+                } else if (strcmp(utility_str, "thermostat") == 0) {
+                    json_object_set_new(data, "thermostat", json_pack("{s:i,s:f,s:f,s:f}",
+                                        "mode", getThermostatMode(), "setpoint", getThermostatSetpoint(),
+                                        "hysteresis", getThermostatHysteresis(), "output", getThermostatOutput()));
+                } else if (strcmp(utility_str, "stats") == 0) {
+                    // Example: {"action":"read","utilities":["stats"],"windows":[60,600]}
+                    json_object_set_new(res, "stats", StatsObject(windows));
                 }
             }
         }
 
         json_object_set_new(res, "data", data);
 
-        // Convert JSON response to string
+        // Convert JSON response to string, a response that does not fit is
+        // an error rather than cut off
         char *res_str = json_dumps(res, JSON_COMPACT);
-        if (res_str) {
-            strncpy(response, res_str, RX_BUFFER_SIZE);
-            free(res_str);
+        json_decref(res);
+        if (res_str && strlen(res_str) < TX_BUFFER_SIZE) {
+            snprintf(response, TX_BUFFER_SIZE, "%s", res_str);
+            FreeJsonText(res_str);
         } else {
+            FreeJsonText(res_str);
             sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"read\",\"status\":\"Error\",\"message\":\"JSON conversion failed\"}");
             return FALSE;
         }
-        json_decref(res);
     } // End of read
     else if (strcmp(action_str, "write") == 0) {
         // Example: {{"action":"write","utility":"led_pwm","value":32}}
         json_t *utility = json_object_get(root, "utility");
         json_t *value = json_object_get(root, "value");
 
-        if (!json_is_string(utility) || !json_is_integer(value)) {
+        if (!json_is_string(utility) || !value) {
             sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"write\",\"status\":\"Error\",\"message\":\"Missing or invalid utility or value\"}");
             return FALSE;
         }
 
         const char *utility_str = json_string_value(utility);
 
-        if (strcmp(utility_str, "led_pwm") == 0) {
+        if (strcmp(utility_str, "led_pwm") == 0 && json_is_integer(value)) {
+            // Example: {"action":"write","utility":"led_pwm","value":80,"fade_ms":2000}
+            json_t *fade = json_object_get(root, "fade_ms");
+            if (FadeError(root)) {
+                sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"write\",\"status\":\"Error\",\"message\":\"%s\"}", FadeError(root));
+                return FALSE;
+            }
+            int previous = dutyCycleLed;
             dutyCycleLed = (int)json_integer_value(value);
 
             // Check if the duty cycle is in the valid range
@@ -644,15 +1947,73 @@ static int processCommand(char* command, char* response)
                 dutyCycleLed = 100;
             }
 
+            // Single writes are coalesced per device tick, only the last one
+            // is applied and acknowledged by FlushWrites. The id outlives the
+            // arena of the command.
+            if (commandBatchDepth == 0) {
+                json_t *id = json_object_get(root, "id");
+                conn->ledWrites++;
+                json_decref(conn->ledWriteId);
+                conn->ledWriteId = keepArenaJson(id);
+                ledFadeMs = fade ? (uint32_t)json_integer_value(fade) : 0;
+                if (!isTimerActive(&writeTimer)) {
+                    ledTickStart = previous;
+                    startTimer(&writeTimer, WRITE_TICK_MS, 0);
+                }
+                response[0] = '\0';
+                return TRUE;
+            }
+            RecordState(STATE_LED_PWM, dutyCycleLed);
+
             // Set the duty cycle for the lamps based on their current state
             if(stateLampFloor){
-                dimSLamp((uint16_t)dutyCycleLed);
+                fadeSLamp((uint16_t)dutyCycleLed, fade ? (uint32_t)json_integer_value(fade) : 0);
             }
             if(stateLampCeiling){
-                dimRLamp((uint16_t)dutyCycleLed);
+                fadeRLamp((uint16_t)dutyCycleLed, fade ? (uint32_t)json_integer_value(fade) : 0);
             }
             
-            sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"write\",\"status\":\"Success\",\"message\":\"RLamp set to %d\"}", dutyCycleLed);
+            sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"write\",\"status\":\"Success\",\"message\":\"LED PWM set to %d\"}", dutyCycleLed);
+        }
+        else if (strcmp(utility_str, "thermostat") == 0 && (json_is_integer(value) || json_is_string(value))) {
+            // Example: {"action":"write","utility":"thermostat","value":"pid"}, or 0/1/2
+            static const char *modes[] = { "off", "hysteresis", "pid" };
+            int mode = json_is_integer(value) ? (int)json_integer_value(value) : -1;
+
+            for (int i = 0; json_is_string(value) && i < 3; i++) {
+                if (strcmp(json_string_value(value), modes[i]) == 0) {
+                    mode = i;
+                }
+            }
+            if (mode < THERMOSTAT_OFF || mode > THERMOSTAT_PID) {
+                sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"write\",\"status\":\"Error\",\"message\":\"Invalid thermostat mode\"}");
+                return FALSE;
+            }
+
+            setThermostat(mode, getThermostatSetpoint(), getThermostatHysteresis());
+            RecordState(STATE_THERMOSTAT, mode);
+            sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"write\",\"status\":\"Success\",\"message\":\"Thermostat set to %s\"}", modes[mode]);
+        }
+        else if ((strcmp(utility_str, "setpoint") == 0 || strcmp(utility_str, "hysteresis") == 0) && json_is_number(value)) {
+            // Example: {"action":"write","utility":"setpoint","value":21.5}
+            float setpoint = getThermostatSetpoint();
+            float hysteresis = getThermostatHysteresis();
+
+            if (utility_str[0] == 's') {
+                setpoint = (float)json_number_value(value);
+            }
+            else {
+                hysteresis = (float)json_number_value(value);
+            }
+            setThermostat(getThermostatMode(), setpoint, hysteresis);
+
+            // Log the clamped values, they are what gets restored
+            BeginStateBatch();
+            RecordState(STATE_SETPOINT, (int32_t)lroundf(getThermostatSetpoint() * 100));
+            RecordState(STATE_HYSTERESIS, (int32_t)lroundf(getThermostatHysteresis() * 100));
+            EndStateBatch();
+            sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"write\",\"status\":\"Success\",\"message\":\"Setpoint %.2f, hysteresis %.2f\"}",
+                    getThermostatSetpoint(), getThermostatHysteresis());
         }
         else{
             sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"write\",\"status\":\"Error\",\"message\":\"Invalid utility: %s\"}", utility_str);
@@ -672,10 +2033,22 @@ static int processCommand(char* command, char* response)
         int utility_toggled = 1;
 
         if (strcmp(utility_str, "tv") == 0) {
-            getTVState() ? turnTVOff() : turnTVOn();
+            int tv = !getTVState();
+            tv ? turnTVOn() : turnTVOff();
+            RecordState(STATE_TV, tv);
         }
         else if (strcmp(utility_str, "heater") == 0) {
-            getHeatState() ? turnHeatOff() : turnHeatOn();
+            int heater = !getHeatState();
+
+            // Switching the heater by hand overrides the thermostat
+            BeginStateBatch();
+            if (getThermostatMode() != THERMOSTAT_OFF) {
+                setThermostat(THERMOSTAT_OFF, getThermostatSetpoint(), getThermostatHysteresis());
+                RecordState(STATE_THERMOSTAT, THERMOSTAT_OFF);
+            }
+            heater ? turnHeatOn() : turnHeatOff();
+            RecordState(STATE_HEATER, heater);
+            EndStateBatch();
         }
         else if (strcmp(utility_str, "lamp_floor") == 0) {
             if(stateLampFloor){
@@ -685,6 +2058,7 @@ static int processCommand(char* command, char* response)
                 stateLampFloor = 1;
                 dimSLamp((uint16_t)dutyCycleLed);
             }
+            RecordState(STATE_LAMP_FLOOR, stateLampFloor);
         }
         else if (strcmp(utility_str, "lamp_ceil") == 0) {
             if(stateLampCeiling){
@@ -694,6 +2068,7 @@ static int processCommand(char* command, char* response)
                 stateLampCeiling = 1;
                 dimRLamp((uint16_t)dutyCycleLed);
             }
+            RecordState(STATE_LAMP_CEIL, stateLampCeiling);
         }
         else{
             utility_toggled = 0;
@@ -705,11 +2080,235 @@ static int processCommand(char* command, char* response)
             sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"toggle\",\"status\":\"Error\",\"message\":\"Invalid utility: %s\"}", utility_str);
             return FALSE;
         }
+    }
+    else if (strcmp(action_str, "events") == 0) {
+        // Example: {"action":"events","from":1700000000000000,"to":1700003600000000,"limit":20}
+        json_t *from = json_object_get(root, "from");
+        json_t *to = json_object_get(root, "to");
+        json_t *limit = json_object_get(root, "limit");
+
+        uint64_t from_us = json_is_integer(from) && json_integer_value(from) > 0 ? (uint64_t)json_integer_value(from) : 0;
+        uint64_t to_us = json_is_integer(to) && json_integer_value(to) >= 0 ? (uint64_t)json_integer_value(to) : UINT64_MAX;
+        uint32_t max = EVENTS_LIMIT;
+        if (json_is_integer(limit) && json_integer_value(limit) >= 0 && json_integer_value(limit) < EVENTS_LIMIT) {
+            max = (uint32_t)json_integer_value(limit);
+        }
+
+        // Binary search the range, the entries are formatted in place
+        uint32_t first;
+        uint32_t count = findAlarmLog(from_us, to_us, &first);
+        int len = sprintf(response, "{\"type\":\"DataResponse\",\"action\":\"events\",\"count\":%u,\"data\":[", count);
+
+        for (uint32_t i = 0; i < count && i < max; i++) {
+            const AlarmLogEntry *entry = getAlarmLog(first + i);
+            len += snprintf(response + len, TX_BUFFER_SIZE - len, "%s{\"time\":%llu,\"state\":%d,\"bounces\":%d}",
+                            i ? "," : "", (unsigned long long)entry->timestamp, entry->level, entry->bounces);
+        }
+        snprintf(response + len, TX_BUFFER_SIZE - len, "]}");
+    }
+    else if (strcmp(action_str, "history") == 0) {
+        // Example: {"action":"history","from":1700000000,"to":1700086400,"resolution":3600}
+        json_t *from = json_object_get(root, "from");
+        json_t *to = json_object_get(root, "to");
+        json_t *resolution = json_object_get(root, "resolution");
+
+        uint32_t to_s = json_is_integer(to) && json_integer_value(to) >= 0 ? (uint32_t)json_integer_value(to) : getClockTime();
+        uint32_t from_s = json_is_integer(from) && json_integer_value(from) >= 0 ? (uint32_t)json_integer_value(from) : to_s - 3600;
+        uint32_t res_s = to_s > from_s ? (to_s - from_s - 1) / HISTORY_LIMIT + 1 : 1;
+        if (json_is_integer(resolution) && json_integer_value(resolution) >= 0) {
+            res_s = (uint32_t)json_integer_value(resolution);
+        }
+
+        // Serve from the finest tier that fits the window into HISTORY_LIMIT
+        // points, a window that is still too long keeps its newest points
+        int tier = selectHistoryTier(res_s);
+        uint32_t step = getHistoryStep(tier);
+        uint32_t newest = to_s - to_s % step;
+        if (newest >= (HISTORY_LIMIT - 1) * step && from_s < newest - (HISTORY_LIMIT - 1) * step) {
+            from_s = newest - (HISTORY_LIMIT - 1) * step;
+        }
+        uint32_t first;
+        uint32_t held = findHistory(tier, 0, UINT32_MAX, &first);
+        uint32_t oldest = held ? getHistory(tier, 0)->time : UINT32_MAX;
+        ArchiveQuery q = { .response = response, .len = 0, .step = step };
+
+        q.len = sprintf(response, "{\"type\":\"DataResponse\",\"action\":\"history\",\"step\":%u,\"data\":[", q.step);
+
+        // Points are [time, min, max, avg, heater fraction], the part older
+        // than the rollup tier is read from the archive
+        if (tier != HISTORY_RAW && from_s < oldest) {
+            ArchivePoint end = { .time = UINT32_MAX };
+            queryArchive(from_s, to_s < oldest ? to_s : oldest - 1, VisitArchive, &q);
+            VisitArchive(&end, &q);
+        }
+
+        uint32_t count = findHistory(tier, from_s, to_s, &first);
+        for (uint32_t i = 0; i < count && q.count < HISTORY_LIMIT; i++, q.count++) {
+            const HistoryPoint *point = getHistory(tier, first + i);
+            q.len += snprintf(response + q.len, TX_BUFFER_SIZE - q.len, "%s[%u,%.2f,%.2f,%.2f,%.2f]", q.count ? "," : "",
+                              point->time, point->min, point->max, point->avg, point->heater);
+        }
+        snprintf(response + q.len, TX_BUFFER_SIZE - q.len, "],\"count\":%u}", q.count);
+    }
+    else if (strcmp(action_str, "apply_scene") == 0) {
+        // Example: {"action":"apply_scene","scene":"SUN"}
+        static const char *names[] = { "tv", "heater", "lamp_floor", "lamp_ceil", "led_pwm" };
+        json_t *name = json_object_get(root, "scene");
+        const Scene *scene = json_is_string(name) ? findScene(json_string_value(name)) : NULL;
+
+        if (!scene) {
+            sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"apply_scene\",\"status\":\"Error\",\"message\":\"Unknown scene\"}");
+            return FALSE;
+        }
+
+        int32_t current[STATE_KEY_COUNT];
+        int32_t target[STATE_KEY_COUNT];
+        CollectState(current);
+        memcpy(target, current, sizeof(target));
+
+        int targets[] = { scene->tv, scene->heater, scene->lampFloor, scene->lampCeil, scene->ledPwm };
+        for (int key = STATE_TV; key <= STATE_LED_PWM; key++) {
+            if (targets[key] != SCENE_KEEP) {
+                target[key] = key == STATE_LED_PWM ? (targets[key] < 0 ? 0 : targets[key] > 100 ? 100 : targets[key])
+                                                   : (targets[key] != 0);
+            }
+        }
+
+        // Log only the differences, all of them in one batch (one version)
+        int len = sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"apply_scene\",\"status\":\"Success\",\"message\":\"Scene %s applied\",\"changed\":[",
+                          scene->name);
+        int changed = 0;
+        BeginStateBatch();
+
+        // A scene setting the heater overrides the thermostat, also when the
+        // heater already is in the state of the scene
+        if (scene->heater != SCENE_KEEP && getThermostatMode() != THERMOSTAT_OFF) {
+            setThermostat(THERMOSTAT_OFF, getThermostatSetpoint(), getThermostatHysteresis());
+            RecordState(STATE_THERMOSTAT, THERMOSTAT_OFF);
+            len += sprintf(response + len, "\"thermostat\"");
+            changed++;
+        }
+        for (int key = STATE_TV; key <= STATE_LED_PWM; key++) {
+            if (target[key] != current[key]) {
+                RecordState(key, target[key]);
+                len += sprintf(response + len, "%s\"%s\"", changed++ ? "," : "", names[key]);
+            }
+        }
+
+        if (changed) {
+            // TV and heater change with one masked GPIO write
+            dutyCycleLed = target[STATE_LED_PWM];
+            stateLampFloor = target[STATE_LAMP_FLOOR];
+            stateLampCeiling = target[STATE_LAMP_CEIL];
+            setWebhouseState(target[STATE_TV], target[STATE_HEATER],
+                             stateLampFloor ? (uint16_t)dutyCycleLed : 0,
+                             stateLampCeiling ? (uint16_t)dutyCycleLed : 0);
+        }
+        EndStateBatch();
+
+        // Inside an atomic batch the version is the one of the open batch
+        sprintf(response + len, "],\"version\":%u}", getWalSeq() + (isWalBatchOpen() ? 1 : 0));
+    }
+    else if (strcmp(action_str, "energy") == 0) {
+        // Example: {"action":"energy","period":"day","from":1700000000,"to":1700604800}
+        json_t *period = json_object_get(root, "period");
+        json_t *from = json_object_get(root, "from");
+        json_t *to = json_object_get(root, "to");
+
+        int p = json_is_string(period) && strcmp(json_string_value(period), "day") == 0 ? ENERGY_DAY : ENERGY_HOUR;
+        uint32_t step = getEnergyStep(p);
+        uint32_t to_s = json_is_integer(to) && json_integer_value(to) >= 0 ? (uint32_t)json_integer_value(to) : getClockTime();
+        uint32_t from_s = json_is_integer(from) && json_integer_value(from) >= 0 ? (uint32_t)json_integer_value(from)
+                                                                                 : to_s - (p == ENERGY_DAY ? 6 : 23) * step;
+
+        json_t *res = json_pack("{s:s,s:s,s:s,s:i}", "type", "DataResponse", "action", "energy",
+                                "period", p == ENERGY_DAY ? "day" : "hour", "step", (int)step);
+        json_t *watts = json_object();
+        json_t *data = json_array();
+        json_t *total = json_object();
+        double totalKwh[ENERGY_DEVICES] = { 0 };
+
+        for (int i = 0; i < ENERGY_DEVICES; i++) {
+            json_object_set_new(watts, getEnergyName(i), json_real(getEnergyWatts(i)));
+        }
+
+        // Every period lists on-time in seconds and energy in kWh per utility
+        uint32_t start = from_s - from_s % step;
+        for (int n = 0; start <= to_s && n < ENERGY_LIMIT; start += step, n++) {
+            EnergyUsage usage[ENERGY_DEVICES];
+            json_t *entry = json_pack("{s:i}", "start", (int)start);
+
+            getEnergyUsage(p, start, usage);
+            for (int i = 0; i < ENERGY_DEVICES; i++) {
+                double kwh = usage[i].dutySeconds * getEnergyWatts(i) / 3.6e6;
+                totalKwh[i] += kwh;
+                json_object_set_new(entry, getEnergyName(i), json_pack("{s:f,s:f}", "on", usage[i].onSeconds, "kwh", kwh));
+            }
+            json_array_append_new(data, entry);
+        }
+
+        for (int i = 0; i < ENERGY_DEVICES; i++) {
+            json_object_set_new(total, getEnergyName(i), json_real(totalKwh[i]));
+        }
+        json_object_set_new(res, "watts", watts);
+        json_object_set_new(res, "data", data);
+        json_object_set_new(res, "total", total);
+
+        // Six digits keep ENERGY_LIMIT periods within one response
+        char *res_str = json_dumps(res, JSON_COMPACT | JSON_REAL_PRECISION(6));
+        json_decref(res);
+        if (!res_str || strlen(res_str) >= TX_BUFFER_SIZE) {
+            FreeJsonText(res_str);
+            sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"energy\",\"status\":\"Error\",\"message\":\"JSON conversion failed\"}");
+            return FALSE;
+        }
+        snprintf(response, TX_BUFFER_SIZE, "%s", res_str);
+        FreeJsonText(res_str);
+    }
+    else if (strcmp(action_str, "subscribe") == 0) {
+        // Example: {"action":"subscribe","events":["alarm"]}, an empty list unsubscribes
+        json_t *events = json_object_get(root, "events");
+
+        if (!json_is_array(events)) {
+            sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"subscribe\",\"status\":\"Error\",\"message\":\"Missing or invalid events\"}");
+            return FALSE;
+        }
+
+        unsigned int subscriptions = 0;
+        size_t index;
+        json_t *value;
+        json_array_foreach(events, index, value) {
+            if (json_is_string(value) && strcmp(json_string_value(value), "alarm") == 0) {
+                subscriptions |= SUB_ALARM;
+            }
+            else if (json_is_string(value) && strcmp(json_string_value(value), "stats") == 0) {
+                subscriptions |= SUB_STATS;
+            }
+        }
+        conn->subscriptions = subscriptions;
+
+        sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"subscribe\",\"status\":\"Success\",\"message\":\"Subscribed\"}");
+    }
+    else if (strcmp(action_str, "metrics") == 0) {
+        // Example: {"action":"metrics"}, latency percentiles per action and phase
+        json_t *res = json_object();
+        json_object_set_new(res, "type", json_string("DataResponse"));
+        json_object_set_new(res, "action", json_string("metrics"));
+        json_object_set_new(res, "data", getMetricsJson());
+
+        char *res_str = json_dumps(res, JSON_COMPACT | JSON_REAL_PRECISION(6));
+        json_decref(res);
+        if (!res_str || strlen(res_str) >= TX_BUFFER_SIZE) {
+            FreeJsonText(res_str);
+            sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"metrics\",\"status\":\"Error\",\"message\":\"JSON conversion failed\"}");
+            return FALSE;
+        }
+        snprintf(response, TX_BUFFER_SIZE, "%s", res_str);
+        FreeJsonText(res_str);
     } else {
         sprintf(response, "{\"type\":\"CommandResponse\",\"action\":\"%s\",\"status\":\"Error\",\"message\":\"Invalid action\"}", action_str);
         return FALSE;
     }
 
-    json_decref(root);
     return TRUE;
 }
\ No newline at end of file
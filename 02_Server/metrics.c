@@ -0,0 +1,383 @@
+/*******************************************************************************
+ * @file       metrics.c
+ *******************************************************************************
+ *
+ * @brief      Latency histograms of the commands per action and phase.
+ *
+ * @details    Durations are counted in log-linear buckets in the style of
+ *             HdrHistogram: every power of two of nanoseconds is split into
+ *             2^METRICS_SUB_BITS linear buckets, so the relative error stays
+ *             below 12.5 % from nanoseconds to seconds at a fixed size.
+ *             Every thread counts into a shard of its own; a scrape merges
+ *             the shards. The histograms are exported as a Prometheus text
+ *             page with fixed bucket limits and as JSON with percentiles.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              getMetricTime
+ *              getMetricAction
+ *              getMetricActionName
+ *              recordMetric
+ *              formatMetricsText
+ *              getMetricsJson
+ *
+ *  Functions  local:
+ *              getShard
+ *              bucketIndex
+ *              bucketLimit
+ *              mergeShards
+ *              getPercentile
+ *              appendText
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "log.h"
+
+//----- Macros -----------------------------------------------------------------
+#define METRIC_ACTIONS (sizeof(actionNames) / sizeof(actionNames[0]))
+#define METRIC_OTHER (METRIC_ACTIONS - 1)
+
+//----- Data types -------------------------------------------------------------
+typedef struct {
+    uint32_t buckets[METRICS_BUCKETS];
+    uint64_t sum;                   // Nanoseconds
+    uint32_t count;
+} Histogram;
+
+typedef struct {
+    const char *le;                 // Label of the limit in seconds
+    uint64_t ns;
+} ExportLimit;
+
+typedef struct {
+    char *text;
+    size_t len;
+    size_t size;
+    int failed;                     // Set when memory ran out
+} Text;
+
+//----- Function prototypes ----------------------------------------------------
+static Histogram *getShard(void);
+static int bucketIndex(uint64_t ns);
+static uint64_t bucketLimit(int index);
+static void mergeShards(Histogram *merged);
+static uint64_t getPercentile(const Histogram *histogram, double percentile);
+static void appendText(Text *text, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+//----- Global variables -------------------------------------------------------
+static const char *actionNames[] = {
+    "read", "write", "toggle", "events", "history", "energy", "apply_scene",
+    "subscribe", "metrics", "batch", "invalid", "other"
+};
+static const char *phaseNames[METRIC_PHASES] = {
+    "recv", "unmask", "parse", "actuate", "serialize", "send", "total"
+};
+// Upper limits of the exported buckets, +Inf is added
+static const ExportLimit exportLimits[] = {
+    { "1e-05", 10000 }, { "2.5e-05", 25000 }, { "5e-05", 50000 },
+    { "0.0001", 100000 }, { "0.00025", 250000 }, { "0.0005", 500000 },
+    { "0.001", 1000000 }, { "0.0025", 2500000 }, { "0.005", 5000000 },
+    { "0.01", 10000000 }, { "0.025", 25000000 }, { "0.05", 50000000 },
+    { "0.1", 100000000 }, { "0.25", 250000000 }, { "0.5", 500000000 },
+    { "1", 1000000000 }, { "2.5", 2500000000ull }, { "5", 5000000000ull },
+    { "10", 10000000000ull }
+};
+
+static Histogram shards[METRICS_THREADS][METRIC_ACTIONS][METRIC_PHASES];
+static unsigned int shardCount = 0;     // Shards handed out, may exceed METRICS_THREADS
+static __thread Histogram (*threadShard)[METRIC_PHASES] = NULL;
+static __thread int threadHasNoShard = 0;
+
+/*******************************************************************************
+ * @brief    Returns the monotonic clock in nanoseconds.
+ ******************************************************************************/
+uint64_t getMetricTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*******************************************************************************
+ * @brief    Returns the histogram index of an action name, unknown names
+ *           (and NULL) share the index of "other".
+ ******************************************************************************/
+int getMetricAction(const char *name)
+{
+    for (size_t i = 0; name && i < METRIC_OTHER; i++) {
+        if (strcmp(name, actionNames[i]) == 0)
+            return (int)i;
+    }
+
+    return (int)METRIC_OTHER;
+}
+
+/*******************************************************************************
+ * @brief    Returns the name of an action index, "other" if it is unknown.
+ ******************************************************************************/
+const char *getMetricActionName(int action)
+{
+    if (action < 0 || action >= (int)METRIC_ACTIONS)
+        action = (int)METRIC_OTHER;
+
+    return actionNames[action];
+}
+
+/*******************************************************************************
+ * @brief    Counts a duration in the shard of the calling thread.
+ *
+ * @param    action  Index from getMetricAction.
+ * @param    phase   METRIC_* phase.
+ * @param    ns      Duration in nanoseconds.
+ ******************************************************************************/
+void recordMetric(int action, int phase, uint64_t ns)
+{
+    Histogram *shard = getShard();
+
+    if (!shard || action < 0 || action >= (int)METRIC_ACTIONS || phase < 0 || phase >= METRIC_PHASES)
+        return;
+
+    Histogram *histogram = &shard[action * METRIC_PHASES + phase];
+    __atomic_add_fetch(&histogram->buckets[bucketIndex(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->sum, ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+ * @brief    Formats the merged histograms as a Prometheus text page. Only
+ *           the series that counted a command are exported.
+ *
+ * @return   Page allocated with malloc, NULL if out of memory.
+ ******************************************************************************/
+char *formatMetricsText(void)
+{
+    static Histogram merged[METRIC_ACTIONS][METRIC_PHASES];
+    Text text = { NULL, 0, 0, 0 };
+
+    mergeShards(&merged[0][0]);
+
+    appendText(&text, "# HELP webhouse_command_duration_seconds Time spent per command action and phase.\n");
+    appendText(&text, "# TYPE webhouse_command_duration_seconds histogram\n");
+
+    for (size_t a = 0; a < METRIC_ACTIONS; a++) {
+        for (int p = 0; p < METRIC_PHASES; p++) {
+            const Histogram *histogram = &merged[a][p];
+            uint64_t cumulative = 0;
+            int bucket = 0;
+
+            if (histogram->count == 0)
+                continue;
+
+            // A bucket is counted below a limit if all its values are
+            for (size_t l = 0; l < sizeof(exportLimits) / sizeof(exportLimits[0]); l++) {
+                while (bucket < METRICS_BUCKETS && bucketLimit(bucket) <= exportLimits[l].ns) {
+                    cumulative += histogram->buckets[bucket++];
+                }
+                appendText(&text, "webhouse_command_duration_seconds_bucket{action=\"%s\",phase=\"%s\",le=\"%s\"} %llu\n",
+                           actionNames[a], phaseNames[p], exportLimits[l].le, (unsigned long long)cumulative);
+            }
+            appendText(&text, "webhouse_command_duration_seconds_bucket{action=\"%s\",phase=\"%s\",le=\"+Inf\"} %u\n",
+                       actionNames[a], phaseNames[p], histogram->count);
+            appendText(&text, "webhouse_command_duration_seconds_sum{action=\"%s\",phase=\"%s\"} %.9f\n",
+                       actionNames[a], phaseNames[p], histogram->sum / 1e9);
+            appendText(&text, "webhouse_command_duration_seconds_count{action=\"%s\",phase=\"%s\"} %u\n",
+                       actionNames[a], phaseNames[p], histogram->count);
+        }
+    }
+
+    appendText(&text, "# HELP webhouse_log_dropped_total Log messages dropped because a log ring was full.\n");
+    appendText(&text, "# TYPE webhouse_log_dropped_total counter\n");
+    appendText(&text, "webhouse_log_dropped_total %llu\n", (unsigned long long)getLogDropped());
+
+    if (text.failed) {
+        free(text.text);
+        return NULL;
+    }
+    return text.text;
+}
+
+/*******************************************************************************
+ * @brief    Returns count, mean, p50, p90, p99 and max in microseconds per
+ *           action and phase, only for series that counted a command.
+ ******************************************************************************/
+json_t *getMetricsJson(void)
+{
+    static Histogram merged[METRIC_ACTIONS][METRIC_PHASES];
+    json_t *root = json_object();
+
+    mergeShards(&merged[0][0]);
+
+    for (size_t a = 0; a < METRIC_ACTIONS; a++) {
+        json_t *phases = NULL;
+
+        for (int p = 0; p < METRIC_PHASES; p++) {
+            const Histogram *histogram = &merged[a][p];
+            if (histogram->count == 0)
+                continue;
+
+            json_t *series = json_object();
+            json_object_set_new(series, "count", json_integer(histogram->count));
+            json_object_set_new(series, "mean_us", json_real(histogram->sum / 1e3 / histogram->count));
+            json_object_set_new(series, "p50_us", json_real(getPercentile(histogram, 0.50) / 1e3));
+            json_object_set_new(series, "p90_us", json_real(getPercentile(histogram, 0.90) / 1e3));
+            json_object_set_new(series, "p99_us", json_real(getPercentile(histogram, 0.99) / 1e3));
+            json_object_set_new(series, "max_us", json_real(getPercentile(histogram, 1.0) / 1e3));
+
+            if (!phases)
+                phases = json_object();
+            json_object_set_new(phases, phaseNames[p], series);
+        }
+
+        if (phases)
+            json_object_set_new(root, actionNames[a], phases);
+    }
+
+    return root;
+}
+
+/*******************************************************************************
+ * @brief    Returns the histograms of the calling thread, assigned on its
+ *           first command. NULL if all shards are taken.
+ ******************************************************************************/
+static Histogram *getShard(void)
+{
+    if (!threadShard && !threadHasNoShard) {
+        unsigned int index = __atomic_fetch_add(&shardCount, 1, __ATOMIC_ACQ_REL);
+        if (index < METRICS_THREADS) {
+            threadShard = shards[index];
+        }
+        else {
+            threadHasNoShard = 1;
+            logWarn("No metrics shard left, durations of this thread are not counted");
+        }
+    }
+
+    return threadShard ? &threadShard[0][0] : NULL;
+}
+
+/*******************************************************************************
+ * @brief    Returns the bucket of a duration. Values below 2^SUB_BITS get a
+ *           bucket each, above the top bits select the power of two and the
+ *           next SUB_BITS bits the linear sub-bucket.
+ ******************************************************************************/
+static int bucketIndex(uint64_t ns)
+{
+    if (ns >= (1ull << METRICS_MAX_BITS))
+        return METRICS_BUCKETS - 1;
+    if (ns < (1u << METRICS_SUB_BITS))
+        return (int)ns;
+
+    int msb = 63 - __builtin_clzll(ns);
+    int shift = msb - METRICS_SUB_BITS;
+    return ((shift + 1) << METRICS_SUB_BITS) + (int)((ns >> shift) & ((1u << METRICS_SUB_BITS) - 1));
+}
+
+/*******************************************************************************
+ * @brief    Returns the largest duration counted in a bucket.
+ ******************************************************************************/
+static uint64_t bucketLimit(int index)
+{
+    if (index < (1 << METRICS_SUB_BITS))
+        return index;
+
+    int shift = (index >> METRICS_SUB_BITS) - 1;
+    uint64_t sub = (uint64_t)(index & ((1 << METRICS_SUB_BITS) - 1)) | (1u << METRICS_SUB_BITS);
+    return ((sub + 1) << shift) - 1;
+}
+
+/*******************************************************************************
+ * @brief    Adds up the histograms of all threads.
+ *
+ * @param    merged  METRIC_ACTIONS * METRIC_PHASES histograms.
+ ******************************************************************************/
+static void mergeShards(Histogram *merged)
+{
+    unsigned int count = __atomic_load_n(&shardCount, __ATOMIC_ACQUIRE);
+
+    if (count > METRICS_THREADS)
+        count = METRICS_THREADS;
+
+    memset(merged, 0, sizeof(Histogram) * METRIC_ACTIONS * METRIC_PHASES);
+    for (unsigned int t = 0; t < count; t++) {
+        const Histogram *shard = &shards[t][0][0];
+        for (size_t h = 0; h < METRIC_ACTIONS * METRIC_PHASES; h++) {
+            for (int b = 0; b < METRICS_BUCKETS; b++) {
+                merged[h].buckets[b] += __atomic_load_n(&shard[h].buckets[b], __ATOMIC_RELAXED);
+            }
+            merged[h].sum += __atomic_load_n(&shard[h].sum, __ATOMIC_RELAXED);
+            merged[h].count += __atomic_load_n(&shard[h].count, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*******************************************************************************
+ * @brief    Returns the upper limit of the bucket holding a percentile.
+ *
+ * @param    percentile  Fraction of the counted values, 1.0 for the max.
+ ******************************************************************************/
+static uint64_t getPercentile(const Histogram *histogram, double percentile)
+{
+    uint64_t rank = (uint64_t)(percentile * histogram->count + 0.5);
+    uint64_t cumulative = 0;
+
+    if (rank == 0)
+        rank = 1;
+
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+        cumulative += histogram->buckets[b];
+        if (cumulative >= rank)
+            return bucketLimit(b);
+    }
+
+    return bucketLimit(METRICS_BUCKETS - 1);
+}
+
+/*******************************************************************************
+ * @brief    Appends formatted text, growing the buffer as needed.
+ ******************************************************************************/
+static void appendText(Text *text, const char *format, ...)
+{
+    va_list args;
+
+    while (!text->failed) {
+        va_start(args, format);
+        int len = vsnprintf(text->text ? text->text + text->len : NULL,
+                            text->size - text->len, format, args);
+        va_end(args);
+
+        if (len < 0) {
+            text->failed = 1;
+        }
+        else if (text->len + len < text->size) {
+            text->len += len;
+            return;
+        }
+        else {
+            size_t size = text->size ? text->size * 2 : 4096;
+            while (size <= text->len + len)
+                size *= 2;
+            char *grown = realloc(text->text, size);
+            if (grown) {
+                text->text = grown;
+                text->size = size;
+            }
+            else {
+                text->failed = 1;
+            }
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+//-----Header-Files----------------------------------------------------------------
+#include <stdint.h>
+
+#include "jansson.h"
+
+//-----Macros----------------------------------------------------------------------
+// Phases of a command, METRIC_TOTAL covers the whole command
+#define METRIC_RECV         0       // recv() of the frame
+#define METRIC_UNMASK       1       // Frame decoding and unmasking
+#define METRIC_PARSE        2       // JSON parsing
+#define METRIC_ACTUATE      3       // Execution, including the GPIO access
+#define METRIC_SERIALIZE    4       // Response id and frame encoding
+#define METRIC_SEND         5       // send() or queueing for the group commit
+#define METRIC_TOTAL        6
+#define METRIC_PHASES       7
+
+// Log-linear buckets: 2^METRICS_SUB_BITS per power of two, up to 2^34 ns
+#define METRICS_SUB_BITS    3
+#define METRICS_MAX_BITS    34
+#define METRICS_BUCKETS     ((METRICS_MAX_BITS - METRICS_SUB_BITS + 1) << METRICS_SUB_BITS)
+#define METRICS_THREADS     4       // Threads that can record at the same time
+
+//-----Function prototypes---------------------------------------------------------
+extern uint64_t getMetricTime(void);
+extern int  getMetricAction(const char *name);
+extern const char *getMetricActionName(int action);
+extern void recordMetric(int action, int phase, uint64_t ns);
+extern char *formatMetricsText(void);
+extern json_t *getMetricsJson(void);
+
+#endif
@@ -0,0 +1,557 @@
+/*******************************************************************************
+ * @file       microbench.c
+ *******************************************************************************
+ *
+ * @brief      Microbenchmarks of the WebSocket codec and the command path.
+ *
+ * @details    Includes main.c to reach its local functions, main is renamed
+ *             to webhouseMain. The GPIO access runs in the bcm2835 debug
+ *             mode, its register dumps and the log go to /dev/null, and the
+ *             server files are created in a temporary directory. Every
+ *             benchmark grows its iteration count until it ran for the
+ *             minimum time, then reports ns/op, allocations/op and bytes
+ *             copied/op. Allocations are counted by replacing malloc,
+ *             copies by wrapping memcpy, memmove, strcpy and strcat at link
+ *             time; copies inlined by the compiler or made inside jansson
+ *             are not seen. Only the calls of the benchmark thread count.
+ *
+ *             microbench [-f filter] [-t seconds] [-j file.json]
+ *
+ *             The JSON file has the layout of Google Benchmark, so the
+ *             usual comparison scripts can track it commit over commit.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              main
+ *              malloc
+ *              calloc
+ *              realloc
+ *              free
+ *              __wrap_memcpy
+ *              __wrap_memmove
+ *              __wrap_strcpy
+ *              __wrap_strcat
+ *
+ *  Functions  local:
+ *              pauseTiming
+ *              resumeTiming
+ *              getThreadTime
+ *              runBenchmark
+ *              setupServer
+ *              benchHandshake
+ *              benchDecode
+ *              benchEncode
+ *              benchBase64
+ *              benchSha1
+ *              benchCommand
+ *              benchThermal
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#define main webhouseMain
+#include "main.c"
+#undef main
+
+#include <fcntl.h>
+
+#include "base64.h"
+#include "sha1.h"
+#include "thermsim.h"
+#include "harness.h"
+
+//----- Macros -----------------------------------------------------------------
+#define BENCH_MIN_SECONDS 0.2       // Default minimum run time per benchmark
+#define BENCH_MAX_ITERATIONS 100000000L
+#define BENCH_CHUNK 256             // Iterations prepared at once, untimed
+#define BENCH_ROOMS 8               // Rooms per house of the thermal benchmarks
+
+#define HANDSHAKE_SAMPLE "GET /chat HTTP/1.1\r\nHost: server.example.com\r\nUpgrade: websocket\r\n" \
+                         "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" \
+                         "Sec-WebSocket-Version: 13\r\n\r\n"
+
+//----- Data types -------------------------------------------------------------
+typedef struct Benchmark Benchmark;
+struct Benchmark {
+    const char *name;
+    void (*run)(const Benchmark *bench, long iterations);
+    const char *input;          // Command or payload of the benchmark
+    int size;                   // Payload size, 0 for the length of input
+};
+
+typedef struct {
+    long iterations;
+    double ns;                  // Wall clock per iteration
+    double cpu_ns;              // Thread CPU time per iteration
+    double allocs;
+    double copied;
+} BenchResult;
+
+//----- Function prototypes ----------------------------------------------------
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__real_memcpy(void *dest, const void *src, size_t n);
+extern void *__real_memmove(void *dest, const void *src, size_t n);
+extern char *__real_strcpy(char *dest, const char *src);
+extern char *__real_strcat(char *dest, const char *src);
+
+static void pauseTiming(void);
+static void resumeTiming(void);
+static uint64_t getThreadTime(void);
+static void runBenchmark(const Benchmark *bench, double minSeconds, BenchResult *result);
+static int  setupServer(char *directory);
+static void benchHandshake(const Benchmark *bench, long iterations);
+static void benchDecode(const Benchmark *bench, long iterations);
+static void benchEncode(const Benchmark *bench, long iterations);
+static void benchBase64(const Benchmark *bench, long iterations);
+static void benchSha1(const Benchmark *bench, long iterations);
+static void benchCommand(const Benchmark *bench, long iterations);
+static void benchThermal(const Benchmark *bench, long iterations);
+
+//----- Global variables -------------------------------------------------------
+static __thread int counting = FALSE;   // TRUE while the calling thread is timed
+static __thread uint64_t allocations = 0;
+static __thread uint64_t bytesCopied = 0;
+
+static uint64_t timedNs = 0;            // Timed wall clock of the current run
+static uint64_t timedCpuNs = 0;
+static uint64_t resumedAt = 0;
+static uint64_t resumedCpuAt = 0;
+
+static char largePayload[16000];        // Filler of the large frames
+
+static const Benchmark benchmarks[] = {
+    { "get_handshake_response", benchHandshake, HANDSHAKE_SAMPLE, 0 },
+    { "decode_incoming_request/small", benchDecode, "{\"action\":\"read\",\"utilities\":[\"tv\",\"heater\",\"temperature\"]}", 0 },
+    { "decode_incoming_request/4k", benchDecode, NULL, RX_BUFFER_SIZE - 16 },
+    { "code_outgoing_response/small", benchEncode, "{\"type\":\"CommandResponse\",\"action\":\"toggle\",\"status\":\"Success\",\"message\":\"TV is now ON\"}", 0 },
+    { "code_outgoing_response/16k", benchEncode, NULL, sizeof(largePayload) - 1 },
+    { "base64_encode/20", benchBase64, NULL, SHA1HashSize },
+    { "base64_encode/1k", benchBase64, NULL, 1024 },
+    { "sha1/60", benchSha1, NULL, 60 },
+    { "sha1/4k", benchSha1, NULL, 4096 },
+    { "processCommand/read", benchCommand, "{\"action\":\"read\",\"utilities\":[\"tv\",\"heater\",\"temperature\",\"alarm\",\"lamp_floor\",\"lamp_ceil\",\"led_pwm\"]}", 0 },
+    { "processCommand/read_stats", benchCommand, "{\"action\":\"read\",\"utilities\":[\"stats\"]}", 0 },
+    { "processCommand/read_id", benchCommand, "{\"id\":\"c-42\",\"action\":\"read\",\"utilities\":[\"tv\"]}", 0 },
+    { "processCommand/write", benchCommand, "{\"action\":\"write\",\"utility\":\"led_pwm\",\"value\":40}", 0 },
+    { "processCommand/write_setpoint", benchCommand, "{\"action\":\"write\",\"utility\":\"setpoint\",\"value\":21.5}", 0 },
+    { "processCommand/toggle", benchCommand, "{\"action\":\"toggle\",\"utility\":\"lamp_floor\"}", 0 },
+    { "processCommand/events", benchCommand, "{\"action\":\"events\",\"limit\":64}", 0 },
+    { "processCommand/history", benchCommand, "{\"action\":\"history\"}", 0 },
+    { "processCommand/energy", benchCommand, "{\"action\":\"energy\",\"period\":\"hour\"}", 0 },
+    { "processCommand/apply_scene", benchCommand, "{\"action\":\"apply_scene\",\"scene\":\"SUN\"}", 0 },
+    { "processCommand/subscribe", benchCommand, "{\"action\":\"subscribe\",\"events\":[\"alarm\"]}", 0 },
+    { "processCommand/metrics", benchCommand, "{\"action\":\"metrics\"}", 0 },
+    { "processCommand/batch", benchCommand, "[{\"action\":\"read\",\"utilities\":[\"tv\"]},{\"action\":\"toggle\",\"utility\":\"tv\"},"
+                                            "{\"action\":\"write\",\"utility\":\"led_pwm\",\"value\":10}]", 0 },
+    { "processCommand/invalid", benchCommand, "{\"action\":", 0 },
+    { "stepThermalSim/1x8", benchThermal, NULL, 1 },
+    { "stepThermalSim/1000x8", benchThermal, NULL, 1000 },
+    { "stepThermalSim/10000x8", benchThermal, NULL, 10000 },
+};
+
+/*******************************************************************************
+ * @brief    Runs the benchmarks matching the filter and prints a table, and
+ *           optionally writes the results as JSON.
+ ******************************************************************************/
+int main(int argc, char **argv)
+{
+    const char *filter = NULL;
+    const char *jsonFile = NULL;
+    double minSeconds = BENCH_MIN_SECONDS;
+    char directory[] = "/tmp/microbench.XXXXXX";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:t:j:")) != -1) {
+        switch (opt) {
+        case 'f': filter = optarg; break;
+        case 't': minSeconds = atof(optarg); break;
+        case 'j': jsonFile = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-f filter] [-t seconds] [-j file.json]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // The report goes to the original stdout, the GPIO dumps and the log
+    // of the server to /dev/null
+    FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+    int errors = dup(STDERR_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    if (!report || errors < 0 || devNull < 0) {
+        perror("microbench");
+        return 1;
+    }
+    dup2(devNull, STDOUT_FILENO);
+    dup2(devNull, STDERR_FILENO);
+    if (setupServer(directory) < 0) {
+        dprintf(errors, "microbench: setup failed: %s\n", strerror(errno));
+        return 1;
+    }
+    memset(largePayload, 'x', sizeof(largePayload) - 1);
+
+    json_t *results = json_array();
+    fprintf(report, "%-34s %12s %12s %12s %14s\n", "benchmark", "iterations", "ns/op", "allocs/op", "bytes copied/op");
+
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        const Benchmark *bench = &benchmarks[i];
+        BenchResult result;
+
+        if (filter && !strstr(bench->name, filter))
+            continue;
+
+        runBenchmark(bench, minSeconds, &result);
+        fprintf(report, "%-34s %12ld %12.1f %12.2f %14.1f\n", bench->name, result.iterations,
+                result.ns, result.allocs, result.copied);
+        fflush(report);
+
+        json_array_append_new(results, json_pack("{s:s, s:s, s:I, s:f, s:f, s:s, s:f, s:f}",
+                                                 "name", bench->name,
+                                                 "run_type", "iteration",
+                                                 "iterations", (json_int_t)result.iterations,
+                                                 "real_time", result.ns,
+                                                 "cpu_time", result.cpu_ns,
+                                                 "time_unit", "ns",
+                                                 "allocs_per_op", result.allocs,
+                                                 "bytes_copied_per_op", result.copied));
+    }
+
+    if (jsonFile) {
+        char date[32];
+        char host[64] = "";
+        time_t now = time(NULL);
+
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+        gethostname(host, sizeof(host) - 1);
+        json_t *root = json_pack("{s:{s:s, s:s, s:s, s:i, s:f}, s:o}",
+                                 "context",
+                                     "date", date,
+                                     "host_name", host,
+                                     "executable", argv[0],
+                                     "num_cpus", (int)sysconf(_SC_NPROCESSORS_ONLN),
+                                     "min_time", minSeconds,
+                                 "benchmarks", results);
+        if (!root || json_dump_file(root, jsonFile, JSON_INDENT(2)) < 0) {
+            dprintf(errors, "microbench: cannot write %s\n", jsonFile);
+        }
+        json_decref(root);
+    }
+    else {
+        json_decref(results);
+    }
+
+    closeHarness(directory);
+    fclose(report);
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Counts an allocation of the benchmark thread while it is timed.
+ ******************************************************************************/
+void *malloc(size_t size)
+{
+    if (counting)
+        allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    if (counting)
+        allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (counting)
+        allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+/*******************************************************************************
+ * @brief    Counts the bytes copied by the benchmark thread while it is
+ *           timed. Linked with -Wl,--wrap=<function>.
+ ******************************************************************************/
+void *__wrap_memcpy(void *dest, const void *src, size_t n)
+{
+    if (counting)
+        bytesCopied += n;
+    return __real_memcpy(dest, src, n);
+}
+
+void *__wrap_memmove(void *dest, const void *src, size_t n)
+{
+    if (counting)
+        bytesCopied += n;
+    return __real_memmove(dest, src, n);
+}
+
+char *__wrap_strcpy(char *dest, const char *src)
+{
+    if (counting)
+        bytesCopied += strlen(src) + 1;
+    return __real_strcpy(dest, src);
+}
+
+char *__wrap_strcat(char *dest, const char *src)
+{
+    if (counting)
+        bytesCopied += strlen(src) + 1;
+    return __real_strcat(dest, src);
+}
+
+/*******************************************************************************
+ * @brief    Stops the clocks and the counters, e.g. while the input of the
+ *           next iterations is prepared.
+ ******************************************************************************/
+static void pauseTiming(void)
+{
+    counting = FALSE;
+    timedNs += getMetricTime() - resumedAt;
+    timedCpuNs += getThreadTime() - resumedCpuAt;
+}
+
+/*******************************************************************************
+ * @brief    Restarts the clocks and the counters.
+ ******************************************************************************/
+static void resumeTiming(void)
+{
+    resumedCpuAt = getThreadTime();
+    resumedAt = getMetricTime();
+    counting = TRUE;
+}
+
+/*******************************************************************************
+ * @brief    Returns the CPU time of the calling thread in nanoseconds.
+ ******************************************************************************/
+static uint64_t getThreadTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*******************************************************************************
+ * @brief    Runs a benchmark with growing iteration counts until it took
+ *           the minimum time.
+ ******************************************************************************/
+static void runBenchmark(const Benchmark *bench, double minSeconds, BenchResult *result)
+{
+    long iterations = 1;
+
+    for (;;) {
+        timedNs = 0;
+        timedCpuNs = 0;
+        allocations = 0;
+        bytesCopied = 0;
+
+        resumeTiming();
+        bench->run(bench, iterations);
+        pauseTiming();
+
+        if (timedNs >= minSeconds * 1e9 || iterations >= BENCH_MAX_ITERATIONS)
+            break;
+
+        // Aim for the minimum time, growing at least twofold and at most tenfold
+        double factor = timedNs > 0 ? minSeconds * 1e9 * 1.2 / timedNs : 10.0;
+        iterations = (long)(iterations * (factor < 2.0 ? 2.0 : factor > 10.0 ? 10.0 : factor));
+    }
+
+    result->iterations = iterations;
+    result->ns = (double)timedNs / iterations;
+    result->cpu_ns = (double)timedCpuNs / iterations;
+    result->allocs = (double)allocations / iterations;
+    result->copied = (double)bytesCopied / iterations;
+}
+
+/*******************************************************************************
+ * @brief    Initializes the server state like main does, without sockets.
+ *           The files are created in a new temporary directory.
+ *
+ * @return   0 if successful, -1 otherwise.
+ ******************************************************************************/
+static int setupServer(char *directory)
+{
+    initArena(NULL, NULL);
+    if (openHarness(directory, NULL) < 0)
+        return -1;
+
+    InitWebhouseUtilities();
+    openAlarmLog(ALARM_LOG_FILE);
+    openArchive(ARCHIVE_FILE);
+
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        connections[i].sock_id = -1;
+    }
+    InitTimers();
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    get_handshake_response, which tokenizes the request in place.
+ *           The copies of the request are made untimed, BENCH_CHUNK at once.
+ ******************************************************************************/
+static void benchHandshake(const Benchmark *bench, long iterations)
+{
+    static char requests[BENCH_CHUNK][sizeof(HANDSHAKE_SAMPLE)];
+    char response[256];
+
+    for (long done = 0; done < iterations; ) {
+        int chunk = iterations - done < BENCH_CHUNK ? (int)(iterations - done) : BENCH_CHUNK;
+
+        pauseTiming();
+        for (int i = 0; i < chunk; i++) {
+            __real_memcpy(requests[i], bench->input, sizeof(HANDSHAKE_SAMPLE));
+        }
+        resumeTiming();
+
+        for (int i = 0; i < chunk; i++) {
+            get_handshake_response(requests[i], response);
+        }
+        done += chunk;
+    }
+}
+
+/*******************************************************************************
+ * @brief    decode_incoming_request of a masked client frame.
+ ******************************************************************************/
+static void benchDecode(const Benchmark *bench, long iterations)
+{
+    static char frame[RX_BUFFER_SIZE + WS_FRAME_HDR_MAX];
+    static char request[RX_BUFFER_SIZE];
+    const char *payload = bench->input ? bench->input : largePayload;
+    int len = bench->size ? bench->size : (int)strlen(payload);
+    int header;
+
+    pauseTiming();
+    frame[0] = (char)0x81;
+    if (len < 126) {
+        frame[1] = (char)(0x80 | len);
+        header = 2;
+    }
+    else {
+        frame[1] = (char)(0x80 | 126);
+        frame[2] = (char)(len >> 8);
+        frame[3] = (char)len;
+        header = 4;
+    }
+    const char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    __real_memcpy(frame + header, mask, sizeof(mask));
+    for (int i = 0; i < len; i++) {
+        frame[header + 4 + i] = payload[i] ^ mask[i % 4];
+    }
+    resumeTiming();
+
+    for (long i = 0; i < iterations; i++) {
+        decode_incoming_request(frame, request, header + 4 + len);
+    }
+}
+
+/*******************************************************************************
+ * @brief    code_outgoing_response of a text frame.
+ ******************************************************************************/
+static void benchEncode(const Benchmark *bench, long iterations)
+{
+    static char response[sizeof(largePayload)];
+    static char coded[sizeof(largePayload) + WS_FRAME_HDR_MAX];
+
+    pauseTiming();
+    if (bench->input)
+        snprintf(response, sizeof(response), "%s", bench->input);
+    else
+        snprintf(response, sizeof(response), "%.*s", bench->size, largePayload);
+    resumeTiming();
+
+    for (long i = 0; i < iterations; i++) {
+        code_outgoing_response(response, coded);
+    }
+}
+
+/*******************************************************************************
+ * @brief    base64_encode, including the free of the returned buffer.
+ ******************************************************************************/
+static void benchBase64(const Benchmark *bench, long iterations)
+{
+    size_t out_len;
+
+    for (long i = 0; i < iterations; i++) {
+        free(base64_encode((const unsigned char *)largePayload, bench->size, &out_len));
+    }
+}
+
+/*******************************************************************************
+ * @brief    SHA-1 digest of a message: SHA1Reset, SHA1Input, SHA1Result.
+ ******************************************************************************/
+static void benchSha1(const Benchmark *bench, long iterations)
+{
+    SHA1Context context;
+    uint8_t digest[SHA1HashSize];
+
+    for (long i = 0; i < iterations; i++) {
+        SHA1Reset(&context);
+        SHA1Input(&context, (const uint8_t *)largePayload, bench->size);
+        SHA1Result(&context, digest);
+    }
+}
+
+/*******************************************************************************
+ * @brief    processCommand of one command on the first connection slot,
+ *           from parsing to the finished response.
+ ******************************************************************************/
+static void benchCommand(const Benchmark *bench, long iterations)
+{
+    static char response[TX_BUFFER_SIZE];
+    char command[512];
+    CommandInfo info;
+
+    pauseTiming();
+    snprintf(command, sizeof(command), "%s", bench->input);
+    resumeTiming();
+
+    for (long i = 0; i < iterations; i++) {
+        processCommand(&connections[0], command, response, &info);
+    }
+}
+
+/*******************************************************************************
+ * @brief    One second step of the thermal model of bench->size houses with
+ *           BENCH_ROOMS rooms each, every other heater on.
+ ******************************************************************************/
+static void benchThermal(const Benchmark *bench, long iterations)
+{
+    ThermalSim sim;
+
+    pauseTiming();
+    if (initThermalSim(&sim, (int)bench->size, BENCH_ROOMS, 16.0f) < 0) {
+        resumeTiming();
+        return;
+    }
+    for (int house = 0; house < sim.houses; house++) {
+        setThermalOutdoor(&sim, house, 5.0f);
+        setThermalHeater(&sim, house, house % BENCH_ROOMS, (float)(house & 1));
+    }
+    resumeTiming();
+
+    for (long i = 0; i < iterations; i++) {
+        stepThermalSim(&sim, 1.0f);
+    }
+
+    pauseTiming();
+    closeThermalSim(&sim);
+    resumeTiming();
+}
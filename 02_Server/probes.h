@@ -0,0 +1,40 @@
+#ifndef PROBES_H_
+#define PROBES_H_
+
+// Static tracepoints (USDT) of the provider "webhouse". A probe is a single
+// nop plus an ELF note, it costs nothing until a tracer attaches, e.g.
+//   bpftrace -e 'usdt:./Template:webhouse:command_done { @[str(arg1)] = hist(arg2); }'
+//
+//   conn_accept      (conn, fd)
+//   conn_close       (conn, lifetime_ns)
+//   handshake        (result)                  result of get_handshake_response
+//   frame_decoded    (conn, length, unmask_ns)
+//   command_parsed   (conn, action, parse_ns)  action name of the metrics, a string
+//   command_done     (conn, action, total_ns)
+//   gpio_write       (pin, level)              (mask, value) for mask writes, PWM edges excluded
+//   pwm_edge_late    (lamp, period_us)         0 stand lamp, 1 roof lamp
+//   state_persisted  (seq, sync_ns)            write-ahead log synced
+//
+// Without <sys/sdt.h> (systemtap-sdt-dev) or with -DWEBHOUSE_NO_PROBES the
+// probes compile to nothing.
+
+//-----Header-Files----------------------------------------------------------------
+#if defined(__has_include) && !defined(WEBHOUSE_NO_PROBES)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define WEBHOUSE_PROBES
+#endif
+#endif
+
+//-----Macros----------------------------------------------------------------------
+#ifdef WEBHOUSE_PROBES
+#define PROBE1(name, a)         DTRACE_PROBE1(webhouse, name, a)
+#define PROBE2(name, a, b)      DTRACE_PROBE2(webhouse, name, a, b)
+#define PROBE3(name, a, b, c)   DTRACE_PROBE3(webhouse, name, a, b, c)
+#else
+#define PROBE1(name, a)         do { } while (0)
+#define PROBE2(name, a, b)      do { } while (0)
+#define PROBE3(name, a, b, c)   do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,118 @@
+/*******************************************************************************
+ * @file       scenes.c
+ *******************************************************************************
+ *
+ * @brief      Named scene presets of the Webhouse utilities.
+ *
+ * @details    A scene holds target states for the TV, the heater, both lamps
+ *             and the dim level. The built-in scenes match the buttons of
+ *             the web page, a JSON file can redefine them or add new ones:
+ *             {"NAME":{"tv":1,"heater":0,"lamp_floor":1,"lamp_ceil":0,
+ *             "led_pwm":40}, ...}. Omitted utilities are left unchanged.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              loadScenes
+ *              findScene
+ *              getSceneCount
+ *              getScene
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "jansson.h"
+#include "scenes.h"
+
+//----- Global variables -------------------------------------------------------
+static Scene scenes[SCENE_MAX] = {
+    // name     tv          heater      floor  ceil  pwm
+    { "SUN",    0,          0,          0,     0,    0  },
+    { "CLOUD",  SCENE_KEEP, SCENE_KEEP, 0,     1,    50 },
+    { "RAIN",   1,          1,          1,     1,    60 },
+    { "SNOW",   0,          1,          1,     1,    80 },
+    { "GHOST",  0,          0,          1,     0,    5  },
+};
+static int sceneCount = 5;
+
+/*******************************************************************************
+ * @brief    Loads scenes from a JSON file. Scenes with the name of an
+ *           existing one replace it, others are added.
+ *
+ * @param    filename  Path of the JSON file.
+ * @return   Number of loaded scenes, -1 if the file could not be read.
+ ******************************************************************************/
+int loadScenes(const char *filename)
+{
+    json_error_t error;
+    json_t *root = json_load_file(filename, 0, &error);
+    const char *name;
+    json_t *value;
+    int loaded = 0;
+
+    if (!root)
+        return -1;
+
+    json_object_foreach(root, name, value) {
+        Scene *scene = (Scene *)findScene(name);
+        static const char *fields[] = { "tv", "heater", "lamp_floor", "lamp_ceil", "led_pwm" };
+
+        if (!json_is_object(value) || strlen(name) >= SCENE_NAME_SIZE)
+            continue;
+        if (!scene) {
+            if (sceneCount == SCENE_MAX)
+                break;
+            scene = &scenes[sceneCount++];
+            snprintf(scene->name, sizeof(scene->name), "%s", name);
+        }
+
+        int *targets[] = { &scene->tv, &scene->heater, &scene->lampFloor, &scene->lampCeil, &scene->ledPwm };
+        for (int i = 0; i < 5; i++) {
+            json_t *target = json_object_get(value, fields[i]);
+            *targets[i] = json_is_integer(target) ? (int)json_integer_value(target) : SCENE_KEEP;
+        }
+        loaded++;
+    }
+
+    json_decref(root);
+    return loaded;
+}
+
+/*******************************************************************************
+ * @brief    Finds a scene by name, ignoring case.
+ *
+ * @return   The scene, NULL if there is none with this name.
+ ******************************************************************************/
+const Scene *findScene(const char *name)
+{
+    for (int i = 0; i < sceneCount; i++) {
+        if (strcasecmp(scenes[i].name, name) == 0)
+            return &scenes[i];
+    }
+
+    return NULL;
+}
+
+/*******************************************************************************
+ * @brief    Returns the number of scenes.
+ ******************************************************************************/
+int getSceneCount(void)
+{
+    return sceneCount;
+}
+
+/*******************************************************************************
+ * @brief    Returns a scene by index.
+ ******************************************************************************/
+const Scene *getScene(int index)
+{
+    return &scenes[index];
+}
@@ -0,0 +1,29 @@
+#ifndef SCENES_H_
+#define SCENES_H_
+
+//-----Header-Files----------------------------------------------------------------
+#include <stdint.h>
+
+//-----Macros----------------------------------------------------------------------
+#define SCENE_NAME_SIZE     16
+#define SCENE_MAX           16
+#define SCENE_KEEP          (-1)    // Target that leaves the utility unchanged
+
+//-----Data types------------------------------------------------------------------
+// Target states of a scene, SCENE_KEEP for utilities the scene does not touch
+typedef struct {
+    char name[SCENE_NAME_SIZE];
+    int tv;
+    int heater;
+    int lampFloor;
+    int lampCeil;
+    int ledPwm;             // Dim level of the lamps [0,100]
+} Scene;
+
+//-----Function prototypes---------------------------------------------------------
+extern int  loadScenes(const char *filename);
+extern const Scene *findScene(const char *name);
+extern int  getSceneCount(void);
+extern const Scene *getScene(int index);
+
+#endif
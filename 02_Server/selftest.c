@@ -0,0 +1,717 @@
+/*******************************************************************************
+ * @file       selftest.c
+ *******************************************************************************
+ *
+ * @brief      Functional checks of the command handling.
+ *
+ * @details    Includes main.c to reach its local functions, main is renamed
+ *             to webhouseMain. The GPIO access runs in the bcm2835 debug
+ *             mode, the clock is virtual and the server files are created
+ *             in a temporary directory. The timer wheel is stepped through
+ *             two hours of virtual time first, so the temperature history
+ *             is filled the way a running server fills it. Every check
+ *             prints "ok" or "FAIL" with the reason.
+ *
+ *             selftest [-f filter]
+ *
+ *             The exit code is 0 if all checks passed, 1 otherwise.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              main
+ *
+ *  Functions  local:
+ *              setupServer
+ *              runCommand
+ *              failCheck
+ *              openClient
+ *              sendText
+ *              receiveText
+ *              checkHistoryDefault
+ *              checkHistoryNewest
+ *              checkWindowsLimit
+ *              checkOrderAfterWrite
+ *              checkSceneThermostat
+ *              checkThermostatLimits
+ *              checkLongIdAck
+ *              limitFileSize
+ *              checkAckHeldUntilSynced
+ *              checkRefusedWhenLogFull
+ *              checkEnergyLimit
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#define main webhouseMain
+#include "main.c"
+#undef main
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "harness.h"
+
+//----- Macros -----------------------------------------------------------------
+#define SELFTEST_WARMUP_S 7200      // Virtual seconds run before the checks
+#define SELFTEST_SLOT 1             // Connection slot of the socket client
+
+//----- Data types -------------------------------------------------------------
+typedef struct {
+    const char *name;
+    int (*run)(void);           // TRUE if the check passed
+} Check;
+
+//----- Function prototypes ----------------------------------------------------
+static int  setupServer(char *directory);
+static json_t *runCommand(const char *command);
+static int  failCheck(const char *format, ...);
+static int  openClient(void);
+static void sendText(int fd, const char *text);
+static json_t *receiveText(int fd);
+static int  checkHistoryDefault(void);
+static int  checkHistoryNewest(void);
+static int  checkWindowsLimit(void);
+static int  checkOrderAfterWrite(void);
+static int  checkSceneThermostat(void);
+static int  checkThermostatLimits(void);
+static int  checkLongIdAck(void);
+static void limitFileSize(rlim_t size);
+static int  checkAckHeldUntilSynced(void);
+static int  checkRefusedWhenLogFull(void);
+static int  checkEnergyLimit(void);
+
+//----- Global variables -------------------------------------------------------
+static FILE *report;                // Original stdout
+
+static const Check checks[] = {
+    { "history/default_window", checkHistoryDefault },
+    { "history/keeps_newest", checkHistoryNewest },
+    { "read/windows_limit", checkWindowsLimit },
+    { "order/read_after_write", checkOrderAfterWrite },
+    { "scene/heater_stops_thermostat", checkSceneThermostat },
+    { "thermostat/limits", checkThermostatLimits },
+    { "order/long_id_ack", checkLongIdAck },
+    { "wal/ack_held_until_synced", checkAckHeldUntilSynced },
+    { "wal/refused_when_log_full", checkRefusedWhenLogFull },
+    { "energy/limit_fits", checkEnergyLimit },
+};
+
+/*******************************************************************************
+ * @brief    Runs the checks matching the filter.
+ ******************************************************************************/
+int main(int argc, char **argv)
+{
+    const char *filter = NULL;
+    char directory[] = "/tmp/selftest.XXXXXX";
+    int failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:")) != -1) {
+        switch (opt) {
+        case 'f': filter = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-f filter]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // The report goes to the original stdout, the GPIO dumps and the log
+    // of the server to /dev/null
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    int errors = dup(STDERR_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    if (!report || errors < 0 || devNull < 0) {
+        perror("selftest");
+        return 1;
+    }
+    dup2(devNull, STDOUT_FILENO);
+    dup2(devNull, STDERR_FILENO);
+    close(devNull);
+    signal(SIGPIPE, SIG_IGN);
+    if (setupServer(directory) < 0) {
+        dprintf(errors, "selftest: setup failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        if (filter && !strstr(checks[i].name, filter))
+            continue;
+
+        fprintf(report, "%-32s ", checks[i].name);
+        fflush(report);
+        if (checks[i].run()) {
+            fprintf(report, "ok\n");
+        }
+        else {
+            failed++;
+        }
+        fflush(report);
+    }
+
+    closeHarness(directory);
+    fclose(report);
+    return failed ? 1 : 0;
+}
+
+/*******************************************************************************
+ * @brief    Starts the server on a virtual clock in a temporary directory and
+ *           runs it for SELFTEST_WARMUP_S seconds.
+ ******************************************************************************/
+static int setupServer(char *directory)
+{
+    initArena(NULL, NULL);
+    if (openHarness(directory, "virtual") < 0)
+        return -1;
+
+    InitWebhouseUtilities();
+    openAlarmLog(ALARM_LOG_FILE);
+    openArchive(ARCHIVE_FILE);
+
+    // AcceptConnection registers the connections, nobody waits on them
+    epoll_id = epoll_create1(0);
+    if (epoll_id < 0)
+        return -1;
+
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        connections[i].sock_id = -1;
+    }
+    InitTimers();
+
+    for (uint64_t tick = 0; tick < SELFTEST_WARMUP_S * 1000ull / TW_TICK_MS; tick++) {
+        stepTimerWheel();
+        CommitResponses();
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Processes a command on the first connection slot and parses the
+ *           response.
+ *
+ * @return   The response, NULL if it is no JSON object.
+ ******************************************************************************/
+static json_t *runCommand(const char *command)
+{
+    static char response[TX_BUFFER_SIZE];
+    char buffer[RX_BUFFER_SIZE];
+    CommandInfo info;
+
+    snprintf(buffer, sizeof(buffer), "%s", command);
+    processCommand(&connections[0], buffer, response, &info);
+
+    json_t *root = json_loads(response, 0, NULL);
+    if (!json_is_object(root)) {
+        json_decref(root);
+        return NULL;
+    }
+    return root;
+}
+
+/*******************************************************************************
+ * @brief    Reports why a check failed.
+ *
+ * @return   FALSE, so a check can return it.
+ ******************************************************************************/
+static int failCheck(const char *format, ...)
+{
+    va_list args;
+
+    fprintf(report, "FAIL: ");
+    va_start(args, format);
+    vfprintf(report, format, args);
+    va_end(args);
+    fprintf(report, "\n");
+
+    return FALSE;
+}
+
+/*******************************************************************************
+ * @brief    Connects a client through a socket pair, the server side takes
+ *           the slot SELFTEST_SLOT with the handshake done.
+ *
+ * @return   Socket of the client, -1 on failure.
+ ******************************************************************************/
+static int openClient(void)
+{
+    Connection *conn = &connections[SELFTEST_SLOT];
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        return -1;
+
+    conn->sock_id = fds[0];
+    conn->handshake_done = TRUE;
+    conn->rx_len = 0;
+    conn->pending_len = 0;
+    conn->subscriptions = 0;
+    conn->ledWrites = 0;
+    conn->ledWriteId = NULL;
+    conn->opened = getMetricTime();
+    initTimer(&conn->ping, PingTimerExpired, conn);
+    initTimer(&conn->idle, IdleTimerExpired, conn);
+
+    return fds[1];
+}
+
+/*******************************************************************************
+ * @brief    Sends a masked text frame that fits the receive buffer.
+ ******************************************************************************/
+static void sendText(int fd, const char *text)
+{
+    char frame[4 + 4 + RX_BUFFER_SIZE];
+    const char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    int len = (int)strlen(text);
+    int header = 2;
+
+    if (len > RX_BUFFER_SIZE)
+        return;
+
+    frame[0] = (char)0x81;
+    if (len < 126) {
+        frame[1] = (char)(0x80 | len);
+    }
+    else {
+        frame[1] = (char)(0x80 | 126);
+        frame[2] = (char)(len >> 8);
+        frame[3] = (char)len;
+        header = 4;
+    }
+    memcpy(frame + header, mask, sizeof(mask));
+    header += sizeof(mask);
+    for (int i = 0; i < len; i++) {
+        frame[header + i] = text[i] ^ mask[i % 4];
+    }
+    if (send(fd, frame, header + len, 0) < 0) {
+        // The check fails on the missing response
+    }
+}
+
+/*******************************************************************************
+ * @brief    Receives the next text frame sent by the server, if one is
+ *           waiting.
+ *
+ * @return   The parsed frame, NULL if none is waiting or it is no JSON.
+ ******************************************************************************/
+static json_t *receiveText(int fd)
+{
+    unsigned char header[4];
+    char payload[TX_BUFFER_SIZE];
+    size_t len;
+
+    if (recv(fd, header, 2, MSG_DONTWAIT) != 2)
+        return NULL;
+
+    len = header[1] & 0x7F;
+    if (len == 126) {
+        if (recv(fd, header + 2, 2, 0) != 2)
+            return NULL;
+        len = (size_t)header[2] << 8 | header[3];
+    }
+    if (len >= sizeof(payload) || recv(fd, payload, len, MSG_WAITALL) != (ssize_t)len)
+        return NULL;
+    payload[len] = '\0';
+
+    return json_loads(payload, 0, NULL);
+}
+
+/*******************************************************************************
+ * @brief    A history request without arguments returns the last hour in
+ *           minute points.
+ ******************************************************************************/
+static int checkHistoryDefault(void)
+{
+    uint32_t now = getClockTime();
+    json_t *res = runCommand("{\"action\":\"history\"}");
+    int ok = FALSE;
+
+    if (!res)
+        return failCheck("no response");
+
+    json_t *data = json_object_get(res, "data");
+    size_t count = json_array_size(data);
+    json_int_t step = json_integer_value(json_object_get(res, "step"));
+    json_int_t first = json_integer_value(json_array_get(json_array_get(data, 0), 0));
+    json_int_t last = json_integer_value(json_array_get(json_array_get(data, count - 1), 0));
+
+    if (step != 60)
+        failCheck("step %lld, expected 60", (long long)step);
+    else if (count < 59 || count > 61)
+        failCheck("%zu points, expected 60", count);
+    else if (first < (json_int_t)now - 3600)
+        failCheck("first point %lld s before the end of the window", (long long)(now - first));
+    else if (last < (json_int_t)now - 120)
+        failCheck("last point %lld s old", (long long)(now - last));
+    else
+        ok = TRUE;
+
+    json_decref(res);
+    return ok;
+}
+
+/*******************************************************************************
+ * @brief    A window with more points than HISTORY_LIMIT at the requested
+ *           resolution keeps the newest points.
+ ******************************************************************************/
+static int checkHistoryNewest(void)
+{
+    char command[160];
+    uint32_t now = getClockTime();
+    int ok = FALSE;
+
+    snprintf(command, sizeof(command), "{\"action\":\"history\",\"from\":%u,\"to\":%u,\"resolution\":1}", now - 1200, now);
+    json_t *res = runCommand(command);
+    if (!res)
+        return failCheck("no response");
+
+    json_t *data = json_object_get(res, "data");
+    size_t count = json_array_size(data);
+    json_int_t step = json_integer_value(json_object_get(res, "step"));
+    json_int_t last = json_integer_value(json_array_get(json_array_get(data, count - 1), 0));
+
+    if (step != 1)
+        failCheck("step %lld, expected 1", (long long)step);
+    else if (count != HISTORY_LIMIT)
+        failCheck("%zu points, expected %d", count, HISTORY_LIMIT);
+    else if (last < (json_int_t)now - 1)
+        failCheck("last point %lld s old, the oldest points were kept", (long long)(now - last));
+    else
+        ok = TRUE;
+
+    json_decref(res);
+    return ok;
+}
+
+/*******************************************************************************
+ * @brief    A stats read with STATS_WINDOW_LIMIT windows is answered, one
+ *           with more windows is refused with a valid error response.
+ ******************************************************************************/
+static int checkWindowsLimit(void)
+{
+    char command[RX_BUFFER_SIZE];
+    int len;
+    int ok = FALSE;
+
+    len = snprintf(command, sizeof(command), "{\"action\":\"read\",\"utilities\":[\"stats\"],\"windows\":[60");
+    for (int i = 1; i < STATS_WINDOW_LIMIT; i++) {
+        len += snprintf(command + len, sizeof(command) - len, ",%d", 60 * (i + 1));
+    }
+    snprintf(command + len, sizeof(command) - len, "]}");
+    json_t *res = runCommand(command);
+    size_t count = json_object_size(json_object_get(res, "stats"));
+    json_decref(res);
+    if (count != STATS_WINDOW_LIMIT)
+        return failCheck("%zu windows, expected %d", count, STATS_WINDOW_LIMIT);
+
+    // As many windows as fit in a request
+    len = snprintf(command, sizeof(command), "{\"action\":\"read\",\"utilities\":[\"stats\"],\"windows\":[1");
+    while (len < (int)sizeof(command) - 16) {
+        len += snprintf(command + len, sizeof(command) - len, ",%d", 1000 + len % 2000);
+    }
+    snprintf(command + len, sizeof(command) - len, "]}");
+    res = runCommand(command);
+    const char *status = json_string_value(json_object_get(res, "status"));
+
+    if (!res)
+        failCheck("no valid response");
+    else if (!status || strcmp(status, "Error") != 0)
+        failCheck("status %s, expected Error", status ? status : "missing");
+    else
+        ok = TRUE;
+
+    json_decref(res);
+    return ok;
+}
+
+/*******************************************************************************
+ * @brief    A read without an id sent right after a led_pwm write without an
+ *           id is answered after the acknowledgement of the write.
+ ******************************************************************************/
+static int checkOrderAfterWrite(void)
+{
+    Connection *conn = &connections[SELFTEST_SLOT];
+    const char *actions[2] = { NULL, NULL };
+    json_t *responses[2] = { NULL, NULL };
+    int fd = openClient();
+    int count = 0;
+    int ok = FALSE;
+
+    if (fd < 0)
+        return failCheck("no socket pair: %s", strerror(errno));
+
+    // Both frames arrive with one recv, the write tick has not ended yet
+    sendText(fd, "{\"action\":\"write\",\"utility\":\"led_pwm\",\"value\":37}");
+    sendText(fd, "{\"action\":\"read\",\"utilities\":[\"led_pwm\"]}");
+    HandleConnection(conn);
+    for (int tick = 0; tick < 2 * WRITE_TICK_MS / TW_TICK_MS; tick++) {
+        CommitResponses();
+        stepTimerWheel();
+    }
+    CommitResponses();
+
+    json_t *res;
+    while ((res = receiveText(fd)) != NULL) {
+        if (count < 2) {
+            responses[count] = res;
+            actions[count] = json_string_value(json_object_get(res, "action"));
+        }
+        else {
+            json_decref(res);
+        }
+        count++;
+    }
+
+    if (count != 2)
+        failCheck("%d responses, expected 2", count);
+    else if (!actions[0] || strcmp(actions[0], "write") != 0)
+        failCheck("first response is %s, expected the write", actions[0] ? actions[0] : "no action");
+    else if (!actions[1] || strcmp(actions[1], "read") != 0)
+        failCheck("second response is %s, expected the read", actions[1] ? actions[1] : "no action");
+    else
+        ok = TRUE;
+
+    json_decref(responses[0]);
+    json_decref(responses[1]);
+    CloseConnection(conn);
+    close(fd);
+    return ok;
+}
+
+/*******************************************************************************
+ * @brief    A scene that sets the heater to the state it already has still
+ *           switches the thermostat off, even if nothing else changes.
+ ******************************************************************************/
+static int checkSceneThermostat(void)
+{
+    json_t *res;
+    int ok = FALSE;
+
+    // After the first SUN no utility differs from the scene
+    json_decref(runCommand("{\"action\":\"apply_scene\",\"scene\":\"SUN\"}"));
+    json_decref(runCommand("{\"action\":\"write\",\"utility\":\"thermostat\",\"value\":\"hysteresis\"}"));
+    if (getThermostatMode() != THERMOSTAT_HYSTERESIS || getHeatState())
+        return failCheck("could not set up the thermostat with the heater off");
+
+    res = runCommand("{\"action\":\"apply_scene\",\"scene\":\"SUN\"}");
+    if (!res)
+        return failCheck("no response");
+
+    const char *status = json_string_value(json_object_get(res, "status"));
+    if (!status || strcmp(status, "Success") != 0)
+        failCheck("status %s", status ? status : "missing");
+    else if (getThermostatMode() != THERMOSTAT_OFF)
+        failCheck("thermostat mode %d, expected off", getThermostatMode());
+    else
+        ok = TRUE;
+
+    json_decref(res);
+    return ok;
+}
+
+/*******************************************************************************
+ * @brief    A huge hysteresis written by a client is limited to the
+ *           temperature range, an unknown mode restored from the state
+ *           switches the thermostat off.
+ ******************************************************************************/
+static int checkThermostatLimits(void)
+{
+    float setpoint = getThermostatSetpoint();
+    float hysteresis = getThermostatHysteresis();
+    int ok = FALSE;
+
+    json_t *res = runCommand("{\"action\":\"write\",\"utility\":\"hysteresis\",\"value\":1e30}");
+    json_decref(res);
+    float limited = getThermostatHysteresis();
+    setThermostat(THERMOSTAT_PID + 5, setpoint, hysteresis);
+
+    if (!(limited >= 0.0f && limited <= 40.0f))
+        failCheck("hysteresis %g, expected at most 40", limited);
+    else if (getThermostatMode() != THERMOSTAT_OFF)
+        failCheck("thermostat mode %d, expected off", getThermostatMode());
+    else
+        ok = TRUE;
+
+    setThermostat(THERMOSTAT_OFF, setpoint, hysteresis);
+    return ok;
+}
+
+/*******************************************************************************
+ * @brief    The coalesced acknowledgement of a led_pwm write echoes an id of
+ *           ID_MAX_LEN characters that each need a \u escape.
+ ******************************************************************************/
+static int checkLongIdAck(void)
+{
+    Connection *conn = &connections[SELFTEST_SLOT];
+    char command[64 + 6 * ID_MAX_LEN];
+    int fd = openClient();
+    int ok = FALSE;
+
+    if (fd < 0)
+        return failCheck("no socket pair: %s", strerror(errno));
+
+    int len = sprintf(command, "{\"id\":\"");
+    for (int i = 0; i < ID_MAX_LEN; i++) {
+        len += sprintf(command + len, "\\u0001");
+    }
+    sprintf(command + len, "\",\"action\":\"write\",\"utility\":\"led_pwm\",\"value\":42}");
+
+    sendText(fd, command);
+    HandleConnection(conn);
+    for (int tick = 0; tick < 2 * WRITE_TICK_MS / TW_TICK_MS; tick++) {
+        CommitResponses();
+        stepTimerWheel();
+    }
+    CommitResponses();
+
+    json_t *res = receiveText(fd);
+    json_t *id = json_object_get(res, "id");
+    const char *action = json_string_value(json_object_get(res, "action"));
+
+    if (!res)
+        failCheck("no acknowledgement or no valid JSON");
+    else if (!action || strcmp(action, "write") != 0)
+        failCheck("response is %s, expected the write", action ? action : "no action");
+    else if (json_string_length(id) != ID_MAX_LEN || strspn(json_string_value(id), "\x01") != ID_MAX_LEN)
+        failCheck("id not echoed");
+    else
+        ok = TRUE;
+
+    json_decref(res);
+    CloseConnection(conn);
+    close(fd);
+    return ok;
+}
+
+/*******************************************************************************
+ * @brief    Lets writes beyond size fail with EFBIG, RLIM_INFINITY lifts the
+ *           limit again.
+ ******************************************************************************/
+static void limitFileSize(rlim_t size)
+{
+    struct rlimit limit;
+
+    signal(SIGXFSZ, SIG_IGN);
+    getrlimit(RLIMIT_FSIZE, &limit);
+    limit.rlim_cur = size;
+    setrlimit(RLIMIT_FSIZE, &limit);
+}
+
+/*******************************************************************************
+ * @brief    A change is not acknowledged while the log cannot be written, the
+ *           acknowledgement follows once a later group commit succeeds.
+ ******************************************************************************/
+static int checkAckHeldUntilSynced(void)
+{
+    Connection *conn = &connections[SELFTEST_SLOT];
+    int fd = openClient();
+    int ok = FALSE;
+
+    if (fd < 0)
+        return failCheck("no socket pair: %s", strerror(errno));
+
+    CommitResponses();
+    limitFileSize((rlim_t)getWalSize());
+    sendText(fd, "{\"action\":\"toggle\",\"utility\":\"tv\"}");
+    HandleConnection(conn);
+    CommitResponses();
+    json_t *held = receiveText(fd);
+
+    limitFileSize(RLIM_INFINITY);
+    CommitResponses();
+    json_t *res = receiveText(fd);
+    const char *status = json_string_value(json_object_get(res, "status"));
+
+    if (held)
+        failCheck("acknowledged before the change was written");
+    else if (!status || strcmp(status, "Success") != 0)
+        failCheck("no acknowledgement after the log was written");
+    else
+        ok = TRUE;
+
+    json_decref(held);
+    json_decref(res);
+    CloseConnection(conn);
+    close(fd);
+    return ok;
+}
+
+/*******************************************************************************
+ * @brief    Once the log buffer is full and cannot be written, changes are
+ *           refused and leave the utility alone; nothing logged is dropped.
+ ******************************************************************************/
+static int checkRefusedWhenLogFull(void)
+{
+    int accepted = TRUE;
+    int toggles = 0;
+    int tv = getTVState();
+    int ok = FALSE;
+
+    CommitResponses();
+    limitFileSize((rlim_t)getWalSize());
+    while (accepted && toggles <= WAL_BUFFER_RECORDS) {
+        json_t *res = runCommand("{\"action\":\"toggle\",\"utility\":\"tv\"}");
+        const char *status = json_string_value(json_object_get(res, "status"));
+        accepted = status && strcmp(status, "Success") == 0;
+        json_decref(res);
+        if (accepted) {
+            toggles++;
+            tv = getTVState();
+        }
+    }
+    int refusedTv = getTVState();
+    long before = getWalSize();
+
+    limitFileSize(RLIM_INFINITY);
+    CommitResponses();
+    long written = (getWalSize() - before) / (long)sizeof(WalRecord);
+
+    if (toggles > WAL_BUFFER_RECORDS)
+        failCheck("changes still accepted with a full buffer");
+    else if (refusedTv != tv)
+        failCheck("the refused toggle changed the TV");
+    else if (written != toggles)
+        failCheck("%ld records written after the failure, %d toggles accepted", written, toggles);
+    else
+        ok = TRUE;
+
+    return ok;
+}
+
+/*******************************************************************************
+ * @brief    An energy request for more hours than ENERGY_LIMIT returns that
+ *           many periods in one valid response, also when every device ran
+ *           at an odd level in every period. Runs last, the clock jumps.
+ ******************************************************************************/
+static int checkEnergyLimit(void)
+{
+    char command[128];
+    int ok = FALSE;
+
+    for (int hour = 0; hour < 200; hour++) {
+        for (int i = 0; i < ENERGY_DEVICES; i++) {
+            setEnergyLoad(i, (float)((hour + i) % 7 + 1) / 7.0f);
+        }
+        advanceClock(3600123456789ull);
+    }
+
+    snprintf(command, sizeof(command), "{\"action\":\"energy\",\"period\":\"hour\",\"from\":%u}", getClockTime() - 200 * 3600);
+    json_t *res = runCommand(command);
+    size_t count = json_array_size(json_object_get(res, "data"));
+
+    if (!res)
+        failCheck("no valid response");
+    else if (count != ENERGY_LIMIT)
+        failCheck("%zu periods, expected %d", count, ENERGY_LIMIT);
+    else
+        ok = TRUE;
+
+    json_decref(res);
+    return ok;
+}
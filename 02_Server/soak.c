@@ -0,0 +1,672 @@
+/*******************************************************************************
+ * @file       soak.c
+ *******************************************************************************
+ *
+ * @brief      Soak test of the server with valid and malformed commands.
+ *
+ * @details    Includes main.c to reach its local functions, main is renamed
+ *             to webhouseMain. The GPIO access runs in the bcm2835 debug
+ *             mode, the clock is virtual and the server files are created
+ *             in a temporary directory. SOAK_CLIENTS loopback connections
+ *             go through the accept, the handshake and the frame handling
+ *             of the server; they send a seeded random mix of valid
+ *             commands, malformed JSON, invalid commands, control frames
+ *             and oversized frames, and end with a close frame or by
+ *             dropping the socket. After every batch the group commit runs
+ *             and the timer wheel advances one tick.
+ *
+ *             Every interval of commands all connections are closed and
+ *             the RSS, the heap in use, the blocks and bytes jansson holds
+ *             outside of the arena (counted by its fallback allocator) and
+ *             the open file descriptors are sampled. The first sample after the
+ *             warm-up is the baseline; the test fails if the last sample
+ *             holds more jansson blocks or descriptors, or if the RSS or
+ *             the heap grew by more than the limit.
+ *
+ *             soak [-n commands] [-i interval] [-w warm-up] [-l limit KiB] [-s seed]
+ *
+ *             The exit code is 0 if the memory stayed flat, 1 if it grew
+ *             and 2 on an error.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              main
+ *
+ *  Functions  local:
+ *              countingMalloc
+ *              countingFree
+ *              nextRandom
+ *              setupServer
+ *              openClient
+ *              closeClient
+ *              sendFrame
+ *              sendCommand
+ *              sendMalformed
+ *              drainClient
+ *              pumpServer
+ *              takeSample
+ *              printSample
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#define main webhouseMain
+#include "main.c"
+#undef main
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+
+#include "harness.h"
+
+//----- Macros -----------------------------------------------------------------
+#define SOAK_COMMANDS 2000000L      // Default number of commands
+#define SOAK_INTERVAL 100000L       // Default commands between two samples
+#define SOAK_WARMUP 200000L         // Default commands before the baseline
+#define SOAK_LIMIT_KIB 1024         // Default growth of RSS and heap allowed
+#define SOAK_CLIENTS 4              // Connections open at the same time
+#define SOAK_BATCH 16               // Most frames sent before the server runs
+#define SOAK_SESSION 5000           // Most commands of one connection
+#define SOAK_MALFORMED 4            // One command in this many is malformed
+#define SOAK_HEADER 16              // Size header of a jansson block, keeps the alignment
+
+#define OPCODE_TEXT 0x1
+#define OPCODE_BINARY 0x2
+#define OPCODE_CLOSE 0x8
+#define OPCODE_PING 0x9
+#define OPCODE_PONG 0xA
+
+#define HANDSHAKE_REQUEST "GET /chat HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\n" \
+                          "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" \
+                          "Sec-WebSocket-Version: 13\r\n\r\n"
+
+//----- Data types -------------------------------------------------------------
+typedef struct {
+    int fd;                     // Client socket, -1 if closed
+    Connection *conn;           // Server side of the connection
+    long remaining;             // Commands until the client closes
+} Client;
+
+typedef struct {
+    long commands;              // Commands sent before the sample
+    long rssKib;                // Resident set size
+    long heapKib;               // Heap in use according to mallinfo2
+    long jsonBlocks;            // Blocks held by jansson outside of the arena
+    long jsonKib;               // Bytes of them
+    int fds;                    // Open file descriptors
+} Sample;
+
+//----- Function prototypes ----------------------------------------------------
+static void *countingMalloc(size_t size);
+static void countingFree(void *ptr);
+static uint32_t nextRandom(void);
+static int  setupServer(char *directory, int *listener);
+static int  openClient(Client *client, int listener);
+static void closeClient(Client *client, int graceful);
+static void sendFrame(Client *client, int opcode, const char *payload, int len, int declared);
+static void sendCommand(Client *client);
+static void sendMalformed(Client *client);
+static void drainClient(Client *client);
+static void pumpServer(Client *clients);
+static void takeSample(Sample *sample, long commands);
+static void printSample(FILE *report, const Sample *sample, const char *label);
+
+//----- Global variables -------------------------------------------------------
+static long jsonBlocks = 0;         // Live jansson blocks
+static long jsonBytes = 0;          // Live jansson bytes
+static long jsonAllocations = 0;    // jansson allocations since the start
+static long received = 0;           // Bytes the clients received
+static uint64_t randomState = 1;    // xorshift64 state
+
+// Valid commands, a %d is replaced with a random number
+static const char *const validCommands[] = {
+    "{\"action\":\"read\",\"utilities\":[\"tv\",\"heater\",\"temperature\",\"alarm\",\"lamp_floor\",\"lamp_ceil\",\"led_pwm\"]}",
+    "{\"id\":%d,\"action\":\"read\",\"utilities\":[\"stats\"],\"windows\":[60,300]}",
+    "{\"action\":\"write\",\"utility\":\"led_pwm\",\"value\":%d}",
+    "{\"id\":\"w-%d\",\"action\":\"write\",\"utility\":\"led_pwm\",\"value\":50}",
+    "{\"action\":\"write\",\"utility\":\"led_pwm\",\"value\":80,\"fade_ms\":%d}",
+    "{\"action\":\"write\",\"utility\":\"setpoint\",\"value\":21.5}",
+    "{\"action\":\"toggle\",\"utility\":\"tv\"}",
+    "{\"action\":\"toggle\",\"utility\":\"heater\"}",
+    "{\"action\":\"toggle\",\"utility\":\"lamp_floor\"}",
+    "{\"id\":[%d],\"action\":\"toggle\",\"utility\":\"lamp_ceil\"}",
+    "{\"action\":\"events\",\"limit\":64}",
+    "{\"action\":\"history\",\"resolution\":%d}",
+    "{\"action\":\"energy\",\"period\":\"day\"}",
+    "{\"action\":\"apply_scene\",\"scene\":\"RAIN\"}",
+    "{\"action\":\"apply_scene\",\"scene\":\"SUN\"}",
+    "{\"action\":\"subscribe\",\"events\":[\"alarm\",\"stats\"]}",
+    "{\"action\":\"subscribe\",\"events\":[]}",
+    "{\"action\":\"metrics\"}",
+    "[{\"action\":\"read\",\"utilities\":[\"tv\"]},{\"action\":\"toggle\",\"utility\":\"tv\"},"
+        "{\"id\":%d,\"action\":\"write\",\"utility\":\"led_pwm\",\"value\":10}]",
+    "{\"id\":\"b\",\"atomic\":true,\"batch\":[{\"action\":\"toggle\",\"utility\":\"tv\"},"
+        "{\"action\":\"write\",\"utility\":\"led_pwm\",\"value\":%d}]}",
+};
+
+// Commands that parse but are rejected, or do not parse at all
+static const char *const invalidCommands[] = {
+    "{\"action\":",
+    "{\"action\":\"read\",\"utilities\":[\"tv\"]",
+    "not json at all",
+    "",
+    "42",
+    "\"read\"",
+    "null",
+    "[]",
+    "[1,2,3]",
+    "{}",
+    "{\"action\":42}",
+    "{\"action\":\"launch\"}",
+    "{\"action\":\"read\"}",
+    "{\"action\":\"read\",\"utilities\":\"tv\"}",
+    "{\"action\":\"read\",\"utilities\":[1,null,{}]}",
+    "{\"action\":\"write\",\"utility\":\"led_pwm\"}",
+    "{\"action\":\"write\",\"utility\":\"led_pwm\",\"value\":\"full\"}",
+    "{\"action\":\"write\",\"utility\":\"led_pwm\",\"value\":1e308}",
+    "{\"action\":\"write\",\"utility\":\"led_pwm\",\"value\":-5,\"fade_ms\":-1}",
+    "{\"action\":\"write\",\"utility\":\"garage\",\"value\":1}",
+    "{\"id\":\"x-%d\",\"action\":\"toggle\",\"utility\":\"garage\"}",
+    "{\"action\":\"toggle\"}",
+    "{\"action\":\"apply_scene\",\"scene\":\"MOON\"}",
+    "{\"action\":\"apply_scene\",\"scene\":7}",
+    "{\"action\":\"subscribe\",\"events\":\"alarm\"}",
+    "{\"action\":\"events\",\"from\":-1,\"to\":\"now\",\"limit\":-%d}",
+    "{\"action\":\"history\",\"from\":4000000000,\"to\":1}",
+    "{\"action\":\"energy\",\"period\":\"year\",\"from\":%d,\"to\":0}",
+    "{\"batch\":[],\"atomic\":true}",
+    "{\"batch\":[{\"action\":\"toggle\",\"utility\":\"tv\"},{\"action\":\"fly\"}],\"atomic\":true}",
+    "[{\"action\":\"read\",\"utilities\":[\"tv\"]},7,\"x\",{\"action\":\"write\"}]",
+    "{\"action\":\"read\",\"utilities\":[\"tv\"],\"action\":\"write\"}",
+    "{\"action\":\"read\xff\xfe\",\"utilities\":[\"tv\"]}",
+    "{\"action\":\"read\\u0000\",\"utilities\":[\"tv\"]}",
+};
+
+/*******************************************************************************
+ * @brief    Runs the soak test and prints the samples.
+ ******************************************************************************/
+int main(int argc, char **argv)
+{
+    long commands = SOAK_COMMANDS;
+    long interval = SOAK_INTERVAL;
+    long warmup = SOAK_WARMUP;
+    long limitKib = SOAK_LIMIT_KIB;
+    char directory[] = "/tmp/soak.XXXXXX";
+    Client clients[SOAK_CLIENTS];
+    int listener = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:i:w:l:s:")) != -1) {
+        switch (opt) {
+        case 'n': commands = atol(optarg); break;
+        case 'i': interval = atol(optarg); break;
+        case 'w': warmup = atol(optarg); break;
+        case 'l': limitKib = atol(optarg); break;
+        case 's': randomState = strtoull(optarg, NULL, 0) | 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-n commands] [-i interval] [-w warm-up] [-l limit KiB] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (commands <= 0 || interval <= 0 || warmup < 0 || warmup >= commands) {
+        fprintf(stderr, "soak: the warm-up must be shorter than the run\n");
+        return 2;
+    }
+
+    // Count the blocks jansson takes outside of the arena of the commands,
+    // the hooks must be set before its first allocation
+    initArena(countingMalloc, countingFree);
+
+    // The report goes to the original stdout, the GPIO dumps and the log
+    // of the server to /dev/null
+    FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+    int errors = dup(STDERR_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    if (!report || errors < 0 || devNull < 0) {
+        perror("soak");
+        return 2;
+    }
+    dup2(devNull, STDOUT_FILENO);
+    dup2(devNull, STDERR_FILENO);
+    close(devNull);
+    signal(SIGPIPE, SIG_IGN);
+    if (setupServer(directory, &listener) < 0) {
+        dprintf(errors, "soak: setup failed: %s\n", strerror(errno));
+        return 2;
+    }
+    for (int i = 0; i < SOAK_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+
+    fprintf(report, "%-10s %10s %10s %10s %12s %10s %6s\n", "sample", "commands", "rss KiB", "heap KiB",
+            "json blocks", "json KiB", "fds");
+
+    Sample baseline = { 0 };
+    Sample sample = { 0 };
+    long sent = 0;
+    long nextSample = interval;
+    int haveBaseline = FALSE;
+    uint64_t started = getMetricTime();
+
+    while (sent < commands) {
+        // One batch on a random connection, opened if needed
+        Client *client = &clients[nextRandom() % SOAK_CLIENTS];
+        if (client->fd < 0 && openClient(client, listener) < 0) {
+            dprintf(errors, "soak: connection failed: %s\n", strerror(errno));
+            return 2;
+        }
+
+        int frames = 1 + nextRandom() % SOAK_BATCH;
+        for (int i = 0; i < frames && client->fd >= 0 && sent < commands; i++) {
+            if (nextRandom() % SOAK_MALFORMED == 0)
+                sendMalformed(client);
+            else
+                sendCommand(client);
+            sent++;
+            client->remaining--;
+        }
+        pumpServer(clients);
+
+        // End the session with a close frame or by dropping the socket
+        if (client->fd >= 0 && client->remaining <= 0) {
+            closeClient(client, nextRandom() % 2);
+            pumpServer(clients);
+        }
+
+        if (sent >= nextSample || sent >= commands) {
+            // Sample without connections, so every sample sees the same
+            // connection state
+            for (int i = 0; i < SOAK_CLIENTS; i++) {
+                if (clients[i].fd >= 0) {
+                    closeClient(&clients[i], TRUE);
+                    pumpServer(clients);
+                }
+            }
+
+            takeSample(&sample, sent);
+            if (!haveBaseline && sent >= warmup) {
+                baseline = sample;
+                haveBaseline = TRUE;
+                printSample(report, &sample, "baseline");
+            }
+            else {
+                printSample(report, &sample, haveBaseline ? "" : "warm-up");
+            }
+            nextSample = sent + interval;
+        }
+    }
+
+    double seconds = (getMetricTime() - started) / 1e9;
+    fprintf(report, "%ld commands in %.1f s (%.0f/s), %.0f s of virtual time, %.1f jansson allocations and "
+            "%.0f bytes of responses per command\n", sent, seconds, sent / seconds, getClockNs() / 1e9,
+            (double)jsonAllocations / sent, (double)received / sent);
+
+    ArenaStats arenaStats;
+    getArenaStats(&arenaStats);
+    fprintf(report, "arena: %llu requests, %.1f blocks per request, %llu fallbacks to malloc, peak %zu of %d bytes\n",
+            (unsigned long long)arenaStats.requests, (double)arenaStats.allocations / arenaStats.requests,
+            (unsigned long long)arenaStats.fallbacks, arenaStats.peak, ARENA_SIZE);
+
+    // Judge the growth from the baseline to the last sample
+    int failed = FALSE;
+    if (sample.jsonBlocks > baseline.jsonBlocks) {
+        fprintf(report, "FAIL: jansson holds %ld more blocks (%ld KiB)\n", sample.jsonBlocks - baseline.jsonBlocks,
+                sample.jsonKib - baseline.jsonKib);
+        failed = TRUE;
+    }
+    if (sample.fds > baseline.fds) {
+        fprintf(report, "FAIL: %d more file descriptors are open\n", sample.fds - baseline.fds);
+        failed = TRUE;
+    }
+    if (sample.heapKib - baseline.heapKib > limitKib) {
+        fprintf(report, "FAIL: the heap grew by %ld KiB\n", sample.heapKib - baseline.heapKib);
+        failed = TRUE;
+    }
+    if (sample.rssKib - baseline.rssKib > limitKib) {
+        fprintf(report, "FAIL: the RSS grew by %ld KiB\n", sample.rssKib - baseline.rssKib);
+        failed = TRUE;
+    }
+    if (!failed) {
+        fprintf(report, "PASS: no growth after the warm-up\n");
+    }
+
+    close(listener);
+    close(epoll_id);
+    closeHarness(directory);
+    fclose(report);
+    return failed ? 1 : 0;
+}
+
+/*******************************************************************************
+ * @brief    Fallback allocator of the arena, counts the live blocks and
+ *           keeps the size in front of every block.
+ ******************************************************************************/
+static void *countingMalloc(size_t size)
+{
+    char *block = malloc(size + SOAK_HEADER);
+
+    if (!block)
+        return NULL;
+
+    *(size_t *)block = size;
+    __atomic_add_fetch(&jsonBlocks, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&jsonAllocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&jsonBytes, (long)size, __ATOMIC_RELAXED);
+    return block + SOAK_HEADER;
+}
+
+/*******************************************************************************
+ * @brief    Releases a block of countingMalloc().
+ ******************************************************************************/
+static void countingFree(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    char *block = (char *)ptr - SOAK_HEADER;
+    __atomic_sub_fetch(&jsonBlocks, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&jsonBytes, (long)*(size_t *)block, __ATOMIC_RELAXED);
+    free(block);
+}
+
+/*******************************************************************************
+ * @brief    Returns the next number of the seeded xorshift64 generator.
+ ******************************************************************************/
+static uint32_t nextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return (uint32_t)(randomState >> 32);
+}
+
+/*******************************************************************************
+ * @brief    Starts the server on a virtual clock in a temporary directory,
+ *           with a listening socket on an ephemeral loopback port.
+ ******************************************************************************/
+static int setupServer(char *directory, int *listener)
+{
+    struct sockaddr_in addr;
+
+    if (openHarness(directory, "virtual") < 0)
+        return -1;
+
+    InitWebhouseUtilities();
+    openAlarmLog(ALARM_LOG_FILE);
+    openArchive(ARCHIVE_FILE);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    *listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (*listener < 0 || bind(*listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(*listener, SOAK_CLIENTS) < 0)
+        return -1;
+
+    // AcceptConnection registers the connections, nobody waits on them
+    epoll_id = epoll_create1(0);
+    if (epoll_id < 0)
+        return -1;
+
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        connections[i].sock_id = -1;
+    }
+    InitTimers();
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Connects a client, lets the server accept it and completes the
+ *           handshake.
+ *
+ * @return   0 if successful, -1 on failure.
+ ******************************************************************************/
+static int openClient(Client *client, int listener)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int one = 1;
+
+    if (getsockname(listener, (struct sockaddr *)&addr, &len) < 0)
+        return -1;
+
+    client->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (client->fd < 0 || connect(client->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return -1;
+    setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // The new connection takes the first free slot
+    client->conn = NULL;
+    for (int i = 0; i < MAX_CONNECTIONS && !client->conn; i++) {
+        if (connections[i].sock_id < 0)
+            client->conn = &connections[i];
+    }
+    AcceptConnection(listener);
+    if (!client->conn || client->conn->sock_id < 0) {
+        errno = EMFILE;
+        return -1;
+    }
+
+    send(client->fd, HANDSHAKE_REQUEST, strlen(HANDSHAKE_REQUEST), 0);
+    while (!client->conn->handshake_done && client->conn->sock_id >= 0) {
+        HandleConnection(client->conn);
+    }
+    drainClient(client);
+    client->remaining = 1 + nextRandom() % SOAK_SESSION;
+
+    return client->conn->sock_id >= 0 ? 0 : -1;
+}
+
+/*******************************************************************************
+ * @brief    Ends a session with a close frame or by dropping the socket. The
+ *           server notices it in the next pumpServer().
+ ******************************************************************************/
+static void closeClient(Client *client, int graceful)
+{
+    if (graceful) {
+        sendFrame(client, OPCODE_CLOSE, "\x03\xe8", 2, 2);
+    }
+    shutdown(client->fd, SHUT_WR);
+}
+
+/*******************************************************************************
+ * @brief    Sends a masked frame. The declared length may exceed the payload
+ *           to announce frames the server cannot hold.
+ ******************************************************************************/
+static void sendFrame(Client *client, int opcode, const char *payload, int len, int declared)
+{
+    static char frame[RX_BUFFER_SIZE + 16];
+    uint32_t mask = nextRandom();
+    int header = 2;
+
+    frame[0] = (char)(0x80 | opcode);
+    if (declared < 126) {
+        frame[1] = (char)(0x80 | declared);
+    }
+    else {
+        frame[1] = (char)(0x80 | 126);
+        frame[2] = (char)(declared >> 8);
+        frame[3] = (char)declared;
+        header = 4;
+    }
+    memcpy(frame + header, &mask, sizeof(mask));
+    header += sizeof(mask);
+    for (int i = 0; i < len && header + i < (int)sizeof(frame); i++) {
+        frame[header + i] = payload[i] ^ ((char *)&mask)[i % 4];
+    }
+    if (send(client->fd, frame, header + len, MSG_NOSIGNAL) < 0) {
+        // Closed by the server, pumpServer() notices it
+    }
+}
+
+/*******************************************************************************
+ * @brief    Sends a random valid command.
+ ******************************************************************************/
+static void sendCommand(Client *client)
+{
+    char command[512];
+    const char *format = validCommands[nextRandom() % (sizeof(validCommands) / sizeof(validCommands[0]))];
+    int len = snprintf(command, sizeof(command), format, (int)(nextRandom() % 101));
+
+    sendFrame(client, OPCODE_TEXT, command, len, len);
+}
+
+/*******************************************************************************
+ * @brief    Sends a random malformed message: an invalid command, random
+ *           bytes, deep nesting, a control frame, or a frame the server
+ *           cannot hold, which makes it close the connection.
+ ******************************************************************************/
+static void sendMalformed(Client *client)
+{
+    static char payload[RX_BUFFER_SIZE];
+    int len;
+
+    switch (nextRandom() % 8) {
+    case 0:
+        // Random bytes
+        len = 1 + nextRandom() % 200;
+        for (int i = 0; i < len; i++) {
+            payload[i] = (char)nextRandom();
+        }
+        sendFrame(client, OPCODE_TEXT, payload, len, len);
+        break;
+    case 1:
+        // Nesting deeper than jansson accepts
+        len = 1 + nextRandom() % 3000;
+        memset(payload, '[', len);
+        sendFrame(client, OPCODE_TEXT, payload, len, len);
+        break;
+    case 2:
+        // A long id echoed into the response
+        len = snprintf(payload, sizeof(payload), "{\"id\":\"%0*d\",\"action\":\"read\",\"utilities\":[\"tv\"]}",
+                       (int)(nextRandom() % 3000), 7);
+        sendFrame(client, OPCODE_TEXT, payload, len, len);
+        break;
+    case 3:
+        sendFrame(client, nextRandom() % 2 ? OPCODE_PING : OPCODE_PONG, "soak", 4, 4);
+        break;
+    case 4:
+        sendFrame(client, OPCODE_BINARY, "{\"action\":\"metrics\"}", 20, 20);
+        break;
+    case 5:
+        // Rarely announce a frame larger than the receive buffer
+        if (nextRandom() % 64 == 0) {
+            sendFrame(client, OPCODE_TEXT, "{\"action\":\"read\"}", 17, RX_BUFFER_SIZE + 100);
+            break;
+        }
+        // fall through
+    default:
+        len = snprintf(payload, sizeof(payload),
+                       invalidCommands[nextRandom() % (sizeof(invalidCommands) / sizeof(invalidCommands[0]))],
+                       (int)(nextRandom() % 101));
+        sendFrame(client, OPCODE_TEXT, payload, len, len);
+        break;
+    }
+}
+
+/*******************************************************************************
+ * @brief    Reads and discards everything the server sent to a client, and
+ *           closes the client once the server closed its side.
+ ******************************************************************************/
+static void drainClient(Client *client)
+{
+    static char buffer[65536];
+    ssize_t len;
+
+    // Responses are not checked, the memory of the server is
+    while ((len = recv(client->fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+        received += len;
+    }
+    if (client->conn->sock_id < 0) {
+        close(client->fd);
+        client->fd = -1;
+    }
+}
+
+/*******************************************************************************
+ * @brief    Lets the server handle everything the clients sent, commits the
+ *           responses and advances the timer wheel by one tick.
+ ******************************************************************************/
+static void pumpServer(Client *clients)
+{
+    for (int i = 0; i < SOAK_CLIENTS; i++) {
+        Client *client = &clients[i];
+        int pending;
+
+        while (client->fd >= 0 && client->conn->sock_id >= 0) {
+            // Stop once the frames are consumed, unless the peer is gone
+            if (ioctl(client->conn->sock_id, FIONREAD, &pending) < 0 || pending == 0) {
+                char probe;
+                if (recv(client->conn->sock_id, &probe, 1, MSG_PEEK | MSG_DONTWAIT) != 0)
+                    break;
+            }
+            HandleConnection(client->conn);
+        }
+    }
+
+    DispatchAlarmEvents();
+    CommitResponses();
+    stepTimerWheel();
+    CommitResponses();
+
+    for (int i = 0; i < SOAK_CLIENTS; i++) {
+        if (clients[i].fd >= 0)
+            drainClient(&clients[i]);
+    }
+}
+
+/*******************************************************************************
+ * @brief    Samples the RSS, the heap, the blocks of jansson and the open
+ *           file descriptors.
+ ******************************************************************************/
+static void takeSample(Sample *sample, long commands)
+{
+    long pages = 0;
+    long resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm) {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        fclose(statm);
+    }
+
+    struct mallinfo2 heap = mallinfo2();
+
+    // The directory stream holds a descriptor of its own
+    int fds = -1;
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.')
+            fds++;
+    }
+    if (dir)
+        closedir(dir);
+
+    sample->commands = commands;
+    sample->rssKib = resident * (sysconf(_SC_PAGESIZE) / 1024);
+    sample->heapKib = (long)((heap.uordblks + heap.hblkhd) / 1024);
+    sample->jsonBlocks = __atomic_load_n(&jsonBlocks, __ATOMIC_RELAXED);
+    sample->jsonKib = __atomic_load_n(&jsonBytes, __ATOMIC_RELAXED) / 1024;
+    sample->fds = fds;
+}
+
+/*******************************************************************************
+ * @brief    Prints one line of the sample table.
+ ******************************************************************************/
+static void printSample(FILE *report, const Sample *sample, const char *label)
+{
+    fprintf(report, "%-10s %10ld %10ld %10ld %12ld %10ld %6d\n", label, sample->commands, sample->rssKib,
+            sample->heapKib, sample->jsonBlocks, sample->jsonKib, sample->fds);
+    fflush(report);
+}
@@ -0,0 +1,178 @@
+/*******************************************************************************
+ * @file       stateimage.c
+ *******************************************************************************
+ *
+ * @brief      Memory-mapped binary snapshot of the Webhouse state.
+ *
+ * @details    The image has a fixed layout with a magic number, a version
+ *             and a CRC-32, so it can be validated and used right after
+ *             mmap() without any parsing. Images are replaced atomically
+ *             (write to a temporary file, fsync, rename), a power cut leaves
+ *             either the old or the new image behind.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              loadStateImage
+ *              saveStateImage
+ *              writeFileAtomic
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stateimage.h"
+#include "wal.h"
+#include "log.h"
+
+//----- Macros -----------------------------------------------------------------
+#define STATE_IMAGE_CRC_LEN offsetof(StateImage, crc)
+#define TMP_SUFFIX ".tmp"
+
+/*******************************************************************************
+ * @brief    Maps a state image and copies its values out after validation.
+ *           Keys missing in an older image keep the values passed in.
+ *
+ * @param    filename  Path of the image.
+ * @param    values    Receives the states, indexed by STATE_* key.
+ * @param    count     Number of entries in values.
+ * @param    seq       Receives the log sequence number covered by the image.
+ * @return   0 if successful, -1 if the image is missing or invalid.
+ ******************************************************************************/
+int loadStateImage(const char *filename, int32_t values[], int count, uint32_t *seq)
+{
+    struct stat st;
+    const StateImage *image;
+    int fd, ret = -1;
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st) < 0 || st.st_size != sizeof(StateImage)) {
+        logWarn("Invalid state image size: %s", filename);
+        close(fd);
+        return -1;
+    }
+
+    image = mmap(NULL, sizeof(StateImage), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        logError("mmap state image failed: %s", strerror(errno));
+        return -1;
+    }
+
+    if (image->magic != STATE_IMAGE_MAGIC || image->version != STATE_IMAGE_VERSION ||
+        image->size != sizeof(StateImage) || image->count > STATE_IMAGE_SLOTS) {
+        logWarn("Unsupported state image: %s", filename);
+    }
+    else if (crc32(image, STATE_IMAGE_CRC_LEN) != image->crc) {
+        logWarn("State image checksum mismatch: %s", filename);
+    }
+    else {
+        int n = (int)image->count < count ? (int)image->count : count;
+        memcpy(values, image->values, n * sizeof(int32_t));
+        *seq = image->seq;
+        ret = 0;
+    }
+
+    munmap((void *)image, sizeof(StateImage));
+    return ret;
+}
+
+/*******************************************************************************
+ * @brief    Writes a new state image atomically.
+ *
+ * @param    filename  Path of the image.
+ * @param    values    States indexed by STATE_* key.
+ * @param    count     Number of entries in values.
+ * @param    seq       Log sequence number covered by the values.
+ * @return   0 if successful, -1 on failure.
+ ******************************************************************************/
+int saveStateImage(const char *filename, const int32_t values[], int count, uint32_t seq)
+{
+    StateImage image;
+
+    if (count > STATE_IMAGE_SLOTS)
+        return -1;
+
+    memset(&image, 0, sizeof(image));
+    image.magic = STATE_IMAGE_MAGIC;
+    image.version = STATE_IMAGE_VERSION;
+    image.size = sizeof(StateImage);
+    image.seq = seq;
+    image.count = count;
+    memcpy(image.values, values, count * sizeof(int32_t));
+    image.crc = crc32(&image, STATE_IMAGE_CRC_LEN);
+
+    return writeFileAtomic(filename, &image, sizeof(image));
+}
+
+/*******************************************************************************
+ * @brief    Replaces a file atomically: the data is written to a temporary
+ *           file, synced and renamed over the target, then the directory
+ *           entry is synced as well.
+ *
+ * @param    filename  Path of the file to replace.
+ * @param    data      New content.
+ * @param    len       Length of the new content.
+ * @return   0 if successful, -1 on failure.
+ ******************************************************************************/
+int writeFileAtomic(const char *filename, const void *data, size_t len)
+{
+    char tmpname[256];
+    const char *p = data;
+    int fd;
+
+    snprintf(tmpname, sizeof(tmpname), "%s" TMP_SUFFIX, filename);
+
+    fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        logError("Error opening file %s: %s", tmpname, strerror(errno));
+        return -1;
+    }
+
+    while (len > 0) {
+        ssize_t written = write(fd, p, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        p += written;
+        len -= written;
+    }
+
+    if (len > 0 || fsync(fd) < 0) {
+        logError("Error writing to file: %s", tmpname);
+        close(fd);
+        unlink(tmpname);
+        return -1;
+    }
+    close(fd);
+
+    if (rename(tmpname, filename) < 0) {
+        logError("Error renaming file %s: %s", tmpname, strerror(errno));
+        unlink(tmpname);
+        return -1;
+    }
+
+    fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+
+    return 0;
+}
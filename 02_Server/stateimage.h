@@ -0,0 +1,46 @@
+#ifndef STATEIMAGE_H_
+#define STATEIMAGE_H_
+
+//-----Header-Files----------------------------------------------------------------
+#include <stdint.h>
+#include <stddef.h>
+
+//-----Macros----------------------------------------------------------------------
+#define STATE_IMAGE_MAGIC   0x49534857      // "WHSI"
+#define STATE_IMAGE_VERSION 1
+#define STATE_IMAGE_SLOTS   32              // Room for keys added later
+
+//-----Data types------------------------------------------------------------------
+// Keys of the persisted utility states, also the index into the image
+enum {
+    STATE_TV,
+    STATE_HEATER,
+    STATE_LAMP_FLOOR,
+    STATE_LAMP_CEIL,
+    STATE_LED_PWM,
+    STATE_THERMOSTAT,           // THERMOSTAT_* mode
+    STATE_SETPOINT,             // Thermostat setpoint in 1/100 °C
+    STATE_HYSTERESIS,           // Thermostat band in 1/100 °C
+    STATE_KEY_COUNT
+};
+
+/**
+ * Fixed-layout binary snapshot of the utility states. The file is exactly
+ * sizeof(StateImage) bytes and is mapped directly into memory on startup.
+ */
+typedef struct {
+    uint32_t magic;                         // STATE_IMAGE_MAGIC
+    uint16_t version;                       // STATE_IMAGE_VERSION
+    uint16_t size;                          // sizeof(StateImage)
+    uint32_t seq;                           // Log sequence number covered
+    uint32_t count;                         // Valid entries in values
+    int32_t values[STATE_IMAGE_SLOTS];      // Indexed by STATE_* key
+    uint32_t crc;                           // CRC-32 over the preceding bytes
+} StateImage;
+
+//-----Function prototypes---------------------------------------------------------
+extern int loadStateImage(const char *filename, int32_t values[], int count, uint32_t *seq);
+extern int saveStateImage(const char *filename, const int32_t values[], int count, uint32_t seq);
+extern int writeFileAtomic(const char *filename, const void *data, size_t len);
+
+#endif
@@ -0,0 +1,195 @@
+/*******************************************************************************
+ * @file       stats.c
+ *******************************************************************************
+ *
+ * @brief      Sliding-window statistics of the temperature.
+ *
+ * @details    The samples of the last STATS_SPAN seconds are kept in a ring
+ *             together with running (prefix) sums of the value and its
+ *             square, stored as integers in thousandths so they never drift.
+ *             Mean and variance of any window are the difference of two
+ *             prefix sums. Min and max are tracked with monotonic deques:
+ *             each sample is pushed and popped at most once, and the
+ *             extreme of a window is the first deque entry inside it, found
+ *             by binary search. Updates are O(1) amortized, queries for an
+ *             arbitrary window length O(log n).
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              addStatsSample
+ *              getWindowStats
+ *
+ *  Functions  local:
+ *              pushDeque
+ *              firstInWindow
+ *              sampleAt
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stddef.h>
+#include <math.h>
+
+#include "stats.h"
+
+//----- Macros -----------------------------------------------------------------
+#define CAPACITY    (STATS_SPAN + 1)    // One extra sample as base of the sums
+#define SCALE       1000                // Values are summed in thousandths
+
+//----- Data types -------------------------------------------------------------
+typedef struct {
+    uint32_t time;          // Seconds since the epoch
+    int32_t value;          // Value in thousandths
+    int64_t sum;            // Sum of all values up to this sample
+    int64_t sumSq;          // Sum of all squared values up to this sample
+} Sample;
+
+// Deque of sample numbers, the values are monotonic from front to back
+typedef struct {
+    uint64_t seq[CAPACITY];
+    uint32_t head;          // Index of the front entry
+    uint32_t count;
+    int sign;               // 1 keeps the minimum in front, -1 the maximum
+} Deque;
+
+//----- Function prototypes ----------------------------------------------------
+static void pushDeque(Deque *d, uint64_t seq);
+static uint32_t firstInWindow(const Deque *d, uint32_t from);
+static const Sample *sampleAt(uint64_t seq);
+
+//----- Global variables -------------------------------------------------------
+static Sample samples[CAPACITY];
+static uint64_t written = 0;            // Samples ever added
+static Deque minDeque = { .sign = 1 };
+static Deque maxDeque = { .sign = -1 };
+
+/*******************************************************************************
+ * @brief    Adds a sample, normally once per second. A clock set back is
+ *           clamped, so the samples stay in time order.
+ *
+ * @param    time   Seconds since the epoch.
+ * @param    value  Sampled value.
+ ******************************************************************************/
+void addStatsSample(uint32_t time, float value)
+{
+    Sample *s = &samples[written % CAPACITY];
+    const Sample *prev = written ? sampleAt(written - 1) : NULL;
+    int32_t v = (int32_t)lroundf(value * SCALE);
+
+    if (prev && time < prev->time)
+        time = prev->time;
+
+    s->time = time;
+    s->value = v;
+    s->sum = (prev ? prev->sum : 0) + v;
+    s->sumSq = (prev ? prev->sumSq : 0) + (int64_t)v * v;
+
+    pushDeque(&minDeque, written);
+    pushDeque(&maxDeque, written);
+    written++;
+}
+
+/*******************************************************************************
+ * @brief    Computes the statistics of the samples of the last seconds.
+ *           Windows longer than STATS_SPAN are cut to STATS_SPAN samples.
+ *
+ * @param    seconds  Length of the window, ending with the latest sample.
+ * @param    stats    Receives the statistics.
+ * @return   Number of samples in the window, 0 if there are none.
+ ******************************************************************************/
+int getWindowStats(uint32_t seconds, WindowStats *stats)
+{
+    uint64_t oldest = written > STATS_SPAN ? written - STATS_SPAN : 0;
+    uint64_t low, high, last;
+    uint32_t from;
+
+    stats->seconds = seconds;
+    stats->count = 0;
+    if (written == 0 || seconds == 0)
+        return 0;
+
+    // Binary search the first sample inside the window
+    last = written - 1;
+    from = sampleAt(last)->time >= seconds ? sampleAt(last)->time - seconds + 1 : 0;
+    low = oldest;
+    high = written;
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        if (sampleAt(mid)->time < from)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low == written)
+        return 0;
+
+    const Sample *first = sampleAt(low);
+    const Sample *end = sampleAt(last);
+    uint32_t count = (uint32_t)(written - low);
+    double sum = (double)(end->sum - first->sum + first->value);
+    double sumSq = (double)(end->sumSq - first->sumSq + (int64_t)first->value * first->value);
+    double mean = sum / count;
+    double var = sumSq / count - mean * mean;
+
+    stats->count = count;
+    stats->mean = (float)(mean / SCALE);
+    stats->stddev = var > 0 ? (float)(sqrt(var) / SCALE) : 0.0f;
+    stats->min = (float)sampleAt(minDeque.seq[(minDeque.head + firstInWindow(&minDeque, from)) % CAPACITY])->value / SCALE;
+    stats->max = (float)sampleAt(maxDeque.seq[(maxDeque.head + firstInWindow(&maxDeque, from)) % CAPACITY])->value / SCALE;
+
+    return count;
+}
+
+/*******************************************************************************
+ * @brief    Pushes a sample to the back of a deque. Entries it dominates are
+ *           dropped from the back, entries older than STATS_SPAN from the
+ *           front.
+ ******************************************************************************/
+static void pushDeque(Deque *d, uint64_t seq)
+{
+    int32_t value = sampleAt(seq)->value * d->sign;
+
+    while (d->count > 0 &&
+           sampleAt(d->seq[(d->head + d->count - 1) % CAPACITY])->value * d->sign >= value)
+        d->count--;
+
+    while (d->count > 0 && d->seq[d->head] + STATS_SPAN <= seq) {
+        d->head = (d->head + 1) % CAPACITY;
+        d->count--;
+    }
+
+    d->seq[(d->head + d->count) % CAPACITY] = seq;
+    d->count++;
+}
+
+/*******************************************************************************
+ * @brief    Binary search for the position of the first deque entry not
+ *           older than from. The times of the entries are increasing.
+ ******************************************************************************/
+static uint32_t firstInWindow(const Deque *d, uint32_t from)
+{
+    uint32_t low = 0, high = d->count - 1;
+
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (sampleAt(d->seq[(d->head + mid) % CAPACITY])->time < from)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+/*******************************************************************************
+ * @brief    Returns a sample by its number.
+ ******************************************************************************/
+static const Sample *sampleAt(uint64_t seq)
+{
+    return &samples[seq % CAPACITY];
+}
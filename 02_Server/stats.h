@@ -0,0 +1,24 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+//-----Header-Files----------------------------------------------------------------
+#include <stdint.h>
+
+//-----Macros----------------------------------------------------------------------
+#define STATS_SPAN      3600        // Longest window in samples (1 h at 1 Hz)
+
+//-----Data types------------------------------------------------------------------
+typedef struct {
+    uint32_t seconds;       // Length of the window
+    uint32_t count;         // Samples in the window
+    float min;
+    float max;
+    float mean;
+    float stddev;           // Population standard deviation
+} WindowStats;
+
+//-----Function prototypes---------------------------------------------------------
+extern void addStatsSample(uint32_t time, float value);
+extern int  getWindowStats(uint32_t seconds, WindowStats *stats);
+
+#endif
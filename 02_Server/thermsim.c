@@ -0,0 +1,231 @@
+/*******************************************************************************
+ * @file       thermsim.c
+ *******************************************************************************
+ *
+ * @brief      Lumped thermal model of houses with several rooms.
+ *
+ * @details    Every room has a heat capacity, a conductance through the
+ *             envelope to the outdoor temperature of its house, a
+ *             conductance to the next room and a heater. The temperatures
+ *             are integrated with the explicit Euler method; a step longer
+ *             than the stable step of the fastest room is split into equal
+ *             substeps. Every parameter is an aligned array over all rooms
+ *             of all houses, so the compiler vectorizes the step and
+ *             thousands of houses are stepped per second.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              initThermalSim
+ *              closeThermalSim
+ *              setThermalRoom
+ *              setThermalOutdoor
+ *              setThermalHeater
+ *              getThermalTemp
+ *              stepThermalSim
+ *
+ *  Functions  local:
+ *              getStableStep
+ *              integrate
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "thermsim.h"
+
+//----- Macros -----------------------------------------------------------------
+#define THERMAL_ALIGN 64                // Arrays start on a cache line
+#define THERMAL_ARRAYS 8                // Arrays in one allocation
+
+//----- Function prototypes ----------------------------------------------------
+static float getStableStep(const ThermalSim *sim);
+static void  integrate(ThermalSim *sim, float h);
+
+/*******************************************************************************
+ * @brief    Allocates the rooms of a number of houses, all with the default
+ *           parameters, heaters off and at the same temperature.
+ *
+ * @param    sim     Simulator to initialize.
+ * @param    houses  Number of houses.
+ * @param    rooms   Rooms per house.
+ * @param    temp    Initial room and outdoor temperature in °C.
+ * @return   0 if successful, -1 on failure.
+ ******************************************************************************/
+int initThermalSim(ThermalSim *sim, int houses, int rooms, float temp)
+{
+    memset(sim, 0, sizeof(*sim));
+    if (houses <= 0 || rooms <= 0)
+        return -1;
+
+    // One extra element per array for the padding of temp and flow, rounded
+    // up to whole cache lines
+    size_t stride = ((size_t)houses * rooms + 1 + THERMAL_ALIGN / sizeof(float) - 1)
+                    & ~(THERMAL_ALIGN / sizeof(float) - 1);
+    float *block;
+    if (posix_memalign((void **)&block, THERMAL_ALIGN, THERMAL_ARRAYS * stride * sizeof(float)) != 0)
+        return -1;
+    memset(block, 0, THERMAL_ARRAYS * stride * sizeof(float));
+
+    sim->houses = houses;
+    sim->rooms = rooms;
+    sim->count = houses * rooms;
+    sim->block = block;
+    sim->temp = block;
+    sim->invCapacity = block + stride;
+    sim->envelope = block + 2 * stride;
+    sim->link = block + 3 * stride;
+    sim->heater = block + 4 * stride;
+    sim->level = block + 5 * stride;
+    sim->outdoor = block + 6 * stride;
+    sim->flow = block + 7 * stride + 1;
+
+    for (int i = 0; i < sim->count; i++) {
+        sim->temp[i] = temp;
+        sim->outdoor[i] = temp;
+        sim->invCapacity[i] = 1.0f / THERMAL_CAPACITY;
+        sim->envelope[i] = THERMAL_ENVELOPE;
+        sim->link[i] = (i % rooms == rooms - 1) ? 0.0f : THERMAL_LINK;
+        sim->heater[i] = THERMAL_HEATER;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Releases the arrays of a simulator.
+ ******************************************************************************/
+void closeThermalSim(ThermalSim *sim)
+{
+    free(sim->block);
+    memset(sim, 0, sizeof(*sim));
+}
+
+/*******************************************************************************
+ * @brief    Sets the parameters of a room.
+ *
+ * @param    capacity  Heat capacity in J/K, must be positive.
+ * @param    envelope  Conductance to the outside in W/K.
+ * @param    link      Conductance to the next room in W/K, ignored for the
+ *                     last room of a house.
+ * @param    heater    Heater power in W.
+ ******************************************************************************/
+void setThermalRoom(ThermalSim *sim, int house, int room, float capacity, float envelope, float link, float heater)
+{
+    int i = house * sim->rooms + room;
+
+    sim->invCapacity[i] = 1.0f / capacity;
+    sim->envelope[i] = envelope;
+    sim->link[i] = room == sim->rooms - 1 ? 0.0f : link;
+    sim->heater[i] = heater;
+    sim->maxStep = 0.0f;
+}
+
+/*******************************************************************************
+ * @brief    Sets the outdoor temperature of a house in °C.
+ ******************************************************************************/
+void setThermalOutdoor(ThermalSim *sim, int house, float temp)
+{
+    float *outdoor = sim->outdoor + house * sim->rooms;
+
+    for (int room = 0; room < sim->rooms; room++) {
+        outdoor[room] = temp;
+    }
+}
+
+/*******************************************************************************
+ * @brief    Sets the heater of a room, 0 (off) to 1 (full power).
+ ******************************************************************************/
+void setThermalHeater(ThermalSim *sim, int house, int room, float level)
+{
+    sim->level[house * sim->rooms + room] = level;
+}
+
+/*******************************************************************************
+ * @brief    Returns the temperature of a room in °C.
+ ******************************************************************************/
+float getThermalTemp(const ThermalSim *sim, int house, int room)
+{
+    return sim->temp[house * sim->rooms + room];
+}
+
+/*******************************************************************************
+ * @brief    Advances all houses by a time step, split into substeps if it
+ *           exceeds the stable step.
+ *
+ * @param    sim  Simulator.
+ * @param    dt   Time step in s.
+ ******************************************************************************/
+void stepThermalSim(ThermalSim *sim, float dt)
+{
+    if (sim->maxStep <= 0.0f)
+        sim->maxStep = getStableStep(sim);
+
+    int steps = (int)ceilf(dt / sim->maxStep);
+    if (steps < 1)
+        steps = 1;
+
+    float h = dt / steps;
+    for (int i = 0; i < steps; i++) {
+        integrate(sim, h);
+    }
+}
+
+/*******************************************************************************
+ * @brief    Returns the longest time step that keeps every room from
+ *           overshooting: its capacity over the sum of its conductances.
+ ******************************************************************************/
+static float getStableStep(const ThermalSim *sim)
+{
+    float step = INFINITY;
+
+    for (int i = 0; i < sim->count; i++) {
+        float conductance = sim->envelope[i] + sim->link[i];
+        if (i % sim->rooms != 0)
+            conductance += sim->link[i - 1];
+        if (conductance > 0.0f && 1.0f / (sim->invCapacity[i] * conductance) < step)
+            step = 1.0f / (sim->invCapacity[i] * conductance);
+    }
+
+    return isinf(step) ? 3600.0f : step;
+}
+
+/*******************************************************************************
+ * @brief    One explicit Euler step of all rooms. The first pass computes the
+ *           heat flow between neighbours, the second one the heat balance of
+ *           every room; both are plain loops over the arrays.
+ *
+ * @param    sim  Simulator.
+ * @param    h    Time step in s, at most the stable step.
+ ******************************************************************************/
+static void integrate(ThermalSim *sim, float h)
+{
+    const int count = sim->count;
+    float *restrict temp = sim->temp;
+    float *restrict flow = sim->flow;
+    const float *restrict invCapacity = sim->invCapacity;
+    const float *restrict envelope = sim->envelope;
+    const float *restrict link = sim->link;
+    const float *restrict heater = sim->heater;
+    const float *restrict level = sim->level;
+    const float *restrict outdoor = sim->outdoor;
+
+    // Heat flow to the next room, the link of the last room of a house is 0
+    // and temp[count] is padding
+    for (int i = 0; i < count; i++) {
+        flow[i] = link[i] * (temp[i + 1] - temp[i]);
+    }
+
+    // Heater, envelope and the flows from both neighbours, flow[-1] is 0
+    for (int i = 0; i < count; i++) {
+        float power = heater[i] * level[i] + envelope[i] * (outdoor[i] - temp[i]) + flow[i] - flow[i - 1];
+        temp[i] += h * invCapacity[i] * power;
+    }
+}
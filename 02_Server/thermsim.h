@@ -0,0 +1,47 @@
+#ifndef THERMSIM_H_
+#define THERMSIM_H_
+
+//-----Header-Files----------------------------------------------------------------
+#include <stdint.h>
+
+//-----Macros----------------------------------------------------------------------
+// Defaults of a room, sized for the model house: a 2 kW heater warms a
+// cold room by about 0.05 °C per second
+#define THERMAL_CAPACITY    40000.0f    // Heat capacity in J/K
+#define THERMAL_ENVELOPE    40.0f       // Conductance to the outside in W/K
+#define THERMAL_LINK        30.0f       // Conductance to the next room in W/K
+#define THERMAL_HEATER      2000.0f     // Heater power in W
+
+//-----Data types------------------------------------------------------------------
+/**
+ * Rooms of all houses in structure-of-arrays layout, room r of house h at
+ * index h * rooms + r. The rooms of a house are a row, each one exchanges
+ * heat with the next one, so a step is two streaming passes over the
+ * arrays without gathers or branches.
+ */
+typedef struct {
+    int houses;
+    int rooms;                      // Rooms per house
+    int count;                      // houses * rooms
+    float *temp;                    // Temperature in °C, count + 1 (padding)
+    float *invCapacity;             // 1 / heat capacity in K/J
+    float *envelope;                // Conductance to the outside in W/K
+    float *link;                    // Conductance to the next room in W/K, 0 for the last room
+    float *heater;                  // Heater power in W
+    float *level;                   // Heater level, 0 (off) to 1 (full power)
+    float *outdoor;                 // Outdoor temperature in °C
+    float *flow;                    // Heat flow to the next room in W, flow[-1] is 0
+    float maxStep;                  // Longest stable time step in s, 0 to recompute
+    void *block;                    // Allocation holding all arrays
+} ThermalSim;
+
+//-----Function prototypes---------------------------------------------------------
+extern int   initThermalSim(ThermalSim *sim, int houses, int rooms, float temp);
+extern void  closeThermalSim(ThermalSim *sim);
+extern void  setThermalRoom(ThermalSim *sim, int house, int room, float capacity, float envelope, float link, float heater);
+extern void  setThermalOutdoor(ThermalSim *sim, int house, float temp);
+extern void  setThermalHeater(ThermalSim *sim, int house, int room, float level);
+extern float getThermalTemp(const ThermalSim *sim, int house, int room);
+extern void  stepThermalSim(ThermalSim *sim, float dt);
+
+#endif
@@ -0,0 +1,317 @@
+/*******************************************************************************
+ * @file       timerwheel.c
+ *******************************************************************************
+ *
+ * @brief      Hashed hierarchical timer wheel driven by a timerfd.
+ *
+ * @details    All periodic work of the server (temperature model, keepalive
+ *             pings, idle eviction, persistence) is scheduled on this wheel
+ *             and executed from the main event loop, so no extra threads are
+ *             needed. The wheel has TW_LEVELS levels of TW_SLOTS slots each.
+ *             Timers are kept in intrusive lists, which makes starting and
+ *             stopping a timer O(1). Timers of the upper levels are cascaded
+ *             down whenever the lower level wraps around.
+ *             A tick lasts TW_TICK_MS of the clock (clock.c): the timerfd
+ *             fires faster in scaled time, and in virtual time it stays
+ *             disarmed and the event loop calls stepTimerWheel().
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              initTimerWheel
+ *              closeTimerWheel
+ *              getTimerWheelFd
+ *              processTimerWheel
+ *              stepTimerWheel
+ *              getTimerWheelTicks
+ *              initTimer
+ *              startTimer
+ *              stopTimer
+ *              isTimerActive
+ *
+ *  Functions  local:
+ *              linkTimer
+ *              unlinkTimer
+ *              cascadeLevel
+ *              advanceTick
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/timerfd.h>
+
+#include "timerwheel.h"
+#include "clock.h"
+#include "log.h"
+
+//----- Macros -----------------------------------------------------------------
+#define TW_LEVEL_SPAN(level) ((uint64_t)1 << (TW_SLOT_BITS * ((level) + 1)))
+#define TW_MAX_DELTA (TW_LEVEL_SPAN(TW_LEVELS - 1) - 1)
+
+//----- Function prototypes ----------------------------------------------------
+static void linkTimer(TimerEntry *timer);
+static void unlinkTimer(TimerEntry *timer);
+static void cascadeLevel(int level);
+static void advanceTick(void);
+
+//----- Global variables -------------------------------------------------------
+static TimerEntry *wheel[TW_LEVELS][TW_SLOTS];
+static uint64_t currentTick = 0;
+static int timerFd = -1;
+
+/*******************************************************************************
+ * @brief    Creates the timerfd that drives the wheel at TW_TICK_MS of the
+ *           clock. The timerfd of a virtual clock is never armed.
+ *
+ * @return   The file descriptor to be watched by the event loop, -1 on error.
+ ******************************************************************************/
+int initTimerWheel(void)
+{
+    memset(wheel, 0, sizeof(wheel));
+    currentTick = 0;
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd < 0) {
+        logError("timerfd_create failed: %s", strerror(errno));
+        return -1;
+    }
+
+    struct itimerspec spec;
+    uint64_t interval = (uint64_t)(TW_TICK_MS * 1000000L / getClockScale());
+    if (interval == 0)
+        interval = 1;
+    spec.it_interval.tv_sec = interval / 1000000000;
+    spec.it_interval.tv_nsec = interval % 1000000000;
+    spec.it_value = spec.it_interval;
+    if (getClockMode() == CLOCK_VIRTUAL)
+        memset(&spec, 0, sizeof(spec));
+
+    if (timerfd_settime(timerFd, 0, &spec, NULL) < 0) {
+        logError("timerfd_settime failed: %s", strerror(errno));
+        close(timerFd);
+        timerFd = -1;
+        return -1;
+    }
+
+    return timerFd;
+}
+
+/*******************************************************************************
+ * @brief    Closes the timerfd. Pending timers are simply dropped.
+ ******************************************************************************/
+void closeTimerWheel(void)
+{
+    if (timerFd >= 0) {
+        close(timerFd);
+        timerFd = -1;
+    }
+}
+
+/*******************************************************************************
+ * @brief    Returns the timerfd of the wheel.
+ ******************************************************************************/
+int getTimerWheelFd(void)
+{
+    return timerFd;
+}
+
+/*******************************************************************************
+ * @brief    Returns the number of ticks processed since initTimerWheel().
+ ******************************************************************************/
+uint64_t getTimerWheelTicks(void)
+{
+    return currentTick;
+}
+
+/*******************************************************************************
+ * @brief    Consumes the timerfd and runs all timers that became due.
+ *           Ticks missed because the loop was busy are caught up here.
+ ******************************************************************************/
+void processTimerWheel(void)
+{
+    uint64_t expirations;
+
+    if (read(timerFd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        if (errno != EAGAIN)
+            logError("timerfd read failed: %s", strerror(errno));
+        return;
+    }
+
+    while (expirations--)
+        advanceTick();
+}
+
+/*******************************************************************************
+ * @brief    Advances a virtual clock by one tick and runs the timers that
+ *           became due. Used instead of the timerfd in virtual time.
+ ******************************************************************************/
+void stepTimerWheel(void)
+{
+    advanceClock(TW_TICK_MS * 1000000ull);
+    advanceTick();
+}
+
+/*******************************************************************************
+ * @brief    Prepares a timer before its first use.
+ *
+ * @param    timer     Timer to initialize.
+ * @param    callback  Function called on expiry.
+ * @param    arg       User argument handed to the callback.
+ ******************************************************************************/
+void initTimer(TimerEntry *timer, TimerCallback callback, void *arg)
+{
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->period = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+/*******************************************************************************
+ * @brief    (Re)starts a timer. A running timer is rescheduled.
+ *
+ * @param    timer      Initialized timer.
+ * @param    delay_ms   Time until the first expiry.
+ * @param    period_ms  Reload interval, 0 for a one-shot timer.
+ ******************************************************************************/
+void startTimer(TimerEntry *timer, uint32_t delay_ms, uint32_t period_ms)
+{
+    uint64_t delay = (delay_ms + TW_TICK_MS - 1) / TW_TICK_MS;
+
+    if (delay == 0)
+        delay = 1;
+
+    unlinkTimer(timer);
+    timer->expires = currentTick + delay;
+    timer->period = (period_ms + TW_TICK_MS - 1) / TW_TICK_MS;
+    if (period_ms && timer->period == 0)
+        timer->period = 1;
+    linkTimer(timer);
+}
+
+/*******************************************************************************
+ * @brief    Stops a timer. Stopping an idle timer has no effect.
+ ******************************************************************************/
+void stopTimer(TimerEntry *timer)
+{
+    unlinkTimer(timer);
+}
+
+/*******************************************************************************
+ * @brief    Returns TRUE (1) if the timer is scheduled.
+ ******************************************************************************/
+int isTimerActive(const TimerEntry *timer)
+{
+    return timer->pprev != NULL;
+}
+
+/*******************************************************************************
+ * @brief    Inserts a timer into the slot that matches its expiry.
+ *           Timers beyond the range of the wheel are parked in the last
+ *           slot of the top level and re-linked when it is cascaded.
+ ******************************************************************************/
+static void linkTimer(TimerEntry *timer)
+{
+    uint64_t expires = timer->expires;
+    uint64_t delta = expires > currentTick ? expires - currentTick : 0;
+    TimerEntry **slot;
+    int level;
+
+    if (delta > TW_MAX_DELTA) {
+        delta = TW_MAX_DELTA;
+        expires = currentTick + delta;
+    }
+
+    for (level = 0; level < TW_LEVELS - 1; level++) {
+        if (delta < TW_LEVEL_SPAN(level))
+            break;
+    }
+
+    if (delta == 0)
+        expires = currentTick;
+
+    slot = &wheel[level][(expires >> (TW_SLOT_BITS * level)) & TW_SLOT_MASK];
+
+    timer->next = *slot;
+    if (timer->next)
+        timer->next->pprev = &timer->next;
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+/*******************************************************************************
+ * @brief    Removes a timer from whatever list it is currently linked in.
+ ******************************************************************************/
+static void unlinkTimer(TimerEntry *timer)
+{
+    if (!timer->pprev)
+        return;
+
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/*******************************************************************************
+ * @brief    Moves all timers of the current slot of a level one level down.
+ ******************************************************************************/
+static void cascadeLevel(int level)
+{
+    int index = (currentTick >> (TW_SLOT_BITS * level)) & TW_SLOT_MASK;
+    TimerEntry *timer = wheel[level][index];
+
+    wheel[level][index] = NULL;
+    while (timer) {
+        TimerEntry *next = timer->next;
+        timer->next = NULL;
+        timer->pprev = NULL;
+        linkTimer(timer);
+        timer = next;
+    }
+}
+
+/*******************************************************************************
+ * @brief    Advances the wheel by one tick and runs the expired timers.
+ ******************************************************************************/
+static void advanceTick(void)
+{
+    TimerEntry *expired;
+    int level;
+
+    currentTick++;
+
+    // Cascade the upper levels whenever the level below wraps around
+    for (level = 1; level < TW_LEVELS; level++) {
+        if ((currentTick & (TW_LEVEL_SPAN(level - 1) - 1)) != 0)
+            break;
+        cascadeLevel(level);
+    }
+
+    // Detach the due slot, so callbacks may freely start and stop timers
+    expired = wheel[0][currentTick & TW_SLOT_MASK];
+    wheel[0][currentTick & TW_SLOT_MASK] = NULL;
+    if (expired)
+        expired->pprev = &expired;
+
+    while (expired) {
+        TimerEntry *timer = expired;
+
+        unlinkTimer(timer);
+        if (timer->period) {
+            timer->expires = currentTick + timer->period;
+            linkTimer(timer);
+        }
+        timer->callback(timer, timer->arg);
+    }
+}
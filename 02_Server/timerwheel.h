@@ -0,0 +1,44 @@
+#ifndef TIMERWHEEL_H_
+#define TIMERWHEEL_H_
+
+//-----Header-Files----------------------------------------------------------------
+#include <stdint.h>
+
+//-----Macros----------------------------------------------------------------------
+#define TW_TICK_MS      10                      // Resolution of one wheel tick
+#define TW_SLOT_BITS    6
+#define TW_SLOTS        (1 << TW_SLOT_BITS)     // Slots per level
+#define TW_SLOT_MASK    (TW_SLOTS - 1)
+#define TW_LEVELS       4                       // 64^4 ticks, ~46 hours at 10 ms
+
+//-----Data types------------------------------------------------------------------
+struct TimerEntry;
+typedef void (*TimerCallback)(struct TimerEntry *timer, void *arg);
+
+/**
+ * Intrusive timer node. The owner embeds it into its own structure, so that
+ * starting and stopping a timer never allocates and is O(1).
+ */
+typedef struct TimerEntry {
+    struct TimerEntry *next;        // Next timer in the same slot
+    struct TimerEntry **pprev;      // Link pointing to this timer, NULL if idle
+    uint64_t expires;               // Absolute expiry in ticks
+    uint32_t period;                // Reload in ticks, 0 for one-shot timers
+    TimerCallback callback;         // Called from processTimerWheel()
+    void *arg;                      // User argument for the callback
+} TimerEntry;
+
+//-----Function prototypes---------------------------------------------------------
+extern int  initTimerWheel(void);
+extern void closeTimerWheel(void);
+extern int  getTimerWheelFd(void);
+extern void processTimerWheel(void);
+extern void stepTimerWheel(void);
+extern uint64_t getTimerWheelTicks(void);
+
+extern void initTimer(TimerEntry *timer, TimerCallback callback, void *arg);
+extern void startTimer(TimerEntry *timer, uint32_t delay_ms, uint32_t period_ms);
+extern void stopTimer(TimerEntry *timer);
+extern int  isTimerActive(const TimerEntry *timer);
+
+#endif
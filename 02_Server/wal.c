@@ -0,0 +1,371 @@
+/*******************************************************************************
+ * @file       wal.c
+ *******************************************************************************
+ *
+ * @brief      Append-only write-ahead log for the Webhouse state.
+ *
+ * @details    Every state mutation is appended as a fixed-size, checksummed
+ *             record. Records are buffered and written with a single
+ *             fdatasync() per event loop iteration (group commit), so all
+ *             commands acknowledged after syncWal() are durable without an
+ *             fsync per command. The log only holds the mutations since the
+ *             last snapshot, resetWal() truncates it once a snapshot with
+ *             the current sequence number is safely on disk.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              openWal
+ *              closeWal
+ *              replayWal
+ *              logWal
+ *              sealWal
+ *              reserveWal
+ *              syncWal
+ *              resetWal
+ *              isWalPending
+ *              isWalBatchOpen
+ *              getWalSeq
+ *              getWalSize
+ *              crc32
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "wal.h"
+#include "log.h"
+
+//----- Macros -----------------------------------------------------------------
+#define WAL_CRC_LEN offsetof(WalRecord, crc)
+
+//----- Global variables -------------------------------------------------------
+static int walFd = -1;
+static uint32_t snapshotSeq = 0;        // Batches up to here are in the snapshot
+static uint32_t committedSeq = 0;       // Last sealed batch
+static WalRecord buffer[WAL_BUFFER_RECORDS];
+static int bufferCount = 0;             // Records not yet written
+static int batchOpen = 0;               // Records logged since the last seal
+static int batchFailed = 0;             // A record of the open batch was refused
+static long batchOffset = 0;            // Offset of the open batch in the log
+static long walSize = 0;                // Bytes on disk
+static int unsynced = 0;                // Written records wait for fdatasync()
+
+/*******************************************************************************
+ * @brief    Opens (or creates) the log file.
+ *
+ * @param    filename     Path of the log file.
+ * @param    seq          Sequence number contained in the loaded snapshot,
+ *                        older batches are skipped on replay.
+ * @return   0 if successful, -1 on failure.
+ ******************************************************************************/
+int openWal(const char *filename, uint32_t seq)
+{
+    walFd = open(filename, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (walFd < 0) {
+        logError("Error opening file %s: %s", filename, strerror(errno));
+        return -1;
+    }
+
+    snapshotSeq = seq;
+    committedSeq = seq;
+    bufferCount = 0;
+    batchOpen = 0;
+    batchFailed = 0;
+    unsynced = 0;
+    walSize = lseek(walFd, 0, SEEK_END);
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Writes outstanding records and closes the log.
+ ******************************************************************************/
+void closeWal(void)
+{
+    if (walFd < 0)
+        return;
+
+    sealWal();
+    syncWal();
+    close(walFd);
+    walFd = -1;
+}
+
+/*******************************************************************************
+ * @brief    Replays all committed batches newer than the snapshot.
+ *           A torn or corrupted tail (power cut during a write) and an
+ *           uncommitted last batch are cut off, so new records follow the
+ *           last valid batch.
+ *
+ * @param    apply  Called for every replayed record in log order.
+ * @return   Number of replayed batches, -1 on failure.
+ ******************************************************************************/
+int replayWal(WalApplyFn apply)
+{
+    struct stat st;
+    WalRecord *records;
+    size_t count, batchStart = 0, i, j;
+    long good = 0;
+    int batches = 0;
+
+    if (fstat(walFd, &st) < 0)
+        return -1;
+    if (st.st_size == 0)
+        return 0;
+
+    records = malloc(st.st_size);
+    if (!records)
+        return -1;
+
+    if (pread(walFd, records, st.st_size, 0) != st.st_size) {
+        free(records);
+        return -1;
+    }
+
+    count = st.st_size / sizeof(WalRecord);
+    for (i = 0; i < count; i++) {
+        if (crc32(&records[i], WAL_CRC_LEN) != records[i].crc)
+            break;
+        if (!(records[i].flags & WAL_FLAG_COMMIT))
+            continue;
+
+        if (records[i].seq > snapshotSeq) {
+            for (j = batchStart; j <= i; j++)
+                apply(records[j].key, records[j].value);
+            batches++;
+        }
+        if (records[i].seq > committedSeq)
+            committedSeq = records[i].seq;
+
+        batchStart = i + 1;
+        good = (long)batchStart * sizeof(WalRecord);
+    }
+    free(records);
+
+    if (good < st.st_size) {
+        logWarn("WAL: discarding %ld bytes of incomplete tail", (long)st.st_size - good);
+        if (ftruncate(walFd, good) < 0)
+            return -1;
+    }
+    walSize = good;
+
+    return batches;
+}
+
+/*******************************************************************************
+ * @brief    Appends a mutation to the current batch. Nothing is written
+ *           until syncWal() is called. The mutation is refused if the log is
+ *           not open, or if the buffer is full and cannot be written; the
+ *           open batch is then aborted by the next sealWal().
+ *
+ * @return   0 if the mutation was logged, -1 if it was refused.
+ ******************************************************************************/
+int logWal(uint8_t key, int32_t value)
+{
+    if (batchFailed || walFd < 0 || (bufferCount == WAL_BUFFER_RECORDS && syncWal() < 0)) {
+        batchFailed = 1;
+        return -1;
+    }
+    if (!batchOpen)
+        batchOffset = walSize + (long)(bufferCount * sizeof(WalRecord));
+
+    WalRecord *rec = &buffer[bufferCount++];
+    rec->seq = committedSeq + 1;
+    rec->key = key;
+    rec->flags = 0;
+    rec->reserved = 0;
+    rec->value = value;
+    rec->crc = crc32(rec, WAL_CRC_LEN);
+    batchOpen++;
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Closes the current batch. The mutations logged since the last
+ *           seal are replayed all together or not at all: if one of them was
+ *           refused, the others are removed from the buffer and the log.
+ *
+ * @return   0 if the batch was sealed or empty, -1 if it was aborted.
+ ******************************************************************************/
+int sealWal(void)
+{
+    if (batchFailed) {
+        batchFailed = 0;
+        if (batchOpen && batchOffset >= walSize) {
+            bufferCount = (int)((batchOffset - walSize) / (long)sizeof(WalRecord));
+        }
+        else if (batchOpen) {
+            // Part of the batch was written when the buffer ran full
+            bufferCount = 0;
+            if (ftruncate(walFd, batchOffset) == 0)
+                walSize = batchOffset;
+            else
+                logError("WAL truncate failed: %s", strerror(errno));
+        }
+        batchOpen = 0;
+        return -1;
+    }
+    if (!batchOpen)
+        return 0;
+
+    WalRecord *rec = &buffer[bufferCount - 1];
+    rec->flags |= WAL_FLAG_COMMIT;
+    rec->crc = crc32(rec, WAL_CRC_LEN);
+    committedSeq++;
+    batchOpen = 0;
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Makes room for the records of a command before it changes
+ *           anything, writing the buffer if needed. Must not be called
+ *           inside a batch that may not be written yet.
+ *
+ * @param    records  Most records the command logs.
+ * @return   0 if the records fit, -1 if the log is not open or cannot be
+ *           written.
+ ******************************************************************************/
+int reserveWal(int records)
+{
+    if (walFd < 0)
+        return -1;
+    if (WAL_BUFFER_RECORDS - bufferCount < records && syncWal() < 0)
+        return -1;
+
+    return WAL_BUFFER_RECORDS - bufferCount >= records ? 0 : -1;
+}
+
+/*******************************************************************************
+ * @brief    Writes all buffered records and flushes them to the medium with
+ *           one fdatasync() (group commit). Records that could not be
+ *           written stay buffered for the next call.
+ *
+ * @return   0 if all records are on the medium, -1 otherwise.
+ ******************************************************************************/
+int syncWal(void)
+{
+    const char *data = (const char *)buffer;
+    size_t len = bufferCount * sizeof(WalRecord);
+    size_t done = 0;
+
+    if (len == 0 && !unsynced)
+        return 0;
+    if (walFd < 0)
+        return -1;
+
+    while (done < len) {
+        ssize_t written = write(walFd, data + done, len - done);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            logError("WAL write failed: %s", strerror(errno));
+            // Cut off a partial write, the retry appends all records again
+            if (done > 0 && ftruncate(walFd, walSize) < 0)
+                logError("WAL truncate failed: %s", strerror(errno));
+            return -1;
+        }
+        done += written;
+    }
+    walSize += len;
+    bufferCount = 0;
+
+    // Written but not synced records are synced again by the next call
+    unsynced = 1;
+    if (fdatasync(walFd) < 0) {
+        logError("WAL fdatasync failed: %s", strerror(errno));
+        return -1;
+    }
+    unsynced = 0;
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Empties the log after a snapshot covering getWalSeq() has been
+ *           made durable.
+ *
+ * @return   0 if successful, -1 on failure.
+ ******************************************************************************/
+int resetWal(void)
+{
+    if (syncWal() < 0)
+        return -1;
+
+    if (walFd >= 0 && ftruncate(walFd, 0) < 0) {
+        logError("WAL truncate failed: %s", strerror(errno));
+        return -1;
+    }
+    walSize = 0;
+    snapshotSeq = committedSeq;
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Returns TRUE (1) if records are waiting for syncWal(), also
+ *           written ones whose fdatasync() failed.
+ ******************************************************************************/
+int isWalPending(void)
+{
+    return bufferCount > 0 || unsynced;
+}
+
+/*******************************************************************************
+ * @brief    Returns TRUE (1) if records were logged since the last seal.
+ ******************************************************************************/
+int isWalBatchOpen(void)
+{
+    return batchOpen > 0;
+}
+
+/*******************************************************************************
+ * @brief    Returns the sequence number of the last sealed batch.
+ ******************************************************************************/
+uint32_t getWalSeq(void)
+{
+    return committedSeq;
+}
+
+/*******************************************************************************
+ * @brief    Returns the size of the log on disk in bytes.
+ ******************************************************************************/
+long getWalSize(void)
+{
+    return walSize;
+}
+
+/*******************************************************************************
+ * @brief    Computes the CRC-32 (IEEE 802.3) of a buffer.
+ ******************************************************************************/
+uint32_t crc32(const void *data, size_t len)
+{
+    static uint32_t table[256];
+    const uint8_t *p = data;
+    uint32_t crc = 0xFFFFFFFF;
+
+    if (!table[1]) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+
+    while (len--)
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+    return crc ^ 0xFFFFFFFF;
+}
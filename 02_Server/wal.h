@@ -0,0 +1,45 @@
+#ifndef WAL_H_
+#define WAL_H_
+
+//-----Header-Files----------------------------------------------------------------
+#include <stdint.h>
+#include <stddef.h>
+
+//-----Macros----------------------------------------------------------------------
+#define WAL_FLAG_COMMIT     0x01    // Last record of a batch
+#define WAL_BUFFER_RECORDS  256     // Records buffered between two syncs
+
+//-----Data types------------------------------------------------------------------
+/**
+ * One state mutation as stored in the log. All records of a batch share the
+ * same sequence number, the last one carries WAL_FLAG_COMMIT. A batch is only
+ * replayed when its commit record made it to disk.
+ */
+typedef struct {
+    uint32_t seq;       // Batch sequence number
+    uint8_t key;        // State key, defined by the user of the log
+    uint8_t flags;      // WAL_FLAG_*
+    uint16_t reserved;
+    int32_t value;      // New value of the key
+    uint32_t crc;       // CRC-32 over the preceding 12 bytes
+} WalRecord;
+
+typedef void (*WalApplyFn)(uint8_t key, int32_t value);
+
+//-----Function prototypes---------------------------------------------------------
+extern int  openWal(const char *filename, uint32_t seq);
+extern void closeWal(void);
+extern int  replayWal(WalApplyFn apply);
+extern int  logWal(uint8_t key, int32_t value);
+extern int  sealWal(void);
+extern int  reserveWal(int records);
+extern int  syncWal(void);
+extern int  resetWal(void);
+extern int  isWalPending(void);
+extern int  isWalBatchOpen(void);
+extern uint32_t getWalSeq(void);
+extern long getWalSize(void);
+
+extern uint32_t crc32(const void *data, size_t len);
+
+#endif
@@ -0,0 +1,746 @@
+/*******************************************************************************
+ * @file       wsbench.c
+ *******************************************************************************
+ *
+ * @brief      WebSocket load generator and latency benchmark of the server.
+ *
+ * @details    Opens a number of WebSocket connections to the server, sends a
+ *             weighted mix of read, toggle and led_pwm write commands and
+ *             matches the responses by their id. In the closed loop every
+ *             connection keeps a fixed number of commands outstanding, in
+ *             the open loop commands are sent at a fixed total rate and the
+ *             latency is measured from the scheduled send time, so a stalled
+ *             server is not hidden by a stalled client. Coalesced write
+ *             acknowledgements complete all writes up to the id they carry.
+ *             Reports throughput, percentiles and errors per command kind.
+ *
+ *             wsbench [-H host] [-p port] [-c connections] [-d seconds]
+ *                     [-w warmup] [-r rate] [-q depth] [-m read:60,toggle:20,write:20]
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              main
+ *
+ *  Functions  local:
+ *              getTime
+ *              parseMix
+ *              pickKind
+ *              openConnection
+ *              flushConnection
+ *              sendFrame
+ *              sendCommand
+ *              completeCommand
+ *              handleFrame
+ *              readConnection
+ *              addSample
+ *              compareSamples
+ *              printSamples
+ *              getPercentile
+ *              printReport
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+//----- Macros -----------------------------------------------------------------
+#define TRUE 1
+#define FALSE 0
+
+#define MAX_CONNECTIONS 256
+#define INFLIGHT_MAX 1024       // Outstanding commands per connection, power of 2
+#define RX_SIZE 65536           // Receive buffer per connection
+#define TX_SIZE 65536           // Send buffer per connection
+#define DRAIN_MS 2000           // Wait for outstanding responses after the run
+#define MAX_EVENTS 64
+
+#define KIND_READ 0
+#define KIND_TOGGLE 1
+#define KIND_WRITE 2
+#define KINDS 3
+
+#define EV_TIMER MAX_CONNECTIONS    // epoll tag of the send timer
+
+#define HANDSHAKE_REQUEST "GET / HTTP/1.1\r\nHost: %s:%d\r\nUpgrade: websocket\r\n" \
+                          "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" \
+                          "Sec-WebSocket-Version: 13\r\n\r\n"
+
+//----- Data types -------------------------------------------------------------
+typedef struct {
+    uint64_t sent;              // Scheduled send time in ns, 0 if the slot is free
+    int kind;                   // KIND_*
+} Inflight;
+
+typedef struct {
+    int fd;                     // -1 once closed
+    uint32_t nextId;            // Id of the next command
+    uint32_t lowId;             // No command below this id is outstanding
+    int outstanding;
+    Inflight inflight[INFLIGHT_MAX];
+    char rx[RX_SIZE];
+    int rx_len;
+    char tx[TX_SIZE];
+    int tx_len;
+} BenchConnection;
+
+typedef struct {
+    uint64_t *ns;               // Latencies of the measured commands
+    size_t count;
+    size_t size;
+    uint64_t sent;              // Commands sent in the measured interval
+    uint64_t failed;            // Responses with status Error
+} Samples;
+
+//----- Function prototypes ----------------------------------------------------
+static uint64_t getTime(void);
+static int  parseMix(const char *mix, int weights[KINDS]);
+static int  pickKind(void);
+static int  openConnection(BenchConnection *conn, const struct sockaddr_in *addr, int index);
+static int  flushConnection(BenchConnection *conn);
+static int  sendFrame(BenchConnection *conn, int opcode, const char *payload, int len);
+static int  sendCommand(BenchConnection *conn, uint64_t scheduled);
+static void completeCommand(BenchConnection *conn, uint32_t id, int coalesced, int failed);
+static void handleFrame(BenchConnection *conn, int opcode, char *payload, int len);
+static int  readConnection(BenchConnection *conn);
+static void addSample(int kind, uint64_t ns);
+static int  compareSamples(const void *a, const void *b);
+static void printSamples(const char *name, Samples *s, double seconds);
+static double getPercentile(const Samples *s, double percentile);
+static void printReport(double seconds);
+
+//----- Global variables -------------------------------------------------------
+static const char *kindNames[KINDS] = { "read", "toggle", "write" };
+static int weights[KINDS] = { 60, 20, 20 };
+static int weightSum = 100;
+static uint32_t randomState = 2463534242u;
+
+static BenchConnection *connections;
+static int connectionCount = 4;
+static int epollId;
+static Samples samples[KINDS];
+static uint64_t measureStart;           // Commands sent before are warmup
+static uint64_t measureEnd;             // End of the run, no command is sent after it
+static uint64_t timeouts = 0;           // Outstanding after the drain
+static uint64_t overruns = 0;           // Open loop sends skipped, window full
+static uint64_t closed = 0;             // Connections lost during the run
+
+/*******************************************************************************
+ * @brief    Runs the benchmark.
+ ******************************************************************************/
+int main(int argc, char **argv)
+{
+    const char *host = "127.0.0.1";
+    int port = 8000;
+    double duration = 10.0;
+    double warmup = 1.0;
+    double rate = 0.0;
+    int depth = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:p:c:d:w:r:q:m:")) != -1) {
+        switch (opt) {
+        case 'H': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'c': connectionCount = atoi(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        case 'w': warmup = atof(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        case 'q': depth = atoi(optarg); break;
+        case 'm':
+            if (parseMix(optarg, weights) < 0) {
+                fprintf(stderr, "Invalid mix: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-H host] [-p port] [-c connections] [-d seconds] [-w warmup]\n"
+                            "       [-r rate] [-q depth] [-m read:60,toggle:20,write:20]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (connectionCount < 1 || connectionCount > MAX_CONNECTIONS || depth < 1 || depth > INFLIGHT_MAX ||
+        duration <= 0 || warmup < 0 || rate < 0) {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+    weightSum = weights[KIND_READ] + weights[KIND_TOGGLE] + weights[KIND_WRITE];
+
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address: %s\n", host);
+        return 1;
+    }
+
+    epollId = epoll_create1(0);
+    connections = calloc(connectionCount, sizeof(BenchConnection));
+    if (epollId < 0 || !connections) {
+        perror("wsbench");
+        return 1;
+    }
+
+    // Connect and complete all handshakes before the load starts
+    for (int i = 0; i < connectionCount; i++) {
+        if (openConnection(&connections[i], &addr, i) < 0) {
+            fprintf(stderr, "Connection %d to %s:%d failed: %s\n", i, host, port, strerror(errno));
+            return 1;
+        }
+    }
+
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = EV_TIMER };
+    epoll_ctl(epollId, EPOLL_CTL_ADD, timerFd, &ev);
+
+    uint64_t start = getTime();
+    uint64_t interval = rate > 0 ? (uint64_t)(1e9 / rate) : 0;
+    uint64_t nextSend = start;
+    int next = 0;
+    measureStart = start + (uint64_t)(warmup * 1e9);
+    measureEnd = measureStart + (uint64_t)(duration * 1e9);
+
+    printf("wsbench: %d connections, %s", connectionCount, interval ? "open loop" : "closed loop");
+    if (interval)
+        printf(" at %.0f/s", rate);
+    else
+        printf(" with %d outstanding", depth);
+    printf(", mix read:%d toggle:%d write:%d, %.1f s after %.1f s warmup\n",
+           weights[KIND_READ], weights[KIND_TOGGLE], weights[KIND_WRITE], duration, warmup);
+
+    if (!interval) {
+        for (int i = 0; i < connectionCount; i++) {
+            for (int d = 0; d < depth; d++) {
+                sendCommand(&connections[i], start);
+            }
+        }
+    }
+
+    for (;;) {
+        uint64_t now = getTime();
+        int running = now < measureEnd;
+
+        if (!running) {
+            int outstanding = 0;
+            for (int i = 0; i < connectionCount; i++) {
+                if (connections[i].fd >= 0)
+                    outstanding += connections[i].outstanding;
+            }
+            if (outstanding == 0 || now >= measureEnd + DRAIN_MS * 1000000ull)
+                break;
+        }
+
+        // Open loop: send everything that is due, then sleep until the next
+        if (interval && running) {
+            while (nextSend <= now) {
+                for (int tries = 0; tries < connectionCount; tries++) {
+                    BenchConnection *conn = &connections[next++ % connectionCount];
+                    if (conn->fd >= 0) {
+                        sendCommand(conn, nextSend);
+                        break;
+                    }
+                }
+                nextSend += interval;
+            }
+            struct itimerspec its = { { 0, 0 }, { nextSend / 1000000000, nextSend % 1000000000 } };
+            timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, NULL);
+        }
+
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epollId, events, MAX_EVENTS, running ? 100 : 10);
+        for (int e = 0; e < n; e++) {
+            uint32_t tag = events[e].data.u32;
+            if (tag == EV_TIMER) {
+                uint64_t expirations;
+                if (read(timerFd, &expirations, sizeof(expirations)) < 0) {
+                    // Spurious wakeup, the loop checks the time anyway
+                }
+                continue;
+            }
+
+            BenchConnection *conn = &connections[tag];
+            if (conn->fd < 0)
+                continue;
+            if ((events[e].events & EPOLLOUT) && flushConnection(conn) < 0)
+                continue;
+            if ((events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && readConnection(conn) < 0)
+                continue;
+
+            // Closed loop: refill the window of the connection
+            if (!interval && getTime() < measureEnd) {
+                while (conn->fd >= 0 && conn->outstanding < depth) {
+                    if (sendCommand(conn, getTime()) < 0)
+                        break;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < connectionCount; i++) {
+        if (connections[i].fd >= 0) {
+            timeouts += connections[i].outstanding;
+            close(connections[i].fd);
+        }
+    }
+
+    printReport(duration);
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Returns the monotonic clock in nanoseconds.
+ ******************************************************************************/
+static uint64_t getTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*******************************************************************************
+ * @brief    Parses a command mix like "read:60,toggle:20,write:20". Kinds
+ *           that are not listed get the weight 0.
+ *
+ * @return   0 if successful, -1 if the mix is invalid or empty.
+ ******************************************************************************/
+static int parseMix(const char *mix, int weights[KINDS])
+{
+    char copy[128];
+    char *saveptr = NULL;
+    int sum = 0;
+
+    snprintf(copy, sizeof(copy), "%s", mix);
+    memset(weights, 0, KINDS * sizeof(int));
+
+    for (char *s = strtok_r(copy, ",", &saveptr); s; s = strtok_r(NULL, ",", &saveptr)) {
+        char *colon = strchr(s, ':');
+        int kind = -1;
+
+        if (!colon)
+            return -1;
+        *colon = '\0';
+        for (int k = 0; k < KINDS; k++) {
+            if (strcmp(s, kindNames[k]) == 0)
+                kind = k;
+        }
+        if (kind < 0 || atoi(colon + 1) < 0)
+            return -1;
+        weights[kind] = atoi(colon + 1);
+        sum += weights[kind];
+    }
+
+    return sum > 0 ? 0 : -1;
+}
+
+/*******************************************************************************
+ * @brief    Picks the kind of the next command by the weights of the mix.
+ ******************************************************************************/
+static int pickKind(void)
+{
+    // xorshift32, the same sequence on every run
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+
+    int r = (int)(randomState % (uint32_t)weightSum);
+    for (int k = 0; k < KINDS; k++) {
+        if (r < weights[k])
+            return k;
+        r -= weights[k];
+    }
+
+    return KIND_READ;
+}
+
+/*******************************************************************************
+ * @brief    Connects, performs the WebSocket handshake and registers the
+ *           connection in epoll.
+ *
+ * @return   0 if successful, -1 otherwise.
+ ******************************************************************************/
+static int openConnection(BenchConnection *conn, const struct sockaddr_in *addr, int index)
+{
+    char request[256];
+    char host[INET_ADDRSTRLEN];
+    int one = 1;
+
+    conn->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (conn->fd < 0)
+        return -1;
+    if (connect(conn->fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        close(conn->fd);
+        conn->fd = -1;
+        return -1;
+    }
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    inet_ntop(AF_INET, &addr->sin_addr, host, sizeof(host));
+    int len = snprintf(request, sizeof(request), HANDSHAKE_REQUEST, host, ntohs(addr->sin_port));
+    if (send(conn->fd, request, len, MSG_NOSIGNAL) != len)
+        return -1;
+
+    // Blocking read of the upgrade response, frames behind it are kept
+    char *end = NULL;
+    while (!end) {
+        int n = recv(conn->fd, conn->rx + conn->rx_len, RX_SIZE - 1 - conn->rx_len, 0);
+        if (n <= 0) {
+            errno = n == 0 ? ECONNRESET : errno;
+            return -1;
+        }
+        conn->rx_len += n;
+        conn->rx[conn->rx_len] = '\0';
+        end = strstr(conn->rx, "\r\n\r\n");
+    }
+    if (strncmp(conn->rx, "HTTP/1.1 101", 12) != 0) {
+        errno = EPROTO;
+        return -1;
+    }
+    end += 4;
+    conn->rx_len -= (int)(end - conn->rx);
+    memmove(conn->rx, end, conn->rx_len);
+
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)index };
+    return epoll_ctl(epollId, EPOLL_CTL_ADD, conn->fd, &ev);
+}
+
+/*******************************************************************************
+ * @brief    Sends as much of the send buffer as the socket takes. Waits for
+ *           EPOLLOUT while data is left.
+ *
+ * @return   0 if successful, -1 if the connection was lost.
+ ******************************************************************************/
+static int flushConnection(BenchConnection *conn)
+{
+    int sent = 0;
+
+    while (sent < conn->tx_len) {
+        ssize_t n = send(conn->fd, conn->tx + sent, conn->tx_len - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EAGAIN)
+            break;
+        if (n <= 0) {
+            close(conn->fd);
+            conn->fd = -1;
+            closed++;
+            return -1;
+        }
+        sent += (int)n;
+    }
+    conn->tx_len -= sent;
+    memmove(conn->tx, conn->tx + sent, conn->tx_len);
+
+    struct epoll_event ev = { .events = EPOLLIN | (conn->tx_len ? EPOLLOUT : 0),
+                              .data.u32 = (uint32_t)(conn - connections) };
+    epoll_ctl(epollId, EPOLL_CTL_MOD, conn->fd, &ev);
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Queues a masked client frame and sends it.
+ *
+ * @return   0 if successful, -1 if the send buffer is full or the
+ *           connection was lost.
+ ******************************************************************************/
+static int sendFrame(BenchConnection *conn, int opcode, const char *payload, int len)
+{
+    uint8_t mask[4];
+    int header = len < 126 ? 6 : 8;
+
+    if (conn->tx_len + header + len > TX_SIZE || len > 0xFFFF)
+        return -1;
+
+    uint8_t *frame = (uint8_t *)conn->tx + conn->tx_len;
+    frame[0] = 0x80 | opcode;
+    if (len < 126) {
+        frame[1] = 0x80 | len;
+    }
+    else {
+        frame[1] = 0x80 | 126;
+        frame[2] = (uint8_t)(len >> 8);
+        frame[3] = (uint8_t)len;
+    }
+
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    memcpy(mask, &randomState, sizeof(mask));
+    memcpy(frame + header - 4, mask, sizeof(mask));
+    for (int i = 0; i < len; i++) {
+        frame[header + i] = (uint8_t)payload[i] ^ mask[i % 4];
+    }
+    conn->tx_len += header + len;
+
+    return flushConnection(conn);
+}
+
+/*******************************************************************************
+ * @brief    Sends the next command of the mix on a connection.
+ *
+ * @param    conn       Connection to send on.
+ * @param    scheduled  Time the command was due, the latency starts here.
+ * @return   0 if successful, -1 otherwise.
+ ******************************************************************************/
+static int sendCommand(BenchConnection *conn, uint64_t scheduled)
+{
+    char command[160];
+    uint32_t id = conn->nextId;
+    int kind = pickKind();
+    int len;
+
+    if (id - conn->lowId >= INFLIGHT_MAX) {
+        overruns++;
+        return -1;
+    }
+
+    switch (kind) {
+    case KIND_TOGGLE:
+        len = snprintf(command, sizeof(command), "{\"id\":%u,\"action\":\"toggle\",\"utility\":\"lamp_floor\"}", id);
+        break;
+    case KIND_WRITE:
+        len = snprintf(command, sizeof(command), "{\"id\":%u,\"action\":\"write\",\"utility\":\"led_pwm\",\"value\":%u}",
+                       id, randomState % 101);
+        break;
+    default:
+        len = snprintf(command, sizeof(command),
+                       "{\"id\":%u,\"action\":\"read\",\"utilities\":[\"tv\",\"heater\",\"temperature\",\"led_pwm\"]}", id);
+        break;
+    }
+
+    if (sendFrame(conn, 1, command, len) < 0) {
+        overruns++;
+        return -1;
+    }
+
+    Inflight *slot = &conn->inflight[id & (INFLIGHT_MAX - 1)];
+    slot->sent = scheduled ? scheduled : 1;
+    slot->kind = kind;
+    conn->nextId++;
+    conn->outstanding++;
+    if (scheduled >= measureStart && scheduled < measureEnd)
+        samples[kind].sent++;
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Completes the command with the given id. A coalesced write
+ *           acknowledgement completes all outstanding writes up to the id.
+ ******************************************************************************/
+static void completeCommand(BenchConnection *conn, uint32_t id, int coalesced, int failed)
+{
+    uint64_t now = getTime();
+    uint32_t from = coalesced ? conn->lowId : id;
+
+    if (id - conn->lowId >= INFLIGHT_MAX || id >= conn->nextId)
+        return;
+
+    for (uint32_t i = from; i != id + 1; i++) {
+        Inflight *slot = &conn->inflight[i & (INFLIGHT_MAX - 1)];
+        if (!slot->sent || (i != id && slot->kind != KIND_WRITE))
+            continue;
+
+        if (slot->sent >= measureStart && slot->sent < measureEnd) {
+            addSample(slot->kind, now - slot->sent);
+            if (failed)
+                samples[slot->kind].failed++;
+        }
+        slot->sent = 0;
+        conn->outstanding--;
+    }
+
+    while (conn->lowId != conn->nextId && !conn->inflight[conn->lowId & (INFLIGHT_MAX - 1)].sent)
+        conn->lowId++;
+}
+
+/*******************************************************************************
+ * @brief    Handles a frame received from the server.
+ ******************************************************************************/
+static void handleFrame(BenchConnection *conn, int opcode, char *payload, int len)
+{
+    if (opcode == 0x9) {
+        sendFrame(conn, 0xA, payload, len);
+        return;
+    }
+    if (opcode == 0x8) {
+        close(conn->fd);
+        conn->fd = -1;
+        closed++;
+        return;
+    }
+    if (opcode != 0x1)
+        return;
+
+    // Responses start with the echoed id, pushed events carry none
+    char saved = payload[len];
+    payload[len] = '\0';
+    if (strncmp(payload, "{\"id\":", 6) == 0) {
+        uint32_t id = (uint32_t)strtoul(payload + 6, NULL, 10);
+        completeCommand(conn, id, strstr(payload, "\"coalesced\":") != NULL,
+                        strstr(payload, "\"status\":\"Error\"") != NULL);
+    }
+    payload[len] = saved;
+}
+
+/*******************************************************************************
+ * @brief    Receives the pending data of a connection and handles all
+ *           complete frames.
+ *
+ * @return   0 if successful, -1 if the connection was lost.
+ ******************************************************************************/
+static int readConnection(BenchConnection *conn)
+{
+    for (;;) {
+        ssize_t n = recv(conn->fd, conn->rx + conn->rx_len, RX_SIZE - 1 - conn->rx_len, 0);
+        if (n < 0 && errno == EAGAIN)
+            break;
+        if (n <= 0) {
+            close(conn->fd);
+            conn->fd = -1;
+            closed++;
+            return -1;
+        }
+        conn->rx_len += (int)n;
+
+        int offset = 0;
+        while (conn->fd >= 0 && conn->rx_len - offset >= 2) {
+            uint8_t *frame = (uint8_t *)conn->rx + offset;
+            uint64_t len = frame[1] & 0x7F;
+            int header = 2;
+
+            if (len == 126) {
+                if (conn->rx_len - offset < 4)
+                    break;
+                len = ((uint64_t)frame[2] << 8) | frame[3];
+                header = 4;
+            }
+            else if (len == 127) {
+                if (conn->rx_len - offset < 10)
+                    break;
+                len = 0;
+                for (int i = 0; i < 8; i++)
+                    len = (len << 8) | frame[2 + i];
+                header = 10;
+            }
+            if (len > RX_SIZE - 1 - (uint64_t)header) {
+                close(conn->fd);
+                conn->fd = -1;
+                closed++;
+                return -1;
+            }
+            if ((uint64_t)(conn->rx_len - offset) < header + len)
+                break;
+
+            handleFrame(conn, frame[0] & 0x0F, (char *)frame + header, (int)len);
+            offset += header + (int)len;
+        }
+        if (conn->fd < 0)
+            return -1;
+
+        conn->rx_len -= offset;
+        memmove(conn->rx, conn->rx + offset, conn->rx_len);
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Stores the latency of a measured command.
+ ******************************************************************************/
+static void addSample(int kind, uint64_t ns)
+{
+    Samples *s = &samples[kind];
+
+    if (s->count == s->size) {
+        size_t size = s->size ? s->size * 2 : 65536;
+        uint64_t *grown = realloc(s->ns, size * sizeof(uint64_t));
+        if (!grown)
+            return;
+        s->ns = grown;
+        s->size = size;
+    }
+    s->ns[s->count++] = ns;
+}
+
+/*******************************************************************************
+ * @brief    qsort comparison of two latencies.
+ ******************************************************************************/
+static int compareSamples(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*******************************************************************************
+ * @brief    Prints the throughput and latency of one kind of command.
+ ******************************************************************************/
+static void printSamples(const char *name, Samples *s, double seconds)
+{
+    qsort(s->ns, s->count, sizeof(uint64_t), compareSamples);
+
+    printf("%-8s %10llu %10zu %10.0f %10.1f %10.1f %10.1f %10.1f\n", name,
+           (unsigned long long)s->sent, s->count, s->count / seconds,
+           getPercentile(s, 0.5), getPercentile(s, 0.99), getPercentile(s, 0.999), getPercentile(s, 1.0));
+}
+
+/*******************************************************************************
+ * @brief    Returns a percentile of sorted latencies in microseconds.
+ ******************************************************************************/
+static double getPercentile(const Samples *s, double percentile)
+{
+    if (s->count == 0)
+        return 0.0;
+
+    return s->ns[(size_t)(percentile * (s->count - 1))] / 1000.0;
+}
+
+/*******************************************************************************
+ * @brief    Prints throughput, latency percentiles and errors per kind and
+ *           for all commands.
+ ******************************************************************************/
+static void printReport(double seconds)
+{
+    Samples all = { 0 };
+
+    printf("%-8s %10s %10s %10s %10s %10s %10s %10s\n",
+           "kind", "sent", "done", "rate/s", "p50 us", "p99 us", "p99.9 us", "max us");
+
+    all.ns = malloc((samples[KIND_READ].count + samples[KIND_TOGGLE].count + samples[KIND_WRITE].count + 1) *
+                    sizeof(uint64_t));
+    for (int k = 0; k < KINDS; k++) {
+        all.sent += samples[k].sent;
+        all.failed += samples[k].failed;
+        if (all.ns) {
+            memcpy(all.ns + all.count, samples[k].ns, samples[k].count * sizeof(uint64_t));
+            all.count += samples[k].count;
+        }
+        if (samples[k].sent > 0)
+            printSamples(kindNames[k], &samples[k], seconds);
+    }
+    printSamples("all", &all, seconds);
+
+    printf("errors: %llu status, %llu timeout, %llu overrun, %llu closed\n",
+           (unsigned long long)all.failed, (unsigned long long)timeouts,
+           (unsigned long long)overruns, (unsigned long long)closed);
+    free(all.ns);
+}
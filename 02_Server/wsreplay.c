@@ -0,0 +1,819 @@
+/*******************************************************************************
+ * @file       wsreplay.c
+ *******************************************************************************
+ *
+ * @brief      Replays a captured session against a server and compares the
+ *             outcome with the capture.
+ *
+ * @details    Reads a file written by a server started with
+ *             WEBHOUSE_CAPTURE and opens a connection for every captured
+ *             one. The received frames are sent again as they were
+ *             captured, at the original speed, at a multiple of it, or as
+ *             fast as possible. Afterwards the latencies of both runs and the
+ *             final utility states are compared. A command is answered by
+ *             the next response on its connection, pushed events aside; a
+ *             coalesced acknowledgement answers as many commands as it
+ *             covers. The same rule is applied to the capture and to the
+ *             replay, so the numbers compare even where it is approximate.
+ *             Run the server with WEBHOUSE_GPIO_DEBUG=1 to stub out the
+ *             GPIO access, and start it from the state the capture started
+ *             with, otherwise the replay warns.
+ *
+ *             wsreplay [-H host] [-p port] [-s speed] capture.bin
+ *
+ *             -s 1 replays at the original speed (default), -s 10 ten
+ *             times faster and -s 0 as fast as possible.
+ *
+ * @version    1.0
+ * @date       Oktober 2026
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Functions  global:
+ *              main
+ *
+ *  Functions  local:
+ *              getTime
+ *              loadCapture
+ *              parseFrame
+ *              isResponse
+ *              getCoalesced
+ *              analyzeCapture
+ *              openConnection
+ *              closeConnection
+ *              sendFrame
+ *              answerCommands
+ *              readConnection
+ *              readState
+ *              compareStates
+ *              addSample
+ *              compareSamples
+ *              printSamples
+ *
+ ******************************************************************************/
+
+//----- Header-Files -----------------------------------------------------------
+#define _GNU_SOURCE             // memmem
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <math.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "jansson.h"
+#include "capture.h"
+#include "stateimage.h"
+
+//----- Macros -----------------------------------------------------------------
+#define TRUE 1
+#define FALSE 0
+
+#define MAX_SLOTS 65536         // Connection slots a capture can use
+#define PENDING_MAX 1024        // Unanswered commands per connection, power of 2
+#define RX_SIZE 65536
+#define DRAIN_MS 2000           // Wait for the responses of a closed connection
+#define MAX_EVENTS 64
+
+#define HANDSHAKE_REQUEST "GET / HTTP/1.1\r\nHost: %s:%d\r\nUpgrade: websocket\r\n" \
+                          "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" \
+                          "Sec-WebSocket-Version: 13\r\n\r\n"
+#define STATE_REQUEST "{\"action\":\"read\",\"utilities\":[\"tv\",\"heater\",\"lamp_floor\",\"lamp_ceil\",\"led_pwm\",\"thermostat\"]}"
+
+//----- Data types -------------------------------------------------------------
+// A captured record with its data
+typedef struct {
+    uint64_t ns;
+    uint16_t conn;
+    uint8_t type;
+    uint32_t len;
+    const char *data;
+    int instance;               // Connection instance of the slot, -1 if none
+} ReplayEvent;
+
+typedef struct {
+    int fd;                     // -1 if not open
+    int closing;                // TRUE once the capture closed it
+    uint64_t closeBy;           // Closed at this time even if responses are missing
+    int expected;               // Responses seen in the capture
+    int responses;
+    uint64_t pending[PENDING_MAX];  // Send times of the unanswered commands
+    uint32_t head;
+    uint32_t tail;
+    char rx[RX_SIZE];
+    int rx_len;
+} ReplayConnection;
+
+typedef struct {
+    uint64_t *ns;
+    size_t count;
+    size_t size;
+    uint64_t errors;            // Responses with status Error
+} Samples;
+
+//----- Function prototypes ----------------------------------------------------
+static uint64_t getTime(void);
+static int  loadCapture(const char *filename);
+static const char *parseFrame(const char *frame, uint32_t len, int *opcode, uint32_t *payload_len);
+static int  isResponse(const char *payload, uint32_t len);
+static int  getCoalesced(const char *payload, uint32_t len);
+static void analyzeCapture(void);
+static int  openConnection(void);
+static void closeConnection(ReplayConnection *conn);
+static int  sendFrame(int fd, int opcode, const char *payload, int len);
+static void answerCommands(uint64_t *pending, uint32_t *head, uint32_t tail, int count, uint64_t now, Samples *samples);
+static int  readConnection(ReplayConnection *conn);
+static int  readState(int32_t values[]);
+static int  compareStates(const char *what, const int32_t *expected, const int32_t *actual);
+static void addSample(Samples *samples, uint64_t ns);
+static int  compareSamples(const void *a, const void *b);
+static void printSamples(const char *name, Samples *samples);
+
+//----- Global variables -------------------------------------------------------
+static const char *stateNames[STATE_KEY_COUNT] = {
+    "tv", "heater", "lamp_floor", "lamp_ceil", "led_pwm", "thermostat", "setpoint", "hysteresis"
+};
+
+static char *captureData = NULL;
+static ReplayEvent *events = NULL;
+static int eventCount = 0;
+static int instanceCount = 0;
+static int *expectedResponses = NULL;   // Per connection instance
+static const int32_t *startState = NULL;
+static const int32_t *finalState = NULL;
+
+static struct sockaddr_in serverAddr;
+static int epollId;
+static ReplayConnection *connections = NULL;    // Per connection instance
+
+static Samples captured;
+static Samples replayed;
+static uint64_t capturedCommands = 0;
+static uint64_t replayedCommands = 0;
+static uint64_t lost = 0;               // Connections lost or refused during the replay
+
+/*******************************************************************************
+ * @brief    Replays the capture and prints the comparison.
+ *
+ * @return   0 if the final states match, 1 if they differ, 2 on errors.
+ ******************************************************************************/
+int main(int argc, char **argv)
+{
+    const char *host = "127.0.0.1";
+    int port = 8000;
+    double speed = 1.0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:p:s:")) != -1) {
+        switch (opt) {
+        case 'H': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 's': speed = atof(optarg); break;
+        default:
+            optind = argc;
+            break;
+        }
+    }
+    if (optind != argc - 1 || speed < 0) {
+        fprintf(stderr, "usage: %s [-H host] [-p port] [-s speed] capture.bin\n", argv[0]);
+        return 2;
+    }
+
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &serverAddr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address: %s\n", host);
+        return 2;
+    }
+    if (loadCapture(argv[optind]) < 0) {
+        fprintf(stderr, "Cannot read capture %s\n", argv[optind]);
+        return 2;
+    }
+    analyzeCapture();
+
+    connections = calloc(instanceCount ? instanceCount : 1, sizeof(ReplayConnection));
+    epollId = epoll_create1(0);
+    if (!connections || epollId < 0) {
+        perror("wsreplay");
+        return 2;
+    }
+    for (int i = 0; i < instanceCount; i++) {
+        connections[i].fd = -1;
+    }
+
+    int32_t state[STATE_KEY_COUNT];
+    if (startState) {
+        if (readState(state) < 0) {
+            fprintf(stderr, "Cannot read the state of %s:%d: %s\n", host, port, strerror(errno));
+            return 2;
+        }
+        compareStates("start state", startState, state);
+    }
+
+    printf("wsreplay: %d records, %d connections, %llu commands, replay %s",
+           eventCount, instanceCount, (unsigned long long)capturedCommands, speed > 0 ? "at " : "as fast as possible\n");
+    if (speed > 0)
+        printf("%gx speed\n", speed);
+
+    uint64_t start = getTime();
+    uint64_t first = eventCount ? events[0].ns : 0;
+    int next = 0;
+
+    for (;;) {
+        uint64_t now = getTime();
+
+        // Replay every record that is due
+        while (next < eventCount && (speed == 0 || start + (uint64_t)((events[next].ns - first) / speed) <= now)) {
+            ReplayEvent *event = &events[next++];
+            ReplayConnection *conn = event->instance >= 0 ? &connections[event->instance] : NULL;
+
+            if (!conn)
+                continue;
+
+            if (event->type == CAPTURE_OPEN) {
+                conn->expected = expectedResponses[event->instance];
+                conn->fd = openConnection();
+                if (conn->fd < 0) {
+                    lost++;
+                    continue;
+                }
+                struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)event->instance };
+                epoll_ctl(epollId, EPOLL_CTL_ADD, conn->fd, &ev);
+            }
+            else if (event->type == CAPTURE_IN && conn->fd >= 0) {
+                int opcode;
+                uint32_t payload_len;
+                parseFrame(event->data, event->len, &opcode, &payload_len);
+
+                // The frame is sent as captured, including its mask
+                if (send(conn->fd, event->data, event->len, MSG_NOSIGNAL) != (ssize_t)event->len) {
+                    closeConnection(conn);
+                    lost++;
+                    continue;
+                }
+                if (opcode == 0x1 && conn->tail - conn->head < PENDING_MAX) {
+                    conn->pending[conn->tail++ & (PENDING_MAX - 1)] = getTime();
+                    replayedCommands++;
+                }
+            }
+            else if (event->type == CAPTURE_CLOSE && conn->fd >= 0) {
+                conn->closing = TRUE;
+                conn->closeBy = now + DRAIN_MS * 1000000ull;
+            }
+        }
+
+        // Close the connections that got all their responses
+        int remaining = 0;
+        for (int i = 0; i < instanceCount; i++) {
+            ReplayConnection *conn = &connections[i];
+            if (conn->fd < 0)
+                continue;
+            if (next == eventCount && !conn->closing) {
+                conn->closing = TRUE;
+                conn->closeBy = now + DRAIN_MS * 1000000ull;
+            }
+            if (conn->closing && (conn->responses >= conn->expected || now >= conn->closeBy))
+                closeConnection(conn);
+            else
+                remaining++;
+        }
+        if (next == eventCount && remaining == 0)
+            break;
+
+        int timeout = 10;
+        if (speed > 0 && next < eventCount) {
+            uint64_t due = start + (uint64_t)((events[next].ns - first) / speed);
+            uint64_t wait = due > now ? (due - now + 999999) / 1000000 : 0;
+            timeout = wait < (uint64_t)timeout ? (int)wait : timeout;
+        }
+
+        struct epoll_event ready[MAX_EVENTS];
+        int n = epoll_wait(epollId, ready, MAX_EVENTS, timeout);
+        for (int e = 0; e < n; e++) {
+            ReplayConnection *conn = &connections[ready[e].data.u32];
+            if (conn->fd >= 0)
+                readConnection(conn);
+        }
+    }
+    double seconds = (getTime() - start) / 1e9;
+    double capturedSeconds = eventCount ? (events[eventCount - 1].ns - first) / 1e9 : 0.0;
+
+    printf("capture: %llu commands, %zu responses in %.1f s\n",
+           (unsigned long long)capturedCommands, captured.count, capturedSeconds);
+    printf("replay:  %llu commands, %zu responses in %.1f s, %llu connections lost\n",
+           (unsigned long long)replayedCommands, replayed.count, seconds, (unsigned long long)lost);
+    printf("%-8s %10s %10s %10s %10s %10s %10s\n", "latency", "responses", "errors", "p50 us", "p90 us", "p99 us", "max us");
+    printSamples("capture", &captured);
+    printSamples("replay", &replayed);
+
+    if (!finalState) {
+        printf("final state: not captured\n");
+        return 0;
+    }
+    if (readState(state) < 0) {
+        fprintf(stderr, "Cannot read the final state: %s\n", strerror(errno));
+        return 2;
+    }
+    return compareStates("final state", finalState, state) ? 1 : 0;
+}
+
+/*******************************************************************************
+ * @brief    Returns the monotonic clock in nanoseconds.
+ ******************************************************************************/
+static uint64_t getTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*******************************************************************************
+ * @brief    Reads a capture into memory and indexes its records. A record
+ *           cut off at the end (e.g. by a crash) is ignored.
+ *
+ * @return   0 if successful, -1 otherwise.
+ ******************************************************************************/
+static int loadCapture(const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    long size;
+
+    if (!file)
+        return -1;
+    if (fseek(file, 0, SEEK_END) < 0 || (size = ftell(file)) < (long)sizeof(CaptureHeader)) {
+        fclose(file);
+        return -1;
+    }
+    rewind(file);
+
+    captureData = malloc(size);
+    if (!captureData || fread(captureData, 1, size, file) != (size_t)size) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    CaptureHeader header;
+    memcpy(&header, captureData, sizeof(header));
+    if (header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION)
+        return -1;
+
+    // Count the records, then index them
+    for (int pass = 0; pass < 2; pass++) {
+        long offset = sizeof(header);
+        int count = 0;
+
+        while (offset + (long)sizeof(CaptureRecord) <= size) {
+            CaptureRecord record;
+            memcpy(&record, captureData + offset, sizeof(record));
+            if (offset + (long)sizeof(record) + (long)record.len > size)
+                break;
+
+            if (pass == 1) {
+                ReplayEvent *event = &events[count];
+                event->ns = record.ns;
+                event->conn = record.conn;
+                event->type = record.type;
+                event->len = record.len;
+                event->data = captureData + offset + sizeof(record);
+                event->instance = -1;
+            }
+            offset += sizeof(record) + record.len;
+            count++;
+        }
+
+        if (pass == 0) {
+            events = calloc(count ? count : 1, sizeof(ReplayEvent));
+            if (!events)
+                return -1;
+        }
+        eventCount = count;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Returns the payload of a WebSocket frame, unmasked frames only.
+ *
+ * @param    frame        Complete frame.
+ * @param    len          Length of the frame.
+ * @param    opcode       Receives the opcode.
+ * @param    payload_len  Receives the length of the payload.
+ * @return   The payload, NULL if the frame is incomplete.
+ ******************************************************************************/
+static const char *parseFrame(const char *frame, uint32_t len, int *opcode, uint32_t *payload_len)
+{
+    const uint8_t *bytes = (const uint8_t *)frame;
+    uint64_t size;
+    uint32_t header = 2;
+
+    *opcode = -1;
+    *payload_len = 0;
+    if (len < 2)
+        return NULL;
+
+    *opcode = bytes[0] & 0x0F;
+    size = bytes[1] & 0x7F;
+    if (size == 126) {
+        if (len < 4)
+            return NULL;
+        size = ((uint64_t)bytes[2] << 8) | bytes[3];
+        header = 4;
+    }
+    else if (size == 127) {
+        if (len < 10)
+            return NULL;
+        size = 0;
+        for (int i = 0; i < 8; i++)
+            size = (size << 8) | bytes[2 + i];
+        header = 10;
+    }
+    if (bytes[1] & 0x80)
+        header += 4;
+    if (header + size > len)
+        return NULL;
+
+    *payload_len = (uint32_t)size;
+    return frame + header;
+}
+
+/*******************************************************************************
+ * @brief    Returns TRUE if a text frame answers a command, FALSE for a
+ *           pushed event.
+ ******************************************************************************/
+static int isResponse(const char *payload, uint32_t len)
+{
+    return !memmem(payload, len, "\"type\":\"Event\"", 14);
+}
+
+/*******************************************************************************
+ * @brief    Returns the number of commands a response answers: the
+ *           coalesced count of a lamp acknowledgement, otherwise 1.
+ ******************************************************************************/
+static int getCoalesced(const char *payload, uint32_t len)
+{
+    const char *field = memmem(payload, len, "\"coalesced\":", 12);
+
+    if (!field)
+        return 1;
+
+    int count = atoi(field + 12);
+    return count > 0 ? count : 1;
+}
+
+/*******************************************************************************
+ * @brief    Assigns the records to connection instances, finds the start
+ *           and final states and measures the latencies of the capture.
+ ******************************************************************************/
+static void analyzeCapture(void)
+{
+    static int slotInstance[MAX_SLOTS];
+    static uint64_t *slotPending[MAX_SLOTS];
+    static uint32_t slotHead[MAX_SLOTS];
+    static uint32_t slotTail[MAX_SLOTS];
+
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        slotInstance[i] = -1;
+    }
+    expectedResponses = calloc(eventCount ? eventCount : 1, sizeof(int));
+
+    for (int i = 0; i < eventCount; i++) {
+        ReplayEvent *event = &events[i];
+        int opcode;
+        uint32_t len;
+
+        if (event->type == CAPTURE_STATE) {
+            if (event->len == STATE_KEY_COUNT * sizeof(int32_t)) {
+                if (!startState)
+                    startState = (const int32_t *)event->data;
+                else
+                    finalState = (const int32_t *)event->data;
+            }
+            continue;
+        }
+
+        if (event->type == CAPTURE_OPEN) {
+            slotInstance[event->conn] = instanceCount++;
+            if (!slotPending[event->conn])
+                slotPending[event->conn] = calloc(PENDING_MAX, sizeof(uint64_t));
+            slotHead[event->conn] = slotTail[event->conn] = 0;
+        }
+        event->instance = slotInstance[event->conn];
+        if (event->instance < 0)
+            continue;
+        if (event->type == CAPTURE_CLOSE)
+            slotInstance[event->conn] = -1;
+
+        const char *payload = parseFrame(event->data, event->len, &opcode, &len);
+        if (!payload || opcode != 0x1)
+            continue;
+
+        if (event->type == CAPTURE_IN) {
+            uint64_t *pending = slotPending[event->conn];
+            if (pending && slotTail[event->conn] - slotHead[event->conn] < PENDING_MAX) {
+                pending[slotTail[event->conn]++ & (PENDING_MAX - 1)] = event->ns;
+                capturedCommands++;
+            }
+        }
+        else if (event->type == CAPTURE_OUT && isResponse(payload, len)) {
+            expectedResponses[event->instance]++;
+            if (memmem(payload, len, "\"status\":\"Error\"", 16))
+                captured.errors++;
+            answerCommands(slotPending[event->conn], &slotHead[event->conn], slotTail[event->conn],
+                           getCoalesced(payload, len), event->ns, &captured);
+        }
+    }
+
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        free(slotPending[i]);
+    }
+}
+
+/*******************************************************************************
+ * @brief    Connects to the server and performs the handshake.
+ *
+ * @return   The socket, -1 on failure.
+ ******************************************************************************/
+static int openConnection(void)
+{
+    char request[256];
+    char response[1024];
+    char host[INET_ADDRSTRLEN];
+    int len = 0;
+    int one = 1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (const struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    inet_ntop(AF_INET, &serverAddr.sin_addr, host, sizeof(host));
+    int request_len = snprintf(request, sizeof(request), HANDSHAKE_REQUEST, host, ntohs(serverAddr.sin_port));
+    if (send(fd, request, request_len, MSG_NOSIGNAL) != request_len) {
+        close(fd);
+        return -1;
+    }
+
+    // The server answers the handshake alone, nothing follows before a command
+    while (len < (int)sizeof(response) - 1) {
+        int n = recv(fd, response + len, sizeof(response) - 1 - len, 0);
+        if (n <= 0)
+            break;
+        len += n;
+        response[len] = '\0';
+        if (strstr(response, "\r\n\r\n"))
+            break;
+    }
+    if (len < 12 || strncmp(response, "HTTP/1.1 101", 12) != 0) {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+/*******************************************************************************
+ * @brief    Closes a replayed connection.
+ ******************************************************************************/
+static void closeConnection(ReplayConnection *conn)
+{
+    epoll_ctl(epollId, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+}
+
+/*******************************************************************************
+ * @brief    Sends a masked client frame, small frames only.
+ *
+ * @return   0 if successful, -1 otherwise.
+ ******************************************************************************/
+static int sendFrame(int fd, int opcode, const char *payload, int len)
+{
+    char frame[6 + 125];
+    const char mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+
+    if (len > 125)
+        return -1;
+
+    frame[0] = (char)(0x80 | opcode);
+    frame[1] = (char)(0x80 | len);
+    memcpy(frame + 2, mask, sizeof(mask));
+    for (int i = 0; i < len; i++) {
+        frame[6 + i] = payload[i] ^ mask[i % 4];
+    }
+
+    return send(fd, frame, 6 + len, MSG_NOSIGNAL) == 6 + len ? 0 : -1;
+}
+
+/*******************************************************************************
+ * @brief    Completes the oldest unanswered commands of a connection.
+ *
+ * @param    pending  Send times of the unanswered commands.
+ * @param    head     Index of the oldest one, advanced.
+ * @param    tail     Index behind the newest one.
+ * @param    count    Commands answered by the response.
+ * @param    now      Time of the response.
+ * @param    samples  Receives the latencies.
+ ******************************************************************************/
+static void answerCommands(uint64_t *pending, uint32_t *head, uint32_t tail, int count, uint64_t now, Samples *samples)
+{
+    while (count-- > 0 && pending && *head != tail) {
+        addSample(samples, now - pending[(*head)++ & (PENDING_MAX - 1)]);
+    }
+}
+
+/*******************************************************************************
+ * @brief    Receives the frames of a replayed connection, answers pings and
+ *           measures the responses.
+ *
+ * @return   0 if successful, -1 if the connection was lost.
+ ******************************************************************************/
+static int readConnection(ReplayConnection *conn)
+{
+    for (;;) {
+        ssize_t n = recv(conn->fd, conn->rx + conn->rx_len, RX_SIZE - conn->rx_len, 0);
+        if (n < 0 && errno == EAGAIN)
+            return 0;
+        if (n <= 0) {
+            if (!conn->closing)
+                lost++;
+            closeConnection(conn);
+            return -1;
+        }
+        conn->rx_len += (int)n;
+
+        uint64_t now = getTime();
+        int offset = 0;
+        for (;;) {
+            int opcode;
+            uint32_t len;
+            const char *payload = parseFrame(conn->rx + offset, conn->rx_len - offset, &opcode, &len);
+            if (!payload)
+                break;
+
+            if (opcode == 0x9) {
+                sendFrame(conn->fd, 0xA, payload, (int)len);
+            }
+            else if (opcode == 0x1 && isResponse(payload, len)) {
+                conn->responses++;
+                if (memmem(payload, len, "\"status\":\"Error\"", 16))
+                    replayed.errors++;
+                answerCommands(conn->pending, &conn->head, conn->tail, getCoalesced(payload, len), now, &replayed);
+            }
+            offset = (int)(payload - conn->rx) + (int)len;
+        }
+
+        if (offset == 0 && conn->rx_len == RX_SIZE) {
+            lost++;
+            closeConnection(conn);
+            return -1;
+        }
+        conn->rx_len -= offset;
+        memmove(conn->rx, conn->rx + offset, conn->rx_len);
+    }
+}
+
+/*******************************************************************************
+ * @brief    Reads the utility states of the server on a new connection.
+ *
+ * @param    values  Receives the states indexed by STATE_* key.
+ * @return   0 if successful, -1 otherwise.
+ ******************************************************************************/
+static int readState(int32_t values[])
+{
+    char rx[4096];
+    int len = 0;
+    int opcode = -1;
+    uint32_t payload_len = 0;
+    const char *payload = NULL;
+
+    int fd = openConnection();
+    if (fd < 0)
+        return -1;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    if (sendFrame(fd, 0x1, STATE_REQUEST, (int)strlen(STATE_REQUEST)) < 0) {
+        close(fd);
+        return -1;
+    }
+    while (opcode != 0x1 && len < (int)sizeof(rx)) {
+        int n = recv(fd, rx + len, sizeof(rx) - len, 0);
+        if (n <= 0)
+            break;
+        len += n;
+        while ((payload = parseFrame(rx, len, &opcode, &payload_len)) != NULL && opcode != 0x1) {
+            int frame_len = (int)(payload - rx) + (int)payload_len;
+            len -= frame_len;
+            memmove(rx, rx + frame_len, len);
+        }
+    }
+    sendFrame(fd, 0x8, "", 0);
+    close(fd);
+    if (!payload || opcode != 0x1)
+        return -1;
+
+    json_error_t error;
+    json_t *root = json_loadb(payload, payload_len, 0, &error);
+    json_t *data = json_object_get(root, "data");
+    json_t *thermostat = json_object_get(data, "thermostat");
+    if (!json_is_object(data)) {
+        json_decref(root);
+        errno = EPROTO;
+        return -1;
+    }
+
+    for (int key = STATE_TV; key <= STATE_LED_PWM; key++) {
+        values[key] = (int32_t)json_integer_value(json_object_get(data, stateNames[key]));
+    }
+    values[STATE_THERMOSTAT] = (int32_t)json_integer_value(json_object_get(thermostat, "mode"));
+    values[STATE_SETPOINT] = (int32_t)lround(json_number_value(json_object_get(thermostat, "setpoint")) * 100);
+    values[STATE_HYSTERESIS] = (int32_t)lround(json_number_value(json_object_get(thermostat, "hysteresis")) * 100);
+
+    json_decref(root);
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief    Prints the differences of two sets of utility states.
+ *
+ * @return   The number of utilities that differ.
+ ******************************************************************************/
+static int compareStates(const char *what, const int32_t *expected, const int32_t *actual)
+{
+    int differences = 0;
+
+    for (int key = 0; key < STATE_KEY_COUNT; key++) {
+        int32_t value;
+        memcpy(&value, &expected[key], sizeof(value));
+        if (value != actual[key]) {
+            printf("%s differs: %s is %d, captured %d\n", what, stateNames[key], actual[key], value);
+            differences++;
+        }
+    }
+    if (differences == 0)
+        printf("%s matches\n", what);
+
+    return differences;
+}
+
+/*******************************************************************************
+ * @brief    Stores a latency.
+ ******************************************************************************/
+static void addSample(Samples *samples, uint64_t ns)
+{
+    if (samples->count == samples->size) {
+        size_t size = samples->size ? samples->size * 2 : 4096;
+        uint64_t *grown = realloc(samples->ns, size * sizeof(uint64_t));
+        if (!grown)
+            return;
+        samples->ns = grown;
+        samples->size = size;
+    }
+    samples->ns[samples->count++] = ns;
+}
+
+/*******************************************************************************
+ * @brief    qsort comparison of two latencies.
+ ******************************************************************************/
+static int compareSamples(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*******************************************************************************
+ * @brief    Prints the latency percentiles of a run.
+ ******************************************************************************/
+static void printSamples(const char *name, Samples *samples)
+{
+    double p[4] = { 0.5, 0.9, 0.99, 1.0 };
+    double us[4] = { 0 };
+
+    qsort(samples->ns, samples->count, sizeof(uint64_t), compareSamples);
+    for (int i = 0; i < 4 && samples->count; i++) {
+        us[i] = samples->ns[(size_t)(p[i] * (samples->count - 1))] / 1000.0;
+    }
+
+    printf("%-8s %10zu %10llu %10.1f %10.1f %10.1f %10.1f\n", name, samples->count,
+           (unsigned long long)samples->errors, us[0], us[1], us[2], us[3]);
+}